@@ -0,0 +1,160 @@
+#include <fstream>
+
+#include "corpus.h"
+
+namespace fs = std::filesystem;
+
+namespace cppgrep::bench {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+constexpr double MIB {1048576.0};
+constexpr double AVERAGE_TOKEN_SIZE {6.5}; //!< Average word size of the generated text, with its separator.
+
+/// Returns the stamp file of a corpus, which records its shape and its planted matches. It lives beside the corpus
+/// directory, so that it isn't searched.
+fs::path stamp_path(const fs::path& dir);
+
+/// Describes the shape of a corpus in one line.
+std::string shape(const CorpusSpec& spec);
+
+} // namespace impl
+
+Random::Random(uint64_t seed) noexcept
+    : m_state {seed ? seed : 0x9E3779B97F4A7C15ULL}
+{
+}
+
+uint64_t Random::next() noexcept
+{
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return m_state * 0x2545F4914F6CDD1DULL;
+}
+
+uint64_t Random::below(uint64_t bound) noexcept
+{
+    return next() % bound;
+}
+
+std::string corpus_pattern(const CorpusSpec& spec)
+{
+    constexpr std::string_view alphabet {"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"};
+
+    Random random {spec.seed * 31 + spec.pattern_size};
+    std::string pattern;
+    while (pattern.size() < spec.pattern_size)
+    {
+        pattern += alphabet[random.below(alphabet.size())];
+    }
+
+    return pattern;
+}
+
+uint64_t fill_text(std::string& text, size_t size, const std::string& pattern, double density, Random& random)
+{
+    // chance of a token being the pattern, out of 2^32
+    constexpr uint64_t scale {1ULL << 32};
+    const auto threshold = static_cast<uint64_t>(density * impl::AVERAGE_TOKEN_SIZE / impl::MIB * static_cast<double>(scale));
+
+    text.clear();
+    text.reserve(size + 128);
+
+    uint64_t planted {0};
+    while (text.size() < size)
+    {
+        auto line_end = text.size() + 40 + random.below(80);
+        while (text.size() < line_end)
+        {
+            // a pattern is only planted whole, so the last line may cut words but never a match
+            if (random.below(scale) < threshold && text.size() + pattern.size() <= size)
+            {
+                text += pattern;
+                ++planted;
+            }
+            else
+            {
+                for (auto length = 2 + random.below(8); length > 0; --length)
+                {
+                    text += static_cast<char>('a' + random.below(26));
+                }
+            }
+            text += ' ';
+        }
+        text.back() = '\n';
+    }
+
+    text.resize(size);
+    return planted;
+}
+
+fs::path generate_corpus(const fs::path& root, const CorpusSpec& spec)
+{
+    auto dir   = root / spec.name;
+    auto stamp = impl::stamp_path(dir);
+    auto shape = impl::shape(spec);
+
+    // a corpus with the same shape is the same corpus, since the generator is deterministic
+    if (std::ifstream stream {stamp}; stream.good())
+    {
+        std::string line;
+        if (std::getline(stream, line) && line == shape && fs::is_directory(dir))
+        {
+            return dir;
+        }
+    }
+
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    auto pattern = corpus_pattern(spec);
+    std::string text;
+    uint64_t planted {0};
+    for (size_t i {0}; i < spec.files; ++i)
+    {
+        auto file_dir = spec.fanout ? dir / ("d" + std::to_string(i / spec.fanout)) : dir;
+        if (spec.fanout && i % spec.fanout == 0)
+        {
+            fs::create_directory(file_dir);
+        }
+
+        // each file has its own seed, so its content doesn't depend on the files before it
+        Random random {spec.seed + i * 0x9E3779B97F4A7C15ULL};
+        planted += fill_text(text, spec.file_size, pattern, spec.density, random);
+
+        std::ofstream stream {file_dir / ("f" + std::to_string(i) + ".txt"), std::ios::binary};
+        stream.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+
+    std::ofstream stream {stamp, std::ios::trunc};
+    stream << shape << '\n' << planted << '\n';
+
+    return dir;
+}
+
+uint64_t corpus_matches(const fs::path& dir)
+{
+    std::ifstream stream {impl::stamp_path(dir)};
+
+    std::string line;
+    uint64_t planted {0};
+    std::getline(stream, line);
+    stream >> planted;
+
+    return planted;
+}
+
+fs::path impl::stamp_path(const fs::path& dir)
+{
+    return dir.parent_path() / (dir.filename().string() + ".corpus");
+}
+
+std::string impl::shape(const CorpusSpec& spec)
+{
+    return std::to_string(spec.files) + ' ' + std::to_string(spec.file_size) + ' ' + std::to_string(spec.fanout) + ' ' +
+           std::to_string(spec.pattern_size) + ' ' + std::to_string(spec.density) + ' ' + std::to_string(spec.seed);
+}
+
+} // namespace cppgrep::bench
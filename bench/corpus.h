@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace cppgrep::bench {
+
+/// Deterministic pseudo random numbers (xorshift64*), so that a seed always yields the same corpus.
+class Random
+{
+public:
+    explicit Random(uint64_t seed) noexcept;
+
+    uint64_t next() noexcept;
+
+    /// Returns a number in [0, bound).
+    uint64_t below(uint64_t bound) noexcept;
+
+private:
+    uint64_t m_state;
+};
+
+/// Shape of a synthetic corpus.
+struct CorpusSpec
+{
+    std::string name;         //!< Directory name of the corpus.
+    size_t files {1};         //!< Number of files.
+    size_t file_size {0};     //!< Size of each file, in bytes.
+    size_t fanout {0};        //!< Files per directory; 0 puts all files in the root.
+    size_t pattern_size {16}; //!< Size of the planted pattern, in bytes.
+    double density {0};       //!< Planted matches per MiB of text, on average.
+    uint64_t seed {1};        //!< Seed of the text and of the pattern.
+};
+
+/// Returns the pattern planted in a corpus. It is made of upper case letters and digits, which the generated text
+/// never has otherwise, so the matches of a search are exactly the planted ones.
+std::string corpus_pattern(const CorpusSpec& spec);
+
+/// Fills a buffer with lines of lower case words, planting the pattern at the given density.
+/// @returns the number of planted matches
+uint64_t fill_text(std::string& text, size_t size, const std::string& pattern, double density, Random& random);
+
+/// Writes a corpus under a root directory, unless it is already there with the same shape.
+/// @returns the directory of the corpus
+std::filesystem::path generate_corpus(const std::filesystem::path& root, const CorpusSpec& spec);
+
+/// Returns the number of matches planted in a corpus, as recorded when it was generated.
+uint64_t corpus_matches(const std::filesystem::path& dir);
+
+} // namespace cppgrep::bench
@@ -0,0 +1,462 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "corpus.h"
+#include "grep.h"
+
+#include "util/log.h"
+#include "util/sys.h"
+#include "util/thread_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace cppgrep::bench {
+
+/// Reaches the stages of a search that Grep keeps private, to time them alone.
+struct Access
+{
+    static size_t chunk_size(const Grep& grep) noexcept
+    {
+        return grep.m_chunk_size;
+    }
+
+    static void grep_chunk(Grep& grep, std::string_view data, size_t begin, size_t end, const FileContext& file)
+    {
+        grep.grep_chunk(data, begin, end, 0, begin / grep.m_chunk_size, file);
+    }
+
+    static void grep_file(Grep& grep, const fs::path& file_path)
+    {
+        grep.grep_file(file_path);
+    }
+
+    static void grep_dir(Grep& grep, const fs::path& dir_path)
+    {
+        grep.grep_dir(dir_path);
+    }
+
+    /// Waits for the queued work, like the end of a search, without its logs.
+    /// @returns the number of results
+    static uint64_t finish(Grep& grep) noexcept
+    {
+        if (grep.m_threadpool)
+        {
+            grep.m_threadpool->stop();
+        }
+        grep.m_output.flush();
+
+        return grep.stats().matches;
+    }
+};
+
+} // namespace cppgrep::bench
+
+using namespace cppgrep;
+using namespace cppgrep::bench;
+
+namespace {
+
+constexpr auto USAGE {"Usage: cppgrep_bench [options]\n"
+                      "Generates synthetic corpora, then times each stage of a search alone and end to end.\n"
+                      "Prints one JSON object per benchmark to stdout.\n"
+                      "Options:\n"
+                      "  --corpus=<dir>      where the corpora are generated, and kept for later runs\n"
+                      "                      (default: cppgrep_bench in the temporary directory)\n"
+                      "  --filter=<text>     only run the benchmarks whose name contains <text>\n"
+                      "  --repeat=<n>        runs of each benchmark (default 5)\n"
+                      "  --scale=<n>         multiplies the size of the corpora, in percent (default 100)\n"
+                      "  --threads=<n>       worker threads of the threaded runs (default: hardware concurrency)"};
+
+/// Settings of a benchmark run.
+struct Settings
+{
+    fs::path corpus {fs::temp_directory_path() / "cppgrep_bench"};
+    std::string filter;
+    size_t repeat {5};
+    size_t scale {100};
+    uint32_t threads {std::max(1U, std::thread::hardware_concurrency())};
+    int null_fd {-1}; //!< Descriptor the search results are discarded to.
+};
+
+/// Measurements of a benchmark.
+struct Result
+{
+    std::string name;
+    uint32_t threads {0};
+    uint64_t bytes {0};   //!< Bytes searched by a run.
+    uint64_t items {0};   //!< Files searched, or tasks run, by a run.
+    uint64_t matches {0}; //!< Results of the last run.
+    uint64_t expected {0};
+    std::vector<double> seconds {};
+};
+
+/// Parses an unsigned number, rejecting trailing characters.
+template <typename T>
+bool parse_number(std::string_view value, T& number)
+{
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+    return ec == std::errc {} && end == value.data() + value.size() && !value.empty();
+}
+
+/// Prints a result as a line of JSON.
+void print(const Result& result)
+{
+    auto sorted = result.seconds;
+    std::sort(sorted.begin(), sorted.end());
+    auto best   = sorted.front();
+    auto median = sorted[sorted.size() / 2];
+    auto rate   = [best](uint64_t count) { return best > 0 ? static_cast<double>(count) / best : 0.0; };
+
+    std::printf("{\"benchmark\":\"%s\",\"threads\":%u,\"runs\":%zu,\"bytes\":%lu,\"items\":%lu,\"matches\":%lu,\"expected\":%lu,"
+                "\"best_s\":%.6f,\"median_s\":%.6f,\"mib_per_s\":%.1f,\"items_per_s\":%.0f}\n",
+                result.name.c_str(), result.threads, sorted.size(), result.bytes, result.items, result.matches, result.expected, best, median,
+                rate(result.bytes) / 1048576.0, rate(result.items));
+    std::fflush(stdout);
+}
+
+/// Times the runs of a benchmark, unless the filter skips it. A run returns its number of results.
+template <typename Run>
+void measure(const Settings& settings, Result result, Run&& run)
+{
+    if (result.name.find(settings.filter) == std::string::npos)
+    {
+        return;
+    }
+
+    for (size_t i {0}; i < settings.repeat; ++i)
+    {
+        auto start     = std::chrono::steady_clock::now();
+        result.matches = run();
+        result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    print(result);
+}
+
+/// Search options of a benchmark run.
+Options search_options(const Settings& settings, uint32_t threads, uint32_t queue_depth = 0)
+{
+    Options options;
+    options.max_threads  = threads;
+    options.queue_depth  = queue_depth;
+    options.ignore_files = false;
+    options.output_fd    = settings.null_fd;
+    return options;
+}
+
+/// A few huge files.
+CorpusSpec huge_corpus(const Settings& settings)
+{
+    return {"huge", 4, (64ULL << 20) * settings.scale / 100, 0, 16, 64.0, 11};
+}
+
+/// Many tiny files spread over directories.
+CorpusSpec tiny_corpus(const Settings& settings)
+{
+    return {"tiny", 20000 * settings.scale / 100, 2048, 100, 16, 256.0, 13};
+}
+
+/// Counts the files and bytes of a corpus.
+std::pair<uint64_t, uint64_t> corpus_size(const fs::path& dir)
+{
+    uint64_t files {0};
+    uint64_t bytes {0};
+    for (const auto& entry: fs::recursive_directory_iterator {dir})
+    {
+        if (entry.is_regular_file())
+        {
+            ++files;
+            bytes += entry.file_size();
+        }
+    }
+
+    return {files, bytes};
+}
+
+/// Lists the files of a corpus in path order.
+std::vector<fs::path> corpus_files(const fs::path& dir)
+{
+    std::vector<fs::path> files;
+    for (const auto& entry: fs::recursive_directory_iterator {dir})
+    {
+        if (entry.is_regular_file())
+        {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    return files;
+}
+
+/// Tasks queued from outside the pool, through the injection queue.
+void bench_thread_pool(const Settings& settings)
+{
+    const uint64_t tasks {(1ULL << 20) * settings.scale / 100};
+
+    Result external {"thread_pool/external", settings.threads, 0, tasks};
+    measure(settings, external, [&] {
+        std::atomic_uint64_t done {0};
+        util::misc::ThreadPool pool {65536, settings.threads};
+        for (uint64_t i {0}; i < tasks; ++i)
+        {
+            pool.try_add_task([&done] { ++done; });
+        }
+        pool.stop();
+        return done.load();
+    });
+
+    // tasks queued by the workers themselves, splitting a range until single items: the deques and stealing
+    Result nested {"thread_pool/nested", settings.threads, 0, tasks};
+    measure(settings, nested, [&] {
+        std::atomic_uint64_t done {0};
+        util::misc::ThreadPool pool {65536, settings.threads};
+        std::function<void(uint64_t, uint64_t)> split = [&](uint64_t begin, uint64_t end) {
+            while (end - begin > 1)
+            {
+                auto middle = begin + (end - begin) / 2;
+                pool.try_add_task([&split, middle, end] { split(middle, end); });
+                end = middle;
+            }
+            ++done;
+        };
+        pool.try_add_task([&] { split(0, tasks); });
+        pool.stop();
+        return done.load();
+    });
+}
+
+/// The literal searchers alone over a buffer in memory, for each pattern length bucket: Boyer-Moore, then the
+/// scalar and widest vector kernels instantiated for the length.
+void bench_searcher(const Settings& settings)
+{
+    const size_t size {(64ULL << 20) * settings.scale / 100};
+
+    for (size_t pattern_size: {1U, 2U, 3U, 4U, 6U, 8U, 12U, 16U, 32U})
+    {
+        CorpusSpec spec {"memory", 1, size, 0, pattern_size, 64.0, 5};
+        auto planted_pattern = corpus_pattern(spec);
+
+        std::string text;
+        Random random {spec.seed};
+        auto planted = fill_text(text, size, planted_pattern, spec.density, random);
+
+        // the planted pattern's bytes never appear in the words, while a piece of the words has common bytes only
+        auto common_pattern = text.substr(text.size() / 2, pattern_size);
+        uint64_t common {0};
+        for (auto found = text.find(common_pattern); found != std::string::npos; found = text.find(common_pattern, found + 1))
+        {
+            ++common;
+        }
+
+        for (const auto& [pattern, bytes, expected]: {std::tuple {planted_pattern, "rare", planted}, std::tuple {common_pattern, "common", common}})
+        {
+            for (auto kind: {SearcherKind::BoyerMoore, SearcherKind::Scalar, SearcherKind::Auto})
+            {
+                auto searcher = Searcher::build(pattern, kind);
+                auto name     = "searcher/" + std::string {searcher->name()} + "/" + bytes + "/length" + std::to_string(pattern_size);
+                measure(settings, {name, 0, size, 1, 0, expected}, [&] {
+                    uint64_t matches {0};
+                    const auto last = text.data() + text.size();
+                    for (auto match = searcher->find(text.data(), last); match.position < last; match = searcher->find(match.position + 1, last))
+                    {
+                        ++matches;
+                    }
+                    return matches;
+                });
+            }
+        }
+    }
+}
+
+/// The search kernels over a buffer in memory, chunk by chunk, for each pattern size and match density.
+void bench_grep_chunk(const Settings& settings)
+{
+    const size_t size {(64ULL << 20) * settings.scale / 100};
+
+    for (size_t pattern_size: {4U, 16U, 64U})
+    {
+        for (double density: {0.0, 64.0, 4096.0})
+        {
+            CorpusSpec spec {"memory", 1, size, 0, pattern_size, density, 7};
+            auto pattern = corpus_pattern(spec);
+
+            std::string text;
+            Random random {spec.seed};
+            auto planted = fill_text(text, size, pattern, density, random);
+
+            auto grep       = Grep::build_grep(settings.corpus.string(), pattern, search_options(settings, 0));
+            auto chunk_size = Access::chunk_size(grep);
+
+            Result result {"grep_chunk/pattern" + std::to_string(pattern_size) + "/density" + std::to_string(static_cast<int>(density)),
+                           0, size, 1, 0, planted};
+            measure(settings, result, [&] {
+                FileContext file;
+                file.name = "memory";
+                for (size_t begin {0}; begin < size; begin += chunk_size)
+                {
+                    Access::grep_chunk(grep, text, begin, std::min(begin + chunk_size, size), file);
+                }
+                return file.matches.load();
+            });
+        }
+    }
+}
+
+/// Whole files: a few huge ones, mapped or read asynchronously, on the calling thread and on the pool.
+void bench_grep_file(const Settings& settings)
+{
+    auto spec          = huge_corpus(settings);
+    auto dir           = generate_corpus(settings.corpus, spec);
+    auto files         = corpus_files(dir);
+    auto [count, size] = corpus_size(dir);
+    auto pattern       = corpus_pattern(spec);
+    auto expected      = corpus_matches(dir);
+
+    auto run = [&](const Options& options) {
+        return [&, options] {
+            auto grep = Grep::build_grep(dir.string(), pattern, options);
+            for (const auto& file: files)
+            {
+                Access::grep_file(grep, file);
+            }
+            return Access::finish(grep);
+        };
+    };
+
+    measure(settings, {"grep_file/mapped", 0, size, count, 0, expected}, run(search_options(settings, 0)));
+    measure(settings, {"grep_file/mapped", settings.threads, size, count, 0, expected}, run(search_options(settings, settings.threads)));
+    measure(settings, {"grep_file/async", settings.threads, size, count, 0, expected}, run(search_options(settings, settings.threads, 64)));
+}
+
+/// Directory traversals: many tiny files spread over directories.
+void bench_grep_dir(const Settings& settings)
+{
+    auto spec          = tiny_corpus(settings);
+    auto dir           = generate_corpus(settings.corpus, spec);
+    auto [count, size] = corpus_size(dir);
+    auto pattern       = corpus_pattern(spec);
+    auto expected      = corpus_matches(dir);
+
+    for (uint32_t threads: {0U, settings.threads})
+    {
+        measure(settings, {"grep_dir/tiny", threads, size, count, 0, expected}, [&] {
+            auto grep = Grep::build_grep(dir.string(), pattern, search_options(settings, threads));
+            Access::grep_dir(grep, dir);
+            return Access::finish(grep);
+        });
+    }
+}
+
+/// Complete searches, from building the searcher to the last result, of both corpora.
+void bench_end_to_end(const Settings& settings)
+{
+    for (const auto& spec: {tiny_corpus(settings), huge_corpus(settings)})
+    {
+        auto dir           = generate_corpus(settings.corpus, spec);
+        auto [count, size] = corpus_size(dir);
+        auto pattern       = corpus_pattern(spec);
+        auto expected      = corpus_matches(dir);
+
+        measure(settings, {"end_to_end/" + spec.name, settings.threads, size, count, 0, expected}, [&] {
+            return Grep::build_grep(dir.string(), pattern, search_options(settings, settings.threads)).search();
+        });
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Settings settings;
+    for (int i {1}; i < argc; ++i)
+    {
+        std::string_view arg {argv[i]};
+        auto separator = arg.find('=');
+        auto name      = arg.substr(0, separator);
+        auto value     = separator == std::string_view::npos ? std::string_view {} : arg.substr(separator + 1);
+
+        bool valid {true};
+        if (name == "--corpus")
+        {
+            settings.corpus = std::string {value};
+        }
+        else if (name == "--filter")
+        {
+            settings.filter = std::string {value};
+        }
+        else if (name == "--repeat")
+        {
+            valid = parse_number(value, settings.repeat) && settings.repeat > 0;
+        }
+        else if (name == "--scale")
+        {
+            valid = parse_number(value, settings.scale) && settings.scale > 0;
+        }
+        else if (name == "--threads")
+        {
+            valid = parse_number(value, settings.threads) && settings.threads > 0;
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            util::log::error("Invalid argument: %s", argv[i]);
+            std::cerr << USAGE << '\n';
+            return 1;
+        }
+    }
+
+#ifdef WIN32_BUILD
+    auto null_file   = std::fopen("NUL", "wb");
+    settings.null_fd = null_file ? _fileno(null_file) : -1;
+#else
+    auto null_file   = std::fopen("/dev/null", "wb");
+    settings.null_fd = null_file ? fileno(null_file) : -1;
+#endif
+    if (!null_file)
+    {
+        util::log::error("Can't open the null device.");
+        return 1;
+    }
+
+    try
+    {
+        fs::create_directories(settings.corpus);
+
+        // the searches log their progress to stdout, which is left to the results
+        auto log_buffer = std::cout.rdbuf(nullptr);
+
+        bench_thread_pool(settings);
+        bench_searcher(settings);
+        bench_grep_chunk(settings);
+        bench_grep_file(settings);
+        bench_grep_dir(settings);
+        bench_end_to_end(settings);
+
+        std::cout.rdbuf(log_buffer);
+        std::cout.clear();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    std::fclose(null_file);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cppgrep::casefold {
+
+/// Checks if a byte is an ASCII letter.
+constexpr bool is_letter(char c) noexcept
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/// Returns the lowercase of an ASCII letter, or the byte itself.
+constexpr char to_lower(char c) noexcept
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+}
+
+/// Lowercases the ASCII letters of 4 bytes at once.
+inline uint32_t to_lower(uint32_t word) noexcept
+{
+    // the high bit of each byte ends up set if the byte is in ['A', 'Z']; non-ASCII bytes are left alone
+    constexpr uint32_t ones {0x01010101U};
+    auto low_bits   = word & 0x7f7f7f7fU;
+    auto above_z    = low_bits + ones * (0x7f - 'Z');
+    auto at_least_a = low_bits + ones * (0x80 - 'A');
+    auto upper      = ~word & (at_least_a ^ above_z) & 0x80808080U;
+
+    return word | upper >> 2;
+}
+
+/// Compares text to a lowercase pattern, folding the ASCII letters of text.
+inline bool equal(const char* text, const char* pattern, size_t size) noexcept
+{
+    for (size_t i {0}; i < size; ++i)
+    {
+        if (to_lower(text[i]) != pattern[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// Lowercases the ASCII letters of a text.
+std::string to_lower(std::string_view text);
+
+/// Checks if a text is pure ASCII. Literal kernels only fold ASCII letters.
+bool is_ascii(std::string_view text) noexcept;
+
+/// Decodes the UTF-8 sequence at the start of a text.
+/// @returns the length of the sequence, or 0 if it isn't valid
+size_t decode_utf8(std::string_view text, char32_t& code_point) noexcept;
+
+/// Encodes a code point as UTF-8.
+std::string encode_utf8(char32_t code_point);
+
+/// Returns the code points equal to a code point when case is ignored, itself included, in ascending order.
+/// Covers simple case folding of the Latin, Greek, Cyrillic and Armenian letters.
+std::vector<char32_t> variants(char32_t code_point);
+
+} // namespace cppgrep::casefold
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "searcher.h"
+
+namespace cppgrep {
+
+/// Builds a searcher for approximate occurrences of a set of literal patterns: substrings within max_edits
+/// substitutions, insertions or deletions of a pattern, reported with their edit distance in Match::edits.
+/// The edit distance of each pattern is tracked with Myers' bit-parallel algorithm, one bit per pattern byte in one or
+/// two 64-bit words, so every text byte costs a few word operations per pattern.
+/// A match ends at the first byte where a pattern is within max_edits of the text, moved on while the distance keeps
+/// dropping, and starts where that distance is reached, as early as possible.
+/// Every match holds one of the max_edits + 1 pieces of its pattern exactly, so the literal search kernels find the
+/// pieces first and the automata only run around them, unless the pieces are too short to be worth it.
+/// @param patterns - the literal patterns; each longer than max_edits and at most 128 bytes
+/// @param max_edits - the edits allowed; at least 1
+/// @param kind - the requested kernel for the piece prefilter
+/// @param ignore_case - fold ASCII letters; other bytes are compared exactly
+/// @throws std::invalid_argument if a pattern is too short or too long
+std::unique_ptr<const Searcher> build_fuzzy_searcher(const std::vector<std::string>& patterns, uint32_t max_edits, SearcherKind kind,
+                                                     bool ignore_case = false);
+
+/// Splits a pattern into max_edits + 1 pieces of nearly equal length; a match with at most max_edits edits holds at
+/// least one of them exactly.
+std::vector<std::string> fuzzy_pieces(std::string_view pattern, uint32_t max_edits);
+
+} // namespace cppgrep
@@ -1,56 +1,372 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <filesystem>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <string_view>
+#include <vector>
 
+#include "line_reporter.h"
+#include "path_filter.h"
+#include "result_sink.h"
+#include "searcher.h"
+
+#include "util/async_reader.h"
+#include "util/buffer_pool.h"
+#include "util/directory_cache.h"
+#include "util/inflate_reader.h"
+#include "util/mapped_file.h"
+#include "util/output.h"
 #include "util/thread_pool.h"
 
 namespace cppgrep {
 
-constexpr auto MAX_PATTERN_SIZE {128U}; //!< Max pattern size, in characters.
-constexpr auto MAX_AFFIX_SIZE {3U};     //!< Max affix size, in characters.
+constexpr auto MAX_PATTERN_SIZE {128U};    //!< Max pattern size, in characters.
+constexpr auto MAX_AFFIX_SIZE {3U};        //!< Max affix size, in characters.
+constexpr auto MAX_EDITS {63U};            //!< Max edits of approximate matching; a pattern needs more, plus room for as many.
+constexpr auto SYNC_INTERVAL {8192U};      //!< Interval of the offsets a regex or approximate match in a longer line can't cross.
+constexpr auto MIN_CHUNK_SIZE {65536U};    //!< Min chunk size, in bytes.
+constexpr auto MAX_CHUNK_SIZE {16777216U}; //!< Max chunk size, in bytes.
+constexpr auto BINARY_SNIFF_SIZE {8192U};  //!< Bytes at the start of a file that decide if it is binary.
+constexpr auto MAP_MIN_SIZE {67108864U};   //!< Files found by a traversal are mapped from this size on, and read below it.
+constexpr auto RANGE_CHUNKS {16U};         //!< Chunks read in order by one task, when a file is read in ranges.
+constexpr auto BATCH_FILES {64U};          //!< Files of a directory searched back to back by one task.
+constexpr auto BATCH_BYTES {1048576U};     //!< Bytes a batch task searches before it queues the rest of its files again.
+
+constexpr std::string_view STDIN_PATH {"-"}; //!< Path that searches the standard input.
+
+/// What is reported for each file.
+enum class ReportMode
+{
+    Matches,          //!< Every match, with its offset and affixes.
+    FilesWithMatches, //!< The name of each file that has a match; a file is only searched up to its first match.
+    Count             //!< The number of matches of each file that has any.
+};
+
+/// How files that look binary are searched. A file looks binary if its first block has a NUL byte or isn't UTF-8.
+enum class BinaryMode
+{
+    Report, //!< Searched up to the first match, which is reported once without its bytes.
+    Skip,   //!< Not searched at all.
+    Text    //!< Searched like any other file.
+};
+
+/// How the statistics of a search are printed at its end.
+enum class StatsFormat
+{
+    None, //!< Not printed.
+    Text, //!< Human readable lines on stdout.
+    Json  //!< One JSON object on stderr, apart from the results.
+};
+
+struct SharedResources;
+
+/// Optional settings of a search.
+struct Options
+{
+    uint64_t max_memory {1073741824};           //!< Budget of the buffers held by queued chunks, in bytes (1GB RAM).
+    uint32_t max_threads {0};                   //!< Number of threads to use; 0 searches on the calling thread.
+    size_t chunk_size {262144};                 //!< Bytes searched by a task; the default fits in a typical L2 cache.
+    bool ordered {false};                       //!< Group the results per file, in offset order.
+    SearcherKind searcher {SearcherKind::Auto}; //!< Literal search kernel.
+    bool regex {false};                         //!< Treat the patterns as regular expressions.
+    uint32_t max_edits {0};                     //!< Edits a match may differ from its literal pattern by; 0 for exact matches.
+    bool ignore_case {false};                   //!< Fold case; literals with UTF-8 letters go through the regex engine.
+    ReportMode report {ReportMode::Matches};    //!< What is reported for each file.
+    uint64_t max_count {0};                     //!< Matches searched per file, in file order; 0 for no limit.
+    bool line_numbers {false};                  //!< Print matching lines whole, with their numbers.
+    size_t before_context {0};                  //!< Lines printed before each matching line.
+    size_t after_context {0};                   //!< Lines printed after each matching line.
+    std::string index_path;                     //!< Trigram index narrowing a directory search to candidate files; empty for none.
+    uint32_t queue_depth {0};                   //!< Reads kept in flight by the asynchronous reader; 0 maps files instead.
+    uint64_t range_read_size {0};               //!< Files at least this large are read in ranges instead of mapped; 0 for none.
+    BinaryMode binary {BinaryMode::Report};     //!< How files that look binary are searched.
+    std::vector<std::string> include;           //!< Globs a file name has to match to be searched, if any are given.
+    std::vector<std::string> exclude;           //!< Globs of file names that are not searched.
+    std::vector<std::string> exclude_dir;       //!< Globs of directory names that are not traversed.
+    bool ignore_files {true};                   //!< Honor .gitignore and .ignore files, and skip .git directories.
+    bool search_zip {false};                    //!< Search gzip and zlib files (.gz, .tgz, .zz) by their decompressed bytes.
+    int output_fd {1};                          //!< Descriptor the results are written to.
+    StatsFormat stats {StatsFormat::None};      //!< How the statistics are printed at the end of the search.
+    ResultSink* sink {nullptr};                 //!< Receives the results as records instead of the output; not owned.
+    std::shared_ptr<SharedResources> shared;    //!< Resources kept across searches, replacing the threads and memory settings; null for none.
+};
+
+/// Resources a long-running process keeps across searches, instead of each search setting them up and tearing them
+/// down: the worker threads, the read buffers, and the listings of the directories searched. Searches sharing them
+/// run one at a time.
+struct SharedResources
+{
+    /// Sets the resources up for the thread count, chunk size and memory budget of the options.
+    explicit SharedResources(const Options& options);
+
+    uint32_t threads;                                       //!< Worker threads; 0 searches on the calling thread.
+    std::shared_ptr<util::misc::BufferPool> buffers;        //!< Read buffers, sized for the longest patterns allowed.
+    util::misc::ThreadPool::Ptr pool;                       //!< Workers; a search waits for its tasks instead of stopping them.
+    std::shared_ptr<util::sys::DirectoryCache> directories; //!< Listings reused while their directory doesn't change.
+};
+
+/// Statistics of a search, summed over its threads.
+struct SearchStats
+{
+    // traversal
+    uint64_t dirs_visited {0};  //!< Directories listed.
+    uint64_t files_visited {0}; //!< Files found by the traversal, searched or not.
+    uint64_t pruned_dirs {0};   //!< Directories rejected by the path filters.
+    uint64_t skipped_files {0}; //!< Files rejected by the path filters.
+    uint64_t skipped_bytes {0}; //!< Size of the files rejected by the path filters.
+    uint64_t walk_ns {0};       //!< Time from the start of the traversal to the last directory listed.
+
+    // input
+    uint64_t files_searched {0};   //!< Files opened for searching.
+    uint64_t binary_files {0};     //!< Files that look binary.
+    uint64_t bytes_mapped {0};     //!< Size of the files searched through a mapping.
+    uint64_t bytes_read {0};       //!< Bytes read into buffers, including overlaps; compressed bytes for compressed files.
+    uint64_t read_ns {0};          //!< Time spent in blocking reads, including decompression.
+    uint64_t compressed_files {0}; //!< Files searched by their decompressed bytes.
+    uint64_t bytes_inflated {0};   //!< Bytes decompressed from the compressed files.
+
+    // search
+    std::string_view kernel;      //!< Name of the search kernel.
+    uint64_t chunks_queued {0};   //!< Chunks handed to the thread pool.
+    uint64_t chunks_searched {0}; //!< Chunks searched, queued or not.
+    uint64_t bytes_scanned {0};   //!< Bytes passed to the search kernel, including overlaps.
+    uint64_t matches {0};         //!< Results found.
+
+    // output
+    uint64_t output_bytes {0}; //!< Bytes written to the output.
+
+    util::misc::ThreadPool::Stats pool;   //!< Scheduling statistics; empty without a thread pool.
+    util::sys::AsyncReader::Stats reader; //!< Asynchronous read statistics; empty without a reader.
+};
+
+/// State shared by all the chunks of a file being searched.
+struct FileContext
+{
+    std::string path;                                //!< Path of a file searched on its own; empty when the name is interned.
+    std::string_view name;                           //!< Path of the file, as printed in results; null terminated.
+    util::sys::MappedFile mapping;                   //!< Mapping the chunks point into; invalid when the file is read through buffers.
+    util::sys::FileHandle handle;                    //!< Descriptor of the asynchronous reads; invalid otherwise.
+    std::unique_ptr<util::io::OrderedGroup> ordered; //!< Reassembles the results in offset order; null if not ordered.
+    std::unique_ptr<LineReporter> lines;             //!< Prints the matching lines and their context; null for per match records.
+    mutable std::atomic_uint64_t size {0};           //!< Size of the file when its search started; for a stream, once it ends.
+
+    // shared by the chunks, which only get const access to the file
+    mutable std::atomic_bool done {false};    //!< Set once no more results are needed; queued chunks are skipped and no more are read.
+    mutable std::atomic_uint64_t matches {0}; //!< Matches found so far.
+    mutable std::atomic_uint64_t pending {1}; //!< Queued chunks not finished yet, plus one until the last chunk is queued.
+    mutable std::atomic_bool binary {false};  //!< Set when the file looks binary and its first match is reported alone.
+    mutable std::once_flag announced {};      //!< Announces the file to the result sink once.
+    mutable uint32_t id {0};                  //!< Id of the file in the result sink's records, once announced.
+};
+
+/// Files of a directory searched back to back by one task. Their paths are interned in one arena and referenced by
+/// offset, so that a small file needs neither a task nor allocations of its own.
+struct FileBatch
+{
+    std::string names;           //!< Paths of the files, each followed by a null character.
+    std::vector<uint32_t> files; //!< Offset of each file's path in names.
+};
+
+namespace bench {
+struct Access;
+} // namespace bench
 
 class Grep
 {
 public:
     /// Builds a Grep instance if the arguments are valid, or throws otherwise.
-    /// @param path - the path where to search
+    /// @param path - the path where to search: a file, a directory, a named pipe, or STDIN_PATH for the standard input
     /// @param pattern - the text pattern to search for
-    /// @param max_memory - buffer used by queued chunks
-    /// @param max_threads - number of threads to use
+    /// @param options - optional settings
     /// @returns Grep instance
     /// @throws std::invalid_arguments
-    static Grep build_grep(std::string_view path, std::string_view pattern, uint64_t max_memory, uint32_t max_threads = 0);
+    static Grep build_grep(std::string_view path, std::string_view pattern, const Options& options = {});
+
+    /// Builds a Grep instance that searches for a set of patterns at once, if the arguments are valid.
+    /// @param path - the path where to search: a file, a directory, a named pipe, or STDIN_PATH for the standard input
+    /// @param patterns - the text patterns to search for; each result reports the one that matched
+    /// @param options - optional settings
+    /// @returns Grep instance
+    /// @throws std::invalid_arguments
+    static Grep build_grep(std::string_view path, std::vector<std::string> patterns, const Options& options = {});
 
     /// Starts the search on a Grep object. Blocks until all results are counted.
     /// @returns the number of results.
     uint64_t search() noexcept;
 
+    /// Sums the statistics counted by each thread. Complete once the search returned.
+    SearchStats stats() const noexcept;
+
 private:
-    /// @param path - the path where to search
-    /// @param pattern - the text pattern to search for
-    /// @param max_memory - buffer used by queued chunks
-    /// @param max_threads - number of threads to use
-    explicit Grep(std::string_view path, std::string_view pattern, uint64_t max_memory, uint32_t max_threads = 0);
+    friend struct bench::Access; //!< Times the stages of a search alone.
+
+    /// Hot path counters. Each thread counts into its own output slot's line, so counting never contends.
+    enum Counter : size_t
+    {
+        DirsVisited,
+        FilesVisited,
+        PrunedDirs,
+        SkippedFiles,
+        SkippedBytes,
+        FilesSearched,
+        BinaryFiles,
+        BytesMapped,
+        BytesRead,
+        ReadNanos,
+        CompressedFiles,
+        BytesInflated,
+        ChunksQueued,
+        ChunksSearched,
+        BytesScanned,
+        Matches,
+        CounterCount
+    };
+
+    /// Counters of a thread, padded to a cache line of their own.
+    struct alignas(64) CounterSlot
+    {
+        std::array<std::atomic_uint64_t, CounterCount> values {};
+    };
+
+    /// @param path - the path where to search: a file, a directory, a named pipe, or STDIN_PATH for the standard input
+    /// @param patterns - the text patterns to search for
+    /// @param options - optional settings
+    explicit Grep(std::string_view path, std::vector<std::string> patterns, const Options& options);
 
     /// Recursively iterates a directory and searches a text pattern in each valid file.
+    /// With a thread pool, returns after queueing the traversal; the pool's stop() waits for it.
     void grep_dir(const std::filesystem::path& dir_path);
 
-    /// Searches a text pattern in a file.
-    void grep_file(const std::filesystem::path& file_path, bool single_file = false);
+    /// Updates the trigram index, then searches the candidate files it lists instead of traversing the directory.
+    /// @returns false if the index can't be used, leaving the search to the traversal
+    bool grep_indexed() noexcept;
+
+    /// Lists a single directory, searching its files and queueing its subdirectories as new tasks.
+    /// Entries rejected by the path filter are skipped; a rejected directory is pruned without being opened.
+    /// @param dir_path - the directory
+    /// @param parent - the filter scope of the parent directory; null for the root
+    void walk_dir(const std::filesystem::path& dir_path, PathFilter::ScopePtr parent);
+
+    /// Searches a text pattern in a file. Maps the file searched alone, or a large one, if possible; otherwise reads it
+    /// through buffers.
+    void grep_file(const std::filesystem::path& file_path);
+
+    /// Searches the files of a batch back to back, from a position, reusing one buffer. Once the batch has searched
+    /// enough bytes the rest of its files are queued again, so that large files don't hold a worker.
+    void grep_batch(std::shared_ptr<const FileBatch> batch, size_t first);
+
+    /// Searches a file that fits in a chunk with a single read into a buffer, without mapping it. Larger files are
+    /// searched by grep_file().
+    /// @param path - path of the file; null terminated, and valid until the file is searched
+    /// @param buffer - buffer the file is read into
+    /// @returns the size of the file, or 0 if it can't be opened
+    uint64_t grep_small(std::string_view path, util::misc::BufferPool::Buffer& buffer);
+
+    /// Searches a text pattern in the standard input or a named pipe, as a stream that can't be sized nor sought.
+    /// Memory stays bounded by the buffers whatever the stream's length, and offsets count from its start.
+    void grep_pipe(const std::filesystem::path& pipe_path);
+
+    /// Searches a text pattern in a memory mapped file, handing out views into the mapping.
+    void grep_mapped(std::shared_ptr<const FileContext> file);
+
+    /// Searches a text pattern in a file read asynchronously. Each chunk is read with its surrounding bytes into its
+    /// own buffer, and searched on the pool when the read completes.
+    void grep_async(std::shared_ptr<const FileContext> file);
+
+    /// Searches a text pattern in a file that can't be mapped, reading it through buffers.
+    void grep_buffered(std::shared_ptr<const FileContext> file);
+
+    /// Searches a text pattern in a large file split into ranges of chunks. Each range is a task that reads its
+    /// chunks with positional reads, with the bytes around them, and searches them, so reads scale with the workers.
+    void grep_ranges(std::shared_ptr<const FileContext> file);
+
+    /// Searches a text pattern in the decompressed bytes of a file. Decompression runs on the calling thread while
+    /// the decompressed chunks are searched on the pool, with offsets in decompressed bytes.
+    /// @param reader - reader of the file, past its header
+    void grep_compressed(std::shared_ptr<const FileContext> file, util::io::InflateReader& reader);
+
+    /// Searches a text pattern in a file read in order, each buffer starting with the tail of the previous one.
+    /// @param source - reads up to a number of bytes into a buffer; returns the bytes read, fewer only at the end
+    void grep_stream(std::shared_ptr<const FileContext> file, const std::function<size_t(char* data, size_t size)>& source);
+
+    /// Queues a chunk of a file on the thread pool. The file is finished by the last of its chunks.
+    /// For an ordered file, first runs queued chunks until the last part of the task is close enough to its turn.
+    /// @param last_part - index of the last ordered part the task adds
+    template <typename Task>
+    void queue_chunk(const std::shared_ptr<const FileContext>& file, uint64_t last_part, Task&& task);
+
+    /// Marks a part of the file's search as finished: a queued chunk, or the queueing itself.
+    /// Reports the count of the file once all parts are finished.
+    void finish_part(const FileContext& file);
+
+    /// Classifies a file from its first block, before any other chunk is read or queued, and applies the binary mode.
+    /// @param file - the file; marked done if it is skipped, or binary if its matches are reported once
+    /// @param head - the first bytes of the file
+    /// @returns false if the file is skipped
+    bool classify(const FileContext& file, std::string_view head) noexcept;
+
+    /// Announces a file to the result sink, if it isn't yet.
+    /// @returns the id of the file
+    uint32_t announce(const FileContext& file);
+
+    /// Adds to a counter of the calling thread.
+    void count(Counter counter, uint64_t amount = 1) noexcept;
+
+    /// Prints the statistics in the format of the options.
+    void print_stats(const SearchStats& stats) const;
+
+    /// Checks out a read buffer. A worker runs queued chunks while waiting, since those hold the buffers.
+    util::misc::BufferPool::Buffer acquire_buffer() noexcept;
 
     /// Searches a text pattern in a buffer.
-    void grep_chunk(const std::vector<char>& chunk, size_t offset, uint64_t chunk_count, std::shared_ptr<const std::string> file_name);
+    /// @param data - buffer holding the chunk, plus surrounding bytes used for overlap and affixes
+    /// @param begin - start of the chunk in data; only matches starting in [begin, end) are reported
+    /// @param end - end of the chunk in data
+    /// @param data_offset - file offset of the first byte in data
+    /// @param index - index of the chunk in the file
+    /// @param file - the file the chunk belongs to
+    void grep_chunk(std::string_view data, size_t begin, size_t end, uint64_t data_offset, uint64_t index, const FileContext& file);
 
-    std::string m_pattern;
+    std::vector<std::string> m_patterns;
+    bool m_regex;
+    uint32_t m_max_edits; //!< Edits allowed by approximate matching; 0 for exact matches.
+    size_t m_min_pattern_size;
+    size_t m_max_pattern_size;
     std::filesystem::path m_path;
-    std::boyer_moore_searcher<std::string_view::const_iterator> m_searcher;
+    std::unique_ptr<const Searcher> m_searcher;
     size_t m_chunk_size;
-    size_t m_increment;
-    std::unique_ptr<util::misc::ThreadPool> m_threadpool;
-    std::atomic_uint64_t m_result_count {0};
+    size_t m_increment; //!< Bytes skipped after an exact literal match; a regex or approximate match is skipped whole.
+    size_t m_lookback;  //!< Bytes before a chunk holding where its scan starts, for regex and approximate matches.
+    bool m_ordered;
+    ReportMode m_report;
+    uint64_t m_max_count;
+    bool m_line_numbers;
+    size_t m_before_context;
+    size_t m_after_context;
+    bool m_lines;      //!< Matches are reported as lines, by the file's line reporter.
+    bool m_sequential; //!< The chunks of a file run in order, for a match limit or for counting lines.
+    BinaryMode m_binary;
+    bool m_search_zip;
+    uint64_t m_range_read_size;
+    std::filesystem::path m_index_path;
+    PathFilter m_filter;
+    std::shared_ptr<SharedResources> m_shared; //!< Resources kept across searches, if any.
+    std::shared_ptr<util::misc::BufferPool> m_buffers;
+    util::io::Output m_output;
+    util::misc::ThreadPool::Ptr m_threadpool;
+    std::shared_ptr<util::sys::DirectoryCache> m_directories; //!< Listings kept across searches; null to list each directory.
+    std::unique_ptr<util::sys::AsyncReader> m_reader; //!< Reads files when a queue depth is set; null otherwise.
+    StatsFormat m_stats_format;
+    ResultSink* m_sink;                      //!< Receives the results instead of the output, if set.
+    std::atomic_uint32_t m_next_file_id {0}; //!< Id of the next file announced to the sink.
+    std::vector<CounterSlot> m_counters;     //!< One per output slot.
+    std::atomic_int64_t m_walk_start {0};    //!< steady_clock ticks
+    std::atomic_int64_t m_walk_end {0};      //!< steady_clock ticks
 };
 
 } // namespace cppgrep
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "util/output.h"
+
+namespace cppgrep {
+
+constexpr auto MAX_LINE_CARRY {1048576U}; //!< Max bytes of a file carried from one chunk to the next for lines crossing it.
+
+/// Counts the line breaks in a range, with the widest vector instructions available.
+size_t count_newlines(const char* first, const char* last) noexcept;
+
+/// Reports the matching lines of a file, with their line numbers and context lines, from its chunks in file order.
+/// Lines are only counted up to the lines printed, so a file without matches costs nothing when its bytes stay
+/// available (a mapping); otherwise each chunk is counted before its bytes go away. Lines that cross a chunk boundary
+/// are completed from the next chunk, carrying the bytes they need in between.
+class LineReporter
+{
+public:
+    /// Match position: file offset and length.
+    using Match = std::pair<uint64_t, size_t>;
+
+    /// @param name - the file name printed with each line
+    /// @param line_numbers - print the number of each line
+    /// @param before - context lines printed before a matching line
+    /// @param after - context lines printed after a matching line
+    /// @param retained - the bytes of earlier chunks stay available at the same addresses, as with a mapping
+    LineReporter(std::string_view name, bool line_numbers, size_t before, size_t after, bool retained);
+
+    /// Reports the matches of a chunk. Records are only appended once the lines they print are complete.
+    /// @param data - buffer holding the chunk, plus the bytes around it
+    /// @param data_offset - file offset of the first byte in data
+    /// @param end - file offset of the end of the chunk
+    /// @param matches - matches starting in the chunk, in offset order
+    /// @param last - no chunk follows: lines crossing the end are completed from data, or cut where it ends
+    /// @param out - receives the records
+    void report(std::string_view data, uint64_t data_offset, uint64_t end, const std::vector<Match>& matches, bool last,
+                util::io::OutputBuffer& out);
+
+private:
+    /// Bytes of the file reachable while reporting a chunk: the carried bytes, then the chunk's buffer.
+    struct Window;
+
+    /// Returns the number of the line starting at an offset, counting the lines up to it.
+    uint64_t line_number(const Window& window, uint64_t line_start) noexcept;
+
+    /// Prints the matching line, then the context lines after it up to a limit.
+    /// @param limit - offset where the next matching line or its context begins, or where the complete lines end
+    void print_pending(const Window& window, uint64_t limit, bool last, util::io::OutputBuffer& out);
+
+    /// Prints the context lines following the printed ones, up to a limit.
+    void print_after(const Window& window, uint64_t limit, bool last, util::io::OutputBuffer& out);
+
+    /// Prints a line, highlighting the pending matches in it.
+    /// @param separator - ':' for a matching line, '-' for a context line
+    void print_line(const Window& window, uint64_t begin, uint64_t end, uint64_t number, char separator, util::io::OutputBuffer& out);
+
+    std::string m_name;
+    bool m_line_numbers;
+    size_t m_before;
+    size_t m_after;
+    bool m_retained;
+    bool m_finished {false};
+
+    // line counting
+    uint64_t m_counted {0}; //!< Offset up to which the line breaks are counted.
+    uint64_t m_lines {0};   //!< Line breaks before m_counted.
+
+    // printed lines
+    bool m_any_printed {false};
+    uint64_t m_printed {0};        //!< Start of the first line not printed after the printed ones.
+    uint64_t m_printed_number {0}; //!< Number of the last printed line.
+    size_t m_after_left {0};       //!< Context lines still to print after the last matching line.
+
+    // matching line waiting for its end
+    bool m_pending {false};
+    uint64_t m_pending_start {0};
+    uint64_t m_pending_number {0};
+    std::vector<Match> m_pending_matches;
+
+    // bytes of earlier chunks still needed
+    std::string m_carry;
+    uint64_t m_carry_offset {0};
+};
+
+} // namespace cppgrep
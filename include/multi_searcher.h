@@ -0,0 +1,19 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "searcher.h"
+
+namespace cppgrep {
+
+/// Builds a searcher for a set of patterns.
+/// Small sets are searched with a vector fingerprint kernel (Teddy), which filters candidate starts on the first bytes
+/// of each pattern, 8 buckets at a time. Larger sets, or CPUs without SSSE3, use a flattened Aho-Corasick automaton.
+/// @param patterns - the text patterns to search for; none may be empty
+/// @param kind - the requested kernel; BoyerMoore always selects the scalar automaton
+/// @param ignore_case - fold ASCII letters; other bytes are compared exactly
+std::unique_ptr<const Searcher> build_multi_searcher(const std::vector<std::string>& patterns, SearcherKind kind, bool ignore_case);
+
+} // namespace cppgrep
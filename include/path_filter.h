@@ -0,0 +1,100 @@
+#pragma once
+
+#include <bitset>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cppgrep {
+
+/// Shell style pattern over paths: "*" and "?" don't match "/", "**" does, and "[...]" matches a byte class.
+/// An unterminated class matches its "[" literally.
+class Glob
+{
+public:
+    /// Compiles a pattern. Patterns that are a literal, or "*" followed by a literal, skip the general matcher.
+    explicit Glob(std::string_view pattern);
+
+    /// Checks if the whole text matches the pattern.
+    bool match(std::string_view text) const noexcept;
+
+private:
+    enum class Kind
+    {
+        Literal, //!< The text is the pattern.
+        Suffix,  //!< The text ends with the literal, with no "/" before it.
+        General  //!< Anything else, through the token matcher.
+    };
+
+    /// Element of a compiled pattern.
+    struct Token
+    {
+        enum class Type
+        {
+            Byte,       //!< One given byte.
+            Any,        //!< Any byte but "/".
+            Class,      //!< A byte of m_classes[index].
+            Star,       //!< Any run of bytes without "/".
+            AnyPath,    //!< Any run of bytes.
+            Directories //!< Nothing, or any run of bytes ending with "/".
+        };
+
+        Type type;
+        unsigned char byte {0};
+        size_t index {0};
+    };
+
+    bool match(size_t token, std::string_view text) const noexcept;
+
+    Kind m_kind {Kind::General};
+    std::string m_literal;
+    std::vector<Token> m_tokens;
+    std::vector<std::bitset<256>> m_classes;
+};
+
+/// Decides which entries a directory traversal visits: --include / --exclude globs on file names,
+/// --exclude-dir globs on directory names, and the rules of the .gitignore and .ignore files found on the way.
+/// Ignore files follow the gitignore format; the rules of a directory override the ones of its parents, and the last
+/// rule that matches within a file wins.
+class PathFilter
+{
+public:
+    /// Rules in effect in a directory: the ones of its own ignore files, then the ones of its parents.
+    struct Scope;
+    using ScopePtr = std::shared_ptr<const Scope>;
+
+    /// @param include - globs a file name has to match, if any are given
+    /// @param exclude - globs of file names to skip
+    /// @param exclude_dir - globs of directory names to prune
+    /// @param ignore_files - read .gitignore and .ignore files, and prune .git directories
+    PathFilter(const std::vector<std::string>& include, const std::vector<std::string>& exclude, const std::vector<std::string>& exclude_dir,
+               bool ignore_files);
+
+    ~PathFilter() noexcept;
+
+    /// Checks if the traversal should look for ignore files.
+    bool ignore_files() const noexcept;
+
+    /// Returns the scope of a directory, reading its ignore files. A directory without any shares its parent's scope.
+    /// @param parent - the scope of the parent directory; null for the root of the traversal
+    /// @param dir - path of the directory, as the traversal names it
+    /// @param has_gitignore - the directory has a .gitignore file
+    /// @param has_ignore - the directory has a .ignore file
+    ScopePtr enter(const ScopePtr& parent, const std::string& dir, bool has_gitignore, bool has_ignore) const;
+
+    /// Checks if an entry of a directory is visited.
+    /// @param scope - the scope of the directory holding the entry
+    /// @param path - path of the entry, as the traversal names it
+    /// @param name - name of the entry
+    /// @param directory - the entry is a directory
+    bool accept(const ScopePtr& scope, std::string_view path, std::string_view name, bool directory) const noexcept;
+
+private:
+    std::vector<Glob> m_include;
+    std::vector<Glob> m_exclude;
+    std::vector<Glob> m_exclude_dir;
+    bool m_ignore_files;
+};
+
+} // namespace cppgrep
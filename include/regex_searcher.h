@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "searcher.h"
+
+namespace cppgrep {
+
+/// Builds a searcher for a set of regular expressions, matched as if joined by alternation.
+/// The syntax covers literals, ".", bracket classes, the \d \w \s escapes and their negations, groups, "|" and the
+/// * + ? {n,m} quantifiers. "." and negated classes don't match line breaks, and anchors are not supported.
+/// Matches are leftmost-longest and at most max_length bytes long, so that a match crossing a chunk boundary is
+/// complete within the bytes that follow the chunk.
+/// The patterns compile to an NFA that runs through a lazily built DFA, cached per thread with a bounded size.
+/// When every match has to contain a literal, the literal search kernels find the candidate regions first.
+/// @param patterns - the regular expressions; none may match an empty string
+/// @param max_length - the longest match reported, in bytes
+/// @param kind - the requested kernel for the literal prefilter
+/// @param ignore_case - fold ASCII letters, and the letters of UTF-8 characters outside of bracket classes
+/// @throws std::invalid_argument if a pattern isn't valid
+std::unique_ptr<const Searcher> build_regex_searcher(const std::vector<std::string>& patterns, size_t max_length, SearcherKind kind,
+                                                     bool ignore_case = false);
+
+/// Escapes the bytes of a literal that have a meaning in a regular expression.
+std::string escape_regex(std::string_view literal);
+
+} // namespace cppgrep
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cppgrep {
+
+/// A match, as delivered to a result sink.
+struct MatchRecord
+{
+    uint32_t file;    //!< Id of the file, as announced by ResultSink::file_found().
+    uint32_t pattern; //!< Index of the pattern that matched.
+    uint64_t offset;  //!< File offset of the first byte of the match.
+    uint64_t length;  //!< Length of the match, in bytes.
+    uint32_t edits;   //!< Edits between the match and its pattern, with approximate matching; 0 otherwise.
+};
+
+/// Receives the results of a search as they are found, instead of the printed output.
+/// Called concurrently from the searching threads, so implementations must be thread safe; a sink that blocks
+/// holds up the thread that found the matches.
+class ResultSink
+{
+public:
+    virtual ~ResultSink() noexcept = default;
+
+    /// Announces a file before any of its records, once.
+    /// @param id - id of the file in the records; ids are dense, from 0, in the order files are announced
+    /// @param path - path of the file, as the traversal names it; only valid during the call
+    virtual void file_found(uint32_t id, std::string_view path) = 0;
+
+    /// Delivers matches of one file, in offset order. When a file is searched in parallel chunks, batches of the
+    /// same file may arrive in any order.
+    /// @param records - the matches
+    /// @param count - number of records
+    /// @param data - bytes holding the matches, and the bytes around them; only valid during the call
+    /// @param data_offset - file offset of the first byte in data
+    virtual void matches(const MatchRecord* records, size_t count, std::string_view data, uint64_t data_offset) = 0;
+
+    /// Reports an announced file once all its chunks are searched.
+    /// @param id - id of the file
+    /// @param matches - number of matches in the file
+    virtual void file_done(uint32_t id, uint64_t matches);
+};
+
+/// Sink that hands the records over to a consumer thread through a bounded queue.
+/// Searching threads block while the queue is full, so a slow consumer slows the search down instead of growing
+/// memory. The paths of announced files are kept for lookups by id.
+class ResultQueue final : public ResultSink
+{
+public:
+    /// @param capacity - max records held by the queue
+    explicit ResultQueue(size_t capacity);
+
+    void file_found(uint32_t id, std::string_view path) override;
+    void matches(const MatchRecord* records, size_t count, std::string_view data, uint64_t data_offset) override;
+
+    /// Ends the queue once the search returned: pop() returns what is left, then nothing.
+    void close();
+
+    /// Takes up to max_count records, waiting for at least one unless the queue is closed.
+    /// @param out - receives the records, replacing its content
+    /// @returns false once the queue is closed and empty
+    bool pop(std::vector<MatchRecord>& out, size_t max_count);
+
+    /// Returns the path of an announced file.
+    std::string path(uint32_t id) const;
+
+private:
+    const size_t m_capacity;
+    std::vector<MatchRecord> m_ring;
+    size_t m_head {0}; //!< Index of the oldest record.
+    size_t m_size {0};
+    bool m_closed {false};
+    std::vector<std::string> m_paths {};
+
+    mutable std::mutex m_mutex {};
+    std::condition_variable m_not_empty {};
+    std::condition_variable m_not_full {};
+};
+
+} // namespace cppgrep
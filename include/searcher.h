@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cppgrep {
+
+/// Kernels that can search for a literal pattern.
+enum class SearcherKind
+{
+    Auto,       //!< Widest vector kernel supported by the CPU.
+    BoyerMoore, //!< Scalar std::boyer_moore_searcher.
+    Scalar,     //!< Scalar memchr() on the rarest byte; a CPU without vectors picks it for patterns up to 16 bytes.
+    Sse2,       //!< 16 byte vectors.
+    Avx2,       //!< 32 byte vectors.
+    Avx512      //!< 64 byte vectors.
+};
+
+/// Occurrence of a pattern in a buffer.
+struct Match
+{
+    const char* position {nullptr}; //!< Start of the match; the end of the searched range if there is none.
+    size_t length {0};              //!< Length of the match, in bytes.
+    uint32_t pattern {0};           //!< Index of the pattern that matched.
+    uint32_t edits {0};             //!< Edits between the match and its pattern; 0 for an exact match.
+};
+
+/// Finds occurrences of one or more literal patterns in a buffer.
+class Searcher
+{
+public:
+    virtual ~Searcher() noexcept = default;
+
+    /// Builds a searcher for a pattern. The kernel is picked once, based on the CPU features.
+    /// A requested vector kernel that isn't supported by the CPU falls back to the next narrower one.
+    /// @param pattern - the text pattern to search for; must not be empty
+    /// @param kind - the requested kernel
+    /// @param ignore_case - fold ASCII letters; other bytes are compared exactly
+    static std::unique_ptr<const Searcher> build(std::string_view pattern, SearcherKind kind = SearcherKind::Auto, bool ignore_case = false);
+
+    /// Builds a searcher for a set of patterns, scanning each byte once however many patterns there are.
+    /// @param patterns - the text patterns to search for; none may be empty
+    /// @param kind - the requested kernel; the vector kinds pick the width of the multi-pattern kernel
+    /// @param ignore_case - fold ASCII letters; other bytes are compared exactly
+    static std::unique_ptr<const Searcher> build(const std::vector<std::string>& patterns, SearcherKind kind = SearcherKind::Auto,
+                                                 bool ignore_case = false);
+
+    /// Finds the leftmost occurrence of a pattern in [first, last); the longest one if several patterns start there.
+    /// @returns the match, with last as position if there is none
+    virtual Match find(const char* first, const char* last) const noexcept = 0;
+
+    /// Returns the name of the kernel, for reporting.
+    virtual std::string_view name() const noexcept = 0;
+};
+
+/// Parses a kernel name, as reported by Searcher::name() or "auto".
+/// @returns false if the name is unknown
+bool parse_searcher_kind(std::string_view name, SearcherKind& kind) noexcept;
+
+} // namespace cppgrep
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#include "util/sys.h"
+
+#ifdef X86_BUILD
+#    include <immintrin.h>
+#    ifdef _MSC_VER
+#        include <intrin.h>
+#    endif
+#endif
+
+// Enables an instruction set for a single function, so that kernels for several
+// instruction sets can live in one binary and be picked at runtime.
+#if defined __GNUC__ || defined __clang__
+#    define CPPGREP_TARGET(isa) __attribute__((target(isa)))
+#else
+#    define CPPGREP_TARGET(isa)
+#endif
+
+namespace cppgrep::simd {
+
+/// Returns the index of the lowest set bit; mask must not be 0.
+inline unsigned lowest_bit(uint64_t mask) noexcept
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return index;
+#else
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+}
+
+} // namespace cppgrep::simd
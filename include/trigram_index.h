@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "path_filter.h"
+
+#include "util/mapped_file.h"
+#include "util/thread_pool.h"
+
+namespace cppgrep {
+
+/// Persistent index of the case-folded byte trigrams of each file in a directory tree.
+/// A file can only contain a literal if it contains all of the literal's trigrams, so a query narrows a search to
+/// the candidate files, which still have to be searched to verify the matches.
+/// The index is a single file in native byte order, mapped for queries: a header, the root path, the table of files
+/// with their size and modification time sorted by path, the table of trigrams sorted by value, then the paths and
+/// the posting lists, stored as delta-encoded varints.
+class TrigramIndex
+{
+public:
+    /// Brings the index up to date with the tree, then maps it.
+    /// Files whose size and modification time didn't change keep their trigrams; only the others are read.
+    /// @param index_path - the index file; created if missing, rebuilt if invalid or built for another root
+    /// @param root - the directory tree, named as the traversal names it
+    /// @param filter - decides which files of the tree are indexed, like it does for the traversal
+    /// @param pool - thread pool reading the changed files; null reads them on the calling thread
+    /// @returns the updated index
+    /// @throws std::runtime_error if the index can't be written
+    static TrigramIndex update(const std::filesystem::path& index_path, const std::filesystem::path& root, const PathFilter& filter,
+                               util::misc::ThreadPool* pool);
+
+    /// Maps an existing index.
+    /// @returns the index, or nothing if the file is missing or isn't a valid index
+    static std::optional<TrigramIndex> open(const std::filesystem::path& index_path);
+
+    /// Returns the number of indexed files.
+    size_t file_count() const noexcept;
+
+    /// Returns the root path of the indexed tree.
+    std::string_view root() const noexcept;
+
+    /// Lists the files that may contain any of the patterns, in path order.
+    /// Patterns are folded like the index, so the candidates hold for case-insensitive searches too.
+    /// A pattern shorter than a trigram makes every file a candidate.
+    /// @param patterns - literal patterns
+    std::vector<std::string> candidates(const std::vector<std::string>& patterns) const;
+
+    /// Table entry of a trigram.
+    struct TrigramEntry
+    {
+        uint32_t trigram; //!< Three bytes, the first one highest.
+        uint32_t count;   //!< Number of files in the posting list.
+        uint64_t offset;  //!< Start of the posting list, from the start of the posting lists.
+    };
+
+    /// Table entry of a file.
+    struct FileEntry
+    {
+        uint64_t size;        //!< Size when indexed, in bytes.
+        int64_t mtime;        //!< Modification time when indexed, in file clock ticks.
+        uint64_t path_offset; //!< Start of the path, from the start of the paths.
+        uint64_t path_size;   //!< Size of the path, in bytes.
+    };
+
+private:
+    explicit TrigramIndex(util::sys::MappedFile mapping) noexcept;
+
+    FileEntry file(size_t id) const noexcept;
+    std::string_view path(size_t id) const noexcept;
+    TrigramEntry trigram(size_t index) const noexcept;
+
+    /// Finds the entry of a trigram with a binary search of the table.
+    std::optional<TrigramEntry> find(uint32_t trigram) const noexcept;
+
+    /// Decodes the posting list of a trigram into ascending file ids.
+    std::vector<uint32_t> postings(const TrigramEntry& entry) const;
+
+    /// Finds a file by path.
+    /// @returns its id, or nothing if the file isn't indexed
+    std::optional<uint32_t> find_file(std::string_view file_path) const noexcept;
+
+    /// Inverts the posting lists of the files that are kept by an update.
+    /// @param kept - new id of each file, or UINT32_MAX for the files that are dropped or read again
+    /// @param trigrams - receives the ascending trigrams of each kept file, at its new id
+    void collect(const std::vector<uint32_t>& kept, std::vector<std::vector<uint32_t>>& trigrams) const;
+
+    util::sys::MappedFile m_mapping;
+    size_t m_file_count {0};
+    size_t m_trigram_count {0};
+    size_t m_root_size {0};
+    size_t m_files_offset {0};    //!< Start of the file table in the mapping.
+    size_t m_trigrams_offset {0}; //!< Start of the trigram table in the mapping.
+    size_t m_paths_offset {0};    //!< Start of the paths in the mapping.
+    size_t m_postings_offset {0}; //!< Start of the posting lists in the mapping.
+};
+
+} // namespace cppgrep
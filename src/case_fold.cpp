@@ -0,0 +1,193 @@
+#include <algorithm>
+
+#include "case_fold.h"
+
+namespace cppgrep::casefold {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+/// Letters whose lowercase is the uppercase plus a fixed offset.
+struct OffsetRange
+{
+    char32_t first;  //!< First uppercase letter.
+    char32_t last;   //!< Last uppercase letter.
+    char32_t offset; //!< Distance to the lowercase letters.
+};
+
+/// Letters where each uppercase is followed by its lowercase, starting with an uppercase.
+struct AlternatingRange
+{
+    char32_t first;
+    char32_t last;
+};
+
+constexpr OffsetRange OFFSET_RANGES[] {
+    {0x0041, 0x005a, 0x20}, // Basic Latin
+    {0x00c0, 0x00d6, 0x20}, // Latin-1 Supplement, before the multiplication sign
+    {0x00d8, 0x00de, 0x20}, // Latin-1 Supplement, after it
+    {0x0391, 0x03a1, 0x20}, // Greek, before the missing final sigma
+    {0x03a3, 0x03ab, 0x20}, // Greek, after it
+    {0x0400, 0x040f, 0x50}, // Cyrillic extensions
+    {0x0410, 0x042f, 0x20}, // Cyrillic
+    {0x0531, 0x0556, 0x30}  // Armenian
+};
+
+constexpr AlternatingRange ALTERNATING_RANGES[] {
+    {0x0100, 0x012f}, // Latin Extended-A
+    {0x0132, 0x0137},
+    {0x0139, 0x0148},
+    {0x014a, 0x0177},
+    {0x0179, 0x017e},
+    {0x0460, 0x0481}, // Cyrillic
+    {0x048a, 0x04bf},
+    {0x1e00, 0x1e95}, // Latin Extended Additional
+    {0x1ea0, 0x1eff}};
+
+/// Letters outside the ranges, as groups of equal letters.
+const std::vector<std::vector<char32_t>> SPECIAL_GROUPS {
+    {0x00ff, 0x0178},         // y with diaeresis
+    {0x03a3, 0x03c2, 0x03c3}, // sigma, final sigma
+};
+
+} // namespace impl
+
+std::string to_lower(std::string_view text)
+{
+    std::string lower {text};
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return to_lower(c); });
+
+    return lower;
+}
+
+bool is_ascii(std::string_view text) noexcept
+{
+    return std::all_of(text.begin(), text.end(), [](char c) { return static_cast<unsigned char>(c) < 0x80; });
+}
+
+size_t decode_utf8(std::string_view text, char32_t& code_point) noexcept
+{
+    if (text.empty())
+    {
+        return 0;
+    }
+
+    auto lead = static_cast<unsigned char>(text[0]);
+    size_t size {0};
+    if (lead < 0x80)
+    {
+        code_point = lead;
+        return 1;
+    }
+
+    if (lead >= 0xc2 && lead < 0xe0)
+    {
+        size       = 2;
+        code_point = lead & 0x1fU;
+    }
+    else if (lead >= 0xe0 && lead < 0xf0)
+    {
+        size       = 3;
+        code_point = lead & 0x0fU;
+    }
+    else if (lead >= 0xf0 && lead < 0xf5)
+    {
+        size       = 4;
+        code_point = lead & 0x07U;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (text.size() < size)
+    {
+        return 0;
+    }
+
+    for (size_t i {1}; i < size; ++i)
+    {
+        auto byte = static_cast<unsigned char>(text[i]);
+        if ((byte & 0xc0U) != 0x80)
+        {
+            return 0;
+        }
+
+        code_point = code_point << 6 | (byte & 0x3fU);
+    }
+
+    // reject overlong forms, surrogates and values past the last code point
+    constexpr char32_t minimums[] {0, 0, 0x80, 0x800, 0x10000};
+    if (code_point < minimums[size] || (code_point >= 0xd800 && code_point < 0xe000) || code_point > 0x10ffff)
+    {
+        return 0;
+    }
+
+    return size;
+}
+
+std::string encode_utf8(char32_t code_point)
+{
+    std::string text;
+    if (code_point < 0x80)
+    {
+        text += static_cast<char>(code_point);
+    }
+    else if (code_point < 0x800)
+    {
+        text += static_cast<char>(0xc0 | code_point >> 6);
+        text += static_cast<char>(0x80 | (code_point & 0x3f));
+    }
+    else if (code_point < 0x10000)
+    {
+        text += static_cast<char>(0xe0 | code_point >> 12);
+        text += static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+        text += static_cast<char>(0x80 | (code_point & 0x3f));
+    }
+    else
+    {
+        text += static_cast<char>(0xf0 | code_point >> 18);
+        text += static_cast<char>(0x80 | (code_point >> 12 & 0x3f));
+        text += static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+        text += static_cast<char>(0x80 | (code_point & 0x3f));
+    }
+
+    return text;
+}
+
+std::vector<char32_t> variants(char32_t code_point)
+{
+    for (const auto& group: impl::SPECIAL_GROUPS)
+    {
+        if (std::find(group.begin(), group.end(), code_point) != group.end())
+        {
+            return group;
+        }
+    }
+
+    for (const auto& range: impl::OFFSET_RANGES)
+    {
+        if (code_point >= range.first && code_point <= range.last)
+        {
+            return {code_point, code_point + range.offset};
+        }
+
+        if (code_point >= range.first + range.offset && code_point <= range.last + range.offset)
+        {
+            return {code_point - range.offset, code_point};
+        }
+    }
+
+    for (const auto& range: impl::ALTERNATING_RANGES)
+    {
+        if (code_point >= range.first && code_point <= range.last)
+        {
+            auto upper = code_point - (code_point - range.first) % 2;
+            return {upper, upper + 1};
+        }
+    }
+
+    return {code_point};
+}
+
+} // namespace cppgrep::casefold
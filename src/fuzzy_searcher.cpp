@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "case_fold.h"
+#include "fuzzy_searcher.h"
+
+namespace cppgrep {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+constexpr size_t WORD_BITS {64};
+constexpr size_t MAX_WORDS {2};      //!< Longer patterns are rejected.
+constexpr size_t MIN_PIECE_SIZE {2}; //!< Shorter pieces match too often for the prefilter to pay off.
+
+/// Column of Myers' edit distance automaton: the vertical deltas of the distance matrix, one bit per pattern byte,
+/// the first byte lowest, and the distance of the whole pattern.
+template <size_t Words>
+struct Column
+{
+    std::array<uint64_t, Words> plus;  //!< Bytes where the distance grows by one over the byte before.
+    std::array<uint64_t, Words> minus; //!< Bytes where the distance drops by one over the byte before.
+    uint32_t distance;
+
+    /// Starts the column before any text byte.
+    void reset(size_t size) noexcept
+    {
+        plus.fill(~uint64_t {0});
+        minus.fill(0);
+        distance = static_cast<uint32_t>(size);
+    }
+
+    /// Advances the column by one text byte. Bits above the pattern hold garbage, which only ever moves up.
+    /// @param equal - bits of the pattern bytes equal to the text byte
+    /// @param top_word - word of the last pattern byte
+    /// @param top_bit - bit of the last pattern byte in its word
+    /// @param anchored - the text starts at the first byte advanced, so skipping a text byte costs an edit; otherwise
+    /// the pattern may start at any byte
+    void advance(const std::array<uint64_t, Words>& equal, size_t top_word, uint64_t top_bit, bool anchored) noexcept
+    {
+        uint64_t carry {0};
+        uint64_t plus_in {anchored ? uint64_t {1} : uint64_t {0}};
+        uint64_t minus_in {0};
+        for (size_t word {0}; word < Words; ++word)
+        {
+            auto eq = equal[word];
+            auto pv = plus[word];
+            auto mv = minus[word];
+
+            // (eq & pv) + pv, carried across the words
+            auto term = eq & pv;
+            auto sum  = term + pv;
+            auto next = uint64_t {sum < term};
+            sum += carry;
+            carry = next | uint64_t {sum < carry};
+
+            auto xv = eq | mv;
+            auto xh = (sum ^ pv) | eq;
+            auto ph = mv | ~(xh | pv);
+            auto mh = pv & xh;
+
+            if (word == top_word)
+            {
+                distance += (ph & top_bit) ? 1 : 0;
+                distance -= (mh & top_bit) ? 1 : 0;
+            }
+
+            auto ph_shifted = (ph << 1) | plus_in;
+            auto mh_shifted = (mh << 1) | minus_in;
+            plus_in         = ph >> (WORD_BITS - 1);
+            minus_in        = mh >> (WORD_BITS - 1);
+
+            plus[word]  = mh_shifted | ~(xv | ph_shifted);
+            minus[word] = ph_shifted & xv;
+        }
+    }
+};
+
+/// A pattern, as bit masks of the bytes equal to each byte value, forwards and backwards.
+template <size_t Words>
+struct FuzzyPattern
+{
+    using Masks = std::array<std::array<uint64_t, Words>, 256>;
+
+    FuzzyPattern(std::string_view pattern, bool ignore_case)
+        : size {pattern.size()}, top_word {(pattern.size() - 1) / WORD_BITS}, top_bit {uint64_t {1} << ((pattern.size() - 1) % WORD_BITS)}
+    {
+        auto set = [](Masks& masks, char c, size_t bit) {
+            masks[static_cast<uint8_t>(c)][bit / WORD_BITS] |= uint64_t {1} << (bit % WORD_BITS);
+        };
+
+        for (size_t i {0}; i < size; ++i)
+        {
+            auto c = pattern[i];
+            set(forward, c, i);
+            set(backward, c, size - 1 - i);
+            if (ignore_case && casefold::is_letter(c))
+            {
+                auto other = static_cast<char>(c ^ 0x20);
+                set(forward, other, i);
+                set(backward, other, size - 1 - i);
+            }
+        }
+    }
+
+    size_t size;
+    size_t top_word;
+    uint64_t top_bit;
+    Masks forward {};  //!< Bit i is pattern byte i.
+    Masks backward {}; //!< Bit i is pattern byte size - 1 - i.
+};
+
+/// Approximate searcher for patterns of up to Words * 64 bytes.
+template <size_t Words>
+class FuzzySearcher final : public Searcher
+{
+public:
+    FuzzySearcher(const std::vector<std::string>& patterns, uint32_t max_edits, SearcherKind kind, bool ignore_case);
+
+    Match find(const char* first, const char* last) const noexcept override;
+
+    std::string_view name() const noexcept override
+    {
+        return m_name;
+    }
+
+private:
+    /// Completes the match of a pattern that is within the edits allowed of the text ending at end.
+    /// @param begin - first byte the match may start at
+    Match complete(uint32_t index, Column<Words> column, const char* begin, const char* end, const char* last) const noexcept;
+
+    std::vector<FuzzyPattern<Words>> m_patterns {};
+    uint32_t m_max_edits;
+    std::unique_ptr<const Searcher> m_prefilter {};
+    size_t m_before {0}; //!< Bytes before a piece the match holding it may start at.
+    size_t m_after {0};  //!< Bytes after the start of a piece the match holding it may end at.
+    std::string m_name {"myers"};
+};
+
+template <size_t Words>
+FuzzySearcher<Words>::FuzzySearcher(const std::vector<std::string>& patterns, uint32_t max_edits, SearcherKind kind, bool ignore_case)
+    : m_max_edits {max_edits}
+{
+    std::vector<std::string> pieces;
+    auto filtered = true;
+    for (const auto& pattern: patterns)
+    {
+        m_patterns.emplace_back(pattern, ignore_case);
+
+        // the prefix before a piece aligns with the text before it within the edits allowed, and so does the rest
+        size_t offset {0};
+        for (auto& piece: fuzzy_pieces(pattern, max_edits))
+        {
+            m_before = std::max(m_before, offset + max_edits);
+            m_after  = std::max(m_after, pattern.size() - offset + max_edits);
+            offset += piece.size();
+
+            filtered = filtered && piece.size() >= MIN_PIECE_SIZE;
+            if (std::find(pieces.begin(), pieces.end(), piece) == pieces.end())
+            {
+                pieces.push_back(std::move(piece));
+            }
+        }
+    }
+
+    if (filtered)
+    {
+        m_prefilter = Searcher::build(pieces, kind, ignore_case);
+        m_name += "+" + std::string {m_prefilter->name()};
+    }
+}
+
+template <size_t Words>
+Match FuzzySearcher<Words>::find(const char* first, const char* last) const noexcept
+{
+    thread_local std::vector<Column<Words>> columns;
+    columns.resize(m_patterns.size());
+
+    // without a prefilter the automata run over the whole range, otherwise over the windows around the pieces found,
+    // merged while they overlap
+    auto begin      = first;
+    auto window_end = last;
+    auto candidates = first;
+    if (m_prefilter)
+    {
+        auto piece = m_prefilter->find(first, last);
+        if (piece.position == last)
+        {
+            return {last, 0, 0, 0};
+        }
+
+        begin      = piece.position - std::min<size_t>(m_before, piece.position - first);
+        window_end = piece.position + std::min<size_t>(m_after, last - piece.position);
+        candidates = piece.position + 1;
+    }
+
+    for (size_t i {0}; i < m_patterns.size(); ++i)
+    {
+        columns[i].reset(m_patterns[i].size);
+    }
+
+    for (auto it = begin;;)
+    {
+        for (; it != window_end; ++it)
+        {
+            auto byte = static_cast<uint8_t>(*it);
+
+            // the closest pattern wins when several are within the edits allowed at the same byte
+            uint32_t best {m_max_edits + 1};
+            uint32_t best_index {0};
+            for (size_t i {0}; i < m_patterns.size(); ++i)
+            {
+                const auto& pattern = m_patterns[i];
+                auto& column        = columns[i];
+                column.advance(pattern.forward[byte], pattern.top_word, pattern.top_bit, false);
+                if (column.distance < best)
+                {
+                    best       = column.distance;
+                    best_index = static_cast<uint32_t>(i);
+                }
+            }
+
+            if (best <= m_max_edits)
+            {
+                return complete(best_index, columns[best_index], begin, it + 1, last);
+            }
+        }
+
+        if (window_end == last)
+        {
+            return {last, 0, 0, 0};
+        }
+
+        auto piece = m_prefilter->find(candidates, last);
+        if (piece.position == last)
+        {
+            return {last, 0, 0, 0};
+        }
+
+        // a window starting past the scan restarts the automata there
+        auto piece_begin = piece.position - std::min<size_t>(m_before, piece.position - first);
+        if (piece_begin > it)
+        {
+            it    = piece_begin;
+            begin = piece_begin;
+            for (size_t i {0}; i < m_patterns.size(); ++i)
+            {
+                columns[i].reset(m_patterns[i].size);
+            }
+        }
+
+        window_end = piece.position + std::min<size_t>(m_after, last - piece.position);
+        candidates = piece.position + 1;
+    }
+}
+
+template <size_t Words>
+Match FuzzySearcher<Words>::complete(uint32_t index, Column<Words> column, const char* begin, const char* end, const char* last) const noexcept
+{
+    const auto& pattern = m_patterns[index];
+
+    // the end moves on while the next byte brings the text closer to the pattern
+    while (end != last && column.distance)
+    {
+        auto next = column;
+        next.advance(pattern.forward[static_cast<uint8_t>(*end)], pattern.top_word, pattern.top_bit, false);
+        if (next.distance >= column.distance)
+        {
+            break;
+        }
+
+        column = next;
+        ++end;
+    }
+
+    // the pattern backwards against the text backwards from the end gives the distance of each start; a match is at
+    // most size + max_edits bytes long, and the earliest start wins a tie, so a changed first byte isn't dropped
+    Column<Words> back;
+    back.reset(pattern.size);
+
+    auto start = end;
+    auto best  = UINT32_MAX;
+    auto limit = end - std::min<size_t>(pattern.size + m_max_edits, end - begin);
+    for (auto it = end; it != limit;)
+    {
+        --it;
+        back.advance(pattern.backward[static_cast<uint8_t>(*it)], pattern.top_word, pattern.top_bit, true);
+        if (back.distance <= best)
+        {
+            best  = back.distance;
+            start = it;
+        }
+    }
+
+    return {start, static_cast<size_t>(end - start), index, best};
+}
+
+} // namespace impl
+
+std::unique_ptr<const Searcher> build_fuzzy_searcher(const std::vector<std::string>& patterns, uint32_t max_edits, SearcherKind kind,
+                                                     bool ignore_case)
+{
+    size_t longest {0};
+    for (const auto& pattern: patterns)
+    {
+        if (pattern.size() <= max_edits)
+        {
+            throw std::invalid_argument {"An approximate pattern must be longer than the edits allowed."};
+        }
+
+        longest = std::max(longest, pattern.size());
+    }
+
+    if (longest > impl::MAX_WORDS * impl::WORD_BITS)
+    {
+        throw std::invalid_argument {"An approximate pattern can't be longer than 128 bytes."};
+    }
+
+    if (longest > impl::WORD_BITS)
+    {
+        return std::make_unique<impl::FuzzySearcher<2>>(patterns, max_edits, kind, ignore_case);
+    }
+
+    return std::make_unique<impl::FuzzySearcher<1>>(patterns, max_edits, kind, ignore_case);
+}
+
+std::vector<std::string> fuzzy_pieces(std::string_view pattern, uint32_t max_edits)
+{
+    // the first pieces take the remainder, one byte each
+    const size_t count {std::min<size_t>(size_t {max_edits} + 1, pattern.size())};
+    std::vector<std::string> pieces;
+    for (size_t i {0}, offset {0}; i < count; ++i)
+    {
+        auto size = pattern.size() / count + (i < pattern.size() % count ? 1 : 0);
+        pieces.emplace_back(pattern.substr(offset, size));
+        offset += size;
+    }
+
+    return pieces;
+}
+
+} // namespace cppgrep
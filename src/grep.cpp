@@ -1,9 +1,19 @@
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
-#include <variant>
+#include <iostream>
+#include <limits>
+#include <thread>
 
+#include "case_fold.h"
+#include "fuzzy_searcher.h"
 #include "grep.h"
+#include "path_filter.h"
+#include "regex_searcher.h"
+#include "trigram_index.h"
 
 #include "util/log.h"
 #include "util/optional_error_bool.h"
@@ -19,237 +29,1535 @@ namespace cppgrep {
 /// Implementation of helper functions not needed in the public interface.
 namespace impl {
 
-/// Represents a string or string_view that delimits the pattern.
-using affix = std::variant<std::string, std::string_view>;
-
-/// Checks for tabs and newlines in a string_view. Returns a new string if a replace was necessary.
-affix replace_tab_and_newline(std::string_view affix) noexcept;
+/// Returns the output slot of the calling thread: one per worker, plus one for threads outside the pool.
+inline size_t output_slot() noexcept
+{
+    return static_cast<size_t>(util::misc::ThreadPool::current_worker() + 1);
+}
 
 /// Finds the proper offset skip range for the search iterator.
 /// eg. when searching and finding the word "test" skip to last "t" in case another match starts there
 /// Maybe not necessary when used with std::boyer_moore_searcher.
 constexpr size_t overlap_offset(std::string_view pattern) noexcept;
 
+/// Bytes carried from one read buffer to the next: lookback and affix bytes before a chunk, then the bytes
+/// needed to complete a match and its suffix after it.
+constexpr size_t buffer_overlap(size_t pattern_size, size_t lookback) noexcept
+{
+    return lookback + pattern_size - 1 + 2 * MAX_AFFIX_SIZE;
+}
+
+/// Orders patterns by size.
+inline bool shorter(const std::string& a, const std::string& b) noexcept
+{
+    return a.size() < b.size();
+}
+
+/// Checks if the patterns need the regex engine: either they are regular expressions, or case is ignored and they
+/// have UTF-8 letters, which the literal kernels don't fold. Approximate matching only folds ASCII letters.
+inline bool needs_regex(const std::vector<std::string>& patterns, const Options& options) noexcept
+{
+    auto ascii = [](const std::string& pattern) { return casefold::is_ascii(pattern); };
+    return options.regex || (options.ignore_case && !options.max_edits && !std::all_of(patterns.begin(), patterns.end(), ascii));
+}
+
+/// Returns the number of worker threads of a search, which shared resources decide.
+inline uint32_t thread_count(const Options& options) noexcept
+{
+    return options.shared ? options.shared->threads : options.max_threads;
+}
+
+/// Returns the shared read buffers if they are large enough for a search, or buffers of its own.
+inline std::shared_ptr<util::misc::BufferPool> make_buffers(const Options& options, size_t buffer_size)
+{
+    if (options.shared && options.shared->buffers->buffer_size() >= buffer_size)
+    {
+        return options.shared->buffers;
+    }
+
+    return std::make_shared<util::misc::BufferPool>(buffer_size, options.max_memory);
+}
+
+/// Returns the sync point following the one at index sync of data, or the end of data. Regex and approximate matches
+/// are searched between sync points: line starts, and in a line longer than SYNC_INTERVAL, the multiples of it with no
+/// line start in the interval before them. Each chunk scans from the last one before it, so the matches skipped whole
+/// are the same whatever the chunk size.
+/// @param data_offset - file offset of the first byte in data
+size_t next_sync(std::string_view data, uint64_t data_offset, size_t sync) noexcept;
+
+/// Returns the last sync point at or before index position of data.
+/// @param known - a sync point at or before position, or npos; otherwise 2 * SYNC_INTERVAL bytes before position are
+/// in data, unless it starts the file
+size_t last_sync(std::string_view data, uint64_t data_offset, size_t known, size_t position) noexcept;
+
+/// Returns the nanoseconds elapsed since a point in time.
+inline uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) noexcept
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/// Checks if the first block of a file looks binary: it has a NUL byte, or it isn't valid UTF-8.
+bool is_binary(std::string_view head) noexcept;
+
+/// Checks if a file is named like a gzip or zlib file.
+bool is_compressed(const fs::path& path) noexcept;
+
+/// Builds the searcher for the patterns, escaping literals that go through the regex engine.
+std::unique_ptr<const Searcher> build_searcher(const std::vector<std::string>& patterns, size_t max_length, const Options& options);
+
 /// Checks if the input args are valid.
-opt_err validate_args(std::string_view path, std::string_view pattern) noexcept;
+opt_err validate_args(std::string_view path, const std::vector<std::string>& patterns, const Options& options) noexcept;
 
 /// Checks if a path is an accessible file or directory.
 opt_err validate_path(const fs::path& path) noexcept;
 
 } // namespace impl
 
-Grep Grep::build_grep(std::string_view path, std::string_view pattern, uint64_t max_memory, uint32_t max_threads)
+SharedResources::SharedResources(const Options& options)
+    : threads {options.max_threads},
+      buffers {std::make_shared<util::misc::BufferPool>(options.chunk_size + impl::buffer_overlap(MAX_PATTERN_SIZE, 2 * SYNC_INTERVAL),
+                                                        options.max_memory)},
+      pool {threads ? std::make_shared<util::misc::ThreadPool>(buffers->max_buffers(), threads) : nullptr},
+      directories {std::make_shared<util::sys::DirectoryCache>()}
+{
+}
+
+Grep Grep::build_grep(std::string_view path, std::string_view pattern, const Options& options)
 {
-    if (auto args_check = impl::validate_args(path, pattern); !args_check)
+    return build_grep(path, std::vector<std::string> {std::string {pattern}}, options);
+}
+
+Grep Grep::build_grep(std::string_view path, std::vector<std::string> patterns, const Options& options)
+{
+    if (auto args_check = impl::validate_args(path, patterns, options); !args_check)
     {
         throw std::invalid_argument {args_check.error().value_or("Unknown error occured when validating arguments.")};
     }
 
-    return Grep(path, pattern, max_memory, max_threads);
+    return Grep(path, std::move(patterns), options);
 }
 
-Grep::Grep(std::string_view path, std::string_view pattern, uint64_t max_memory, uint32_t max_threads)
-    : m_pattern {pattern},
+Grep::Grep(std::string_view path, std::vector<std::string> patterns, const Options& options)
+    : m_patterns {std::move(patterns)},
+      m_regex {impl::needs_regex(m_patterns, options)},
+      m_max_edits {options.max_edits},
+      // a regex match may be shorter or longer than its pattern, up to the longest pattern allowed, and an approximate
+      // match by as many bytes as it has edits
+      m_min_pattern_size {m_regex ? 1U : std::min_element(m_patterns.begin(), m_patterns.end(), impl::shorter)->size() - m_max_edits},
+      m_max_pattern_size {m_regex ? MAX_PATTERN_SIZE : std::max_element(m_patterns.begin(), m_patterns.end(), impl::shorter)->size() + m_max_edits},
       m_path {path},
-      m_searcher {pattern.begin(), pattern.end()},
-      m_chunk_size {std::max<size_t>(sys::pagesize(), pattern.size())},
-      m_increment {impl::overlap_offset(pattern)},
-      m_threadpool {max_threads ? std::make_unique<util::misc::ThreadPool>(max_memory / m_chunk_size, max_threads) : nullptr}
+      m_searcher {impl::build_searcher(m_patterns, m_max_pattern_size, options)},
+      m_chunk_size {options.chunk_size},
+      // with several patterns another one may start at any byte of a match; resuming after the whole match instead
+      // would make the results depend on where chunks begin
+      m_increment {m_patterns.size() == 1 ? impl::overlap_offset(options.ignore_case ? casefold::to_lower(m_patterns.front()) : m_patterns.front()) : 1U},
+      m_lookback {m_regex || m_max_edits ? 2 * SYNC_INTERVAL : 0U},
+      m_ordered {options.ordered && !options.sink},
+      m_report {options.report},
+      m_max_count {options.max_count},
+      m_line_numbers {options.line_numbers},
+      m_before_context {options.before_context},
+      m_after_context {options.after_context},
+      m_lines {options.report == ReportMode::Matches && !options.sink && (options.line_numbers || options.before_context || options.after_context)},
+      m_sequential {m_max_count || m_lines},
+      m_binary {options.binary},
+      m_search_zip {options.search_zip},
+      m_range_read_size {options.range_read_size},
+      m_index_path {options.index_path},
+      m_filter {options.include, options.exclude, options.exclude_dir, options.ignore_files},
+      m_shared {options.shared},
+      m_buffers {impl::make_buffers(options, m_chunk_size + impl::buffer_overlap(m_max_pattern_size, m_lookback))},
+      m_output {options.output_fd, size_t {impl::thread_count(options)} + 1},
+      m_threadpool {m_shared ? m_shared->pool
+                             : options.max_threads ? std::make_shared<util::misc::ThreadPool>(m_buffers->max_buffers(), options.max_threads) : nullptr},
+      m_directories {m_shared ? m_shared->directories : nullptr},
+      m_reader {options.queue_depth ? std::make_unique<util::sys::AsyncReader>(options.queue_depth, m_buffers->buffer_size(), m_buffers->max_buffers()) : nullptr},
+      m_stats_format {options.stats},
+      m_sink {options.sink},
+      m_counters(size_t {impl::thread_count(options)} + 1)
 {
+    if (m_reader && !m_reader->valid())
+    {
+        m_reader.reset();
+    }
 }
 
 uint64_t Grep::search() noexcept
 {
-    if (fs::is_regular_file(m_path))
+    log::info("Using the %s search kernel for %lu pattern(s).", m_searcher->name().data(), m_patterns.size());
+
+    if (m_path == STDIN_PATH || (!fs::is_regular_file(m_path) && !fs::is_directory(m_path)))
+    {
+        log::info("The path is a pipe. Searching it as a stream...");
+        grep_pipe(m_path);
+    }
+    else if (fs::is_regular_file(m_path))
     {
         log::info("The path is a regular file. Searching...");
-        grep_file(m_path, true);
+        grep_file(m_path);
     }
     else
     {
         log::info("The path is a directory. Searching recursively...");
-        grep_dir(m_path);
+        if (m_index_path.empty() || !grep_indexed())
+        {
+            grep_dir(m_path);
+        }
     }
 
-    if (m_threadpool)
+    // a shared pool keeps its threads for the next search
+    if (m_threadpool && m_shared)
+    {
+        m_threadpool->wait();
+    }
+    else if (m_threadpool)
     {
         m_threadpool->stop();
     }
 
-    return m_result_count;
+    m_output.flush();
+
+    auto stats = this->stats();
+    if (stats.binary_files)
+    {
+        log::info("%s %lu binary files.", m_binary == BinaryMode::Skip ? "Skipped" : "Found", stats.binary_files);
+    }
+
+    if (m_reader)
+    {
+        log::info("Read %lu chunks (%lu bytes) through %s with a queue depth of %u; at most %u in flight, %lu into %u registered buffers.",
+                  stats.reader.reads, stats.reader.bytes, m_reader->backend(), m_reader->depth(), stats.reader.peak, stats.reader.fixed,
+                  stats.reader.registered);
+    }
+
+    if (stats.dirs_visited)
+    {
+        auto elapsed = static_cast<double>(stats.walk_ns) / 1e9;
+        auto rate    = [elapsed](uint64_t count) { return elapsed > 0 ? static_cast<double>(count) / elapsed : 0.0; };
+        log::info("Traversed %lu directories and %lu files in %.3fs (%.0f dirs/s, %.0f files/s).", stats.dirs_visited,
+                  stats.files_visited, elapsed, rate(stats.dirs_visited), rate(stats.files_visited));
+    }
+
+    if (stats.pruned_dirs || stats.skipped_files)
+    {
+        log::info("Pruned %lu directories and skipped %lu files (%lu bytes) by the path filters.", stats.pruned_dirs, stats.skipped_files,
+                  stats.skipped_bytes);
+    }
+
+    print_stats(stats);
+
+    return stats.matches;
 }
 
-void Grep::grep_file(const std::filesystem::path& file_path, bool single_file)
+SearchStats Grep::stats() const noexcept
 {
-    // skip file if logical size is too small
-    if (fs::file_size(file_path) < m_pattern.size())
+    auto sum = [this](Counter counter) {
+        uint64_t total {0};
+        for (const auto& slot: m_counters)
+        {
+            total += slot.values[counter].load(std::memory_order_relaxed);
+        }
+        return total;
+    };
+
+    SearchStats stats;
+    stats.dirs_visited     = sum(DirsVisited);
+    stats.files_visited    = sum(FilesVisited);
+    stats.pruned_dirs      = sum(PrunedDirs);
+    stats.skipped_files    = sum(SkippedFiles);
+    stats.skipped_bytes    = sum(SkippedBytes);
+    stats.walk_ns          = static_cast<uint64_t>(std::chrono::nanoseconds {m_walk_end - m_walk_start}.count());
+    stats.files_searched   = sum(FilesSearched);
+    stats.binary_files     = sum(BinaryFiles);
+    stats.bytes_mapped     = sum(BytesMapped);
+    stats.bytes_read       = sum(BytesRead);
+    stats.read_ns          = sum(ReadNanos);
+    stats.compressed_files = sum(CompressedFiles);
+    stats.bytes_inflated   = sum(BytesInflated);
+    stats.kernel           = m_searcher->name();
+    stats.chunks_queued    = sum(ChunksQueued);
+    stats.chunks_searched  = sum(ChunksSearched);
+    stats.bytes_scanned    = sum(BytesScanned);
+    stats.matches          = sum(Matches);
+    stats.output_bytes     = m_output.bytes_written();
+
+    if (m_threadpool)
     {
-        return;
+        stats.pool = m_threadpool->stats();
     }
 
-    if (std::ifstream stream {file_path.string().c_str(), std::ios::binary}; stream.good())
+    if (m_reader)
     {
-        // need shared ptr for multithreaded chunks that use same filename
-        // this is not optimal for single thread or single file use case
-        auto file_name = std::make_shared<const std::string>(file_path.string());
+        stats.reader = m_reader->stats();
+    }
 
-        for (auto chunk_count {0UL}; true; ++chunk_count)
-        {
-            auto chunk = std::vector<char>(m_chunk_size);
-            stream.read(&chunk[0], m_chunk_size);
+    return stats;
+}
 
-            // final chunk may not be a full read so don't rely on chunk.end() but rather on bytes last read
-            size_t offset = stream.gcount() ? stream.gcount() : 0U;
+void Grep::print_stats(const SearchStats& stats) const
+{
+    auto seconds = [](uint64_t ns) { return static_cast<double>(ns) / 1e9; };
 
-            // reached eof
-            if (offset < m_pattern.size())
-            {
-                return;
-            }
+    if (m_stats_format == StatsFormat::Text)
+    {
+        log::info("Stats: traversal: %lu directories and %lu files visited in %.3fs; %lu directories pruned, %lu files (%lu bytes) skipped.",
+                  stats.dirs_visited, stats.files_visited, seconds(stats.walk_ns), stats.pruned_dirs, stats.skipped_files, stats.skipped_bytes);
+        log::info("Stats: input: %lu files searched, %lu binary, %lu compressed; %lu bytes mapped, %lu bytes read, %lu bytes inflated "
+                  "(%.3fs blocked in reads).",
+                  stats.files_searched, stats.binary_files, stats.compressed_files, stats.bytes_mapped, stats.bytes_read, stats.bytes_inflated,
+                  seconds(stats.read_ns));
+        log::info("Stats: search: %lu chunks searched, %lu queued; %lu bytes scanned by the %s kernel; %lu matches.", stats.chunks_searched,
+                  stats.chunks_queued, stats.bytes_scanned, stats.kernel.data(), stats.matches);
+        log::info("Stats: output: %lu bytes written.", stats.output_bytes);
+        log::info("Stats: pool: %lu tasks run, %lu stolen, %lu run inline; workers idle for %.3fs, producers blocked for %.3fs.",
+                  stats.pool.tasks, stats.pool.stolen, stats.pool.inlined, seconds(stats.pool.idle_ns), seconds(stats.pool.blocked_ns));
+        log::info("Stats: reader: %lu reads, %lu bytes, %lu into registered buffers; at most %u in flight.", stats.reader.reads,
+                  stats.reader.bytes, stats.reader.fixed, stats.reader.peak);
+    }
+    else if (m_stats_format == StatsFormat::Json)
+    {
+        std::string json {"{"};
+        auto field = [&json](std::string_view name, uint64_t value) {
+            json.append(json.back() != '{' ? ",\"" : "\"").append(name).append("\":").append(std::to_string(value));
+        };
 
-            // don't queue to thread pool if grepping a single small file or when not using a pool
-            auto threaded = m_threadpool && !(single_file && fs::file_size(file_path) < m_chunk_size);
-            if (threaded)
-            {
-                auto task = [&, chunk {std::move(chunk)}, offset, chunk_count, file_name] {
-                    grep_chunk(chunk, offset, chunk_count, file_name);
-                };
+        field("dirs_visited", stats.dirs_visited);
+        field("files_visited", stats.files_visited);
+        field("pruned_dirs", stats.pruned_dirs);
+        field("skipped_files", stats.skipped_files);
+        field("skipped_bytes", stats.skipped_bytes);
+        field("walk_ns", stats.walk_ns);
+        field("files_searched", stats.files_searched);
+        field("binary_files", stats.binary_files);
+        field("bytes_mapped", stats.bytes_mapped);
+        field("bytes_read", stats.bytes_read);
+        field("read_ns", stats.read_ns);
+        field("compressed_files", stats.compressed_files);
+        field("bytes_inflated", stats.bytes_inflated);
+        json.append(",\"kernel\":\"").append(stats.kernel).append("\"");
+        field("chunks_queued", stats.chunks_queued);
+        field("chunks_searched", stats.chunks_searched);
+        field("bytes_scanned", stats.bytes_scanned);
+        field("matches", stats.matches);
+        field("output_bytes", stats.output_bytes);
 
-                m_threadpool->try_add_task(task);
-            }
-            else
+        json.append(",\"pool\":{");
+        field("tasks", stats.pool.tasks);
+        field("stolen", stats.pool.stolen);
+        field("inlined", stats.pool.inlined);
+        field("idle_ns", stats.pool.idle_ns);
+        field("blocked_ns", stats.pool.blocked_ns);
+
+        json.append("},\"reader\":{");
+        field("reads", stats.reader.reads);
+        field("bytes", stats.reader.bytes);
+        field("fixed", stats.reader.fixed);
+        field("peak", stats.reader.peak);
+        json.append("}}\n");
+
+        std::cerr << json;
+    }
+}
+
+void Grep::count(Counter counter, uint64_t amount) noexcept
+{
+    m_counters[impl::output_slot()].values[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void Grep::grep_file(const std::filesystem::path& file_path)
+{
+    count(FilesSearched);
+
+    auto file  = std::make_shared<FileContext>();
+    file->path = file_path.string();
+    file->name = file->path;
+    if (m_ordered)
+    {
+        file->ordered = std::make_unique<util::io::OrderedGroup>(m_output);
+    }
+
+    // the decompressed size of a compressed file is only known once it is read
+    if (m_search_zip && impl::is_compressed(file_path))
+    {
+        if (util::io::InflateReader reader {file->name.data()}; reader.valid())
+        {
+            file->size = std::numeric_limits<uint64_t>::max();
+            if (m_lines)
             {
-                grep_chunk(chunk, offset, chunk_count, file_name);
+                file->lines = std::make_unique<LineReporter>(file->name, m_line_numbers, m_before_context, m_after_context, false);
             }
 
-            // overlap chunks, in case there's a match in-between
-            stream.seekg(1 - static_cast<std::streamoff>(m_pattern.size() + MAX_AFFIX_SIZE), std::ios_base::cur);
+            grep_compressed(std::move(file), reader);
+            return;
+        }
+    }
+
+    // a match limit and line counting need the chunks in order, which the mapping gives
+    if (m_reader && !m_sequential)
+    {
+        file->handle = util::sys::FileHandle {file->name.data()};
+        file->size   = file->handle.size();
+        if (file->size > 0)
+        {
+            grep_async(std::move(file));
+            return;
+        }
+    }
+
+    // a mapped file truncated while it is searched faults the process, so the files found by a traversal are only
+    // mapped when large enough to be worth it; a read past the end of a truncated file just ends its search
+    std::error_code ec;
+    auto size = fs::file_size(file_path, ec);
+    if (file_path == m_path || (!ec && size >= MAP_MIN_SIZE))
+    {
+        file->mapping = util::sys::MappedFile {file->name.data()};
+    }
+    file->size = file->mapping.valid() ? file->mapping.size() : ec ? 0 : size;
+
+    // a large file that can't be mapped, or that is large enough to be read in ranges, is read by the workers
+    // rather than by this thread alone
+    auto ranged = !file->mapping.valid() || (m_range_read_size && file->size >= m_range_read_size);
+    if (ranged && m_threadpool && !m_sequential && file->size > m_chunk_size)
+    {
+        file->handle = util::sys::FileHandle {file->name.data()};
+        if (file->handle.size() > m_chunk_size)
+        {
+            file->mapping = {};
+            file->size    = file->handle.size();
+            grep_ranges(std::move(file));
+            return;
         }
     }
+    if (m_lines)
+    {
+        file->lines = std::make_unique<LineReporter>(file->name, m_line_numbers, m_before_context, m_after_context, file->mapping.valid());
+    }
+
+    if (file->mapping.valid())
+    {
+        grep_mapped(std::move(file));
+    }
+    else
+    {
+        grep_buffered(std::move(file));
+    }
 }
 
-void Grep::grep_dir(const std::filesystem::path& dir_path)
+void Grep::grep_batch(std::shared_ptr<const FileBatch> batch, size_t first)
 {
-    // NOTE: After the user-provided directory path is validated for read access,
-    // there is no requirement to report/handle denied access on contained entries.
-    // The non accessible entries will be skipped, without informing the user.
+    auto buffer = acquire_buffer();
 
-    std::error_code ec;
-    for (fs::recursive_directory_iterator it {dir_path, ec}, end; it != end; it.increment(ec))
+    uint64_t searched {0};
+    for (auto i = first; i < batch->files.size(); ++i)
     {
-        if (ec)
+        if (m_threadpool && searched >= BATCH_BYTES)
         {
-            it.pop();
-            continue;
+            m_threadpool->try_add_task([this, batch, i] { grep_batch(batch, i); });
+            return;
         }
 
         try
         {
-            // fstream will validate files after this point
-            if (fs::is_regular_file(it->path()))
-            {
-                grep_file(it->path());
-            }
+            searched += grep_small(batch->names.data() + batch->files[i], buffer);
         }
         catch (fs::filesystem_error&)
         {
-            continue;
         }
     }
 }
 
-void Grep::grep_chunk(const std::vector<char>& chunk, size_t offset, uint64_t chunk_count, std::shared_ptr<const std::string> file_name)
+uint64_t Grep::grep_small(std::string_view path, util::misc::BufferPool::Buffer& buffer)
 {
-    for (auto chunk_pos = chunk.begin(), read_end = chunk.begin() + offset;
-         chunk_pos = std::search(chunk_pos, read_end, m_searcher), chunk_pos != read_end;
-         chunk_pos += m_increment)
+    // where positional reads aren't available, or the file can't be opened, it takes the usual path
+    util::sys::FileHandle handle {path.data()};
+    if (!handle.valid())
+    {
+        grep_file(fs::path {path});
+        return 0;
+    }
+
+    // a file larger than a chunk is worth splitting into chunks on the pool
+    auto size = handle.size();
+    if (size > m_chunk_size)
+    {
+        grep_file(fs::path {path});
+        return size;
+    }
+
+    count(FilesSearched);
+
+    // one byte more than a chunk tells if the file grew since its size was read
+    auto start = std::chrono::steady_clock::now();
+    auto read  = handle.read(buffer.data(), m_chunk_size + size_t {1}, 0);
+    count(BytesRead, read);
+    count(ReadNanos, impl::elapsed_ns(start));
+    if (read > m_chunk_size)
+    {
+        grep_file(fs::path {path});
+        return read;
+    }
+
+    if (read < m_min_pattern_size)
     {
-        ++m_result_count;
-        auto result_pos = (chunk_count * m_chunk_size) + (chunk_pos - chunk.begin());
+        return read;
+    }
 
-        // get affixes; corner-case: doesn't work with affixes in-between chunks
-        auto boundary   = static_cast<size_t>(std::distance(chunk.begin(), chunk_pos));
-        auto safe_dist  = std::min<size_t>(boundary, MAX_AFFIX_SIZE);
-        auto get_prefix = boundary > 1 ? impl::replace_tab_and_newline({&chunk[(boundary - safe_dist)], safe_dist}) : impl::affix {};
+    // the file is searched before this returns, so it lives on the stack and keeps the interned path
+    FileContext file;
+    file.name = path;
+    file.size = read;
+    if (m_ordered)
+    {
+        file.ordered = std::make_unique<util::io::OrderedGroup>(m_output);
+    }
 
-        boundary += m_pattern.size();
-        safe_dist       = std::min<size_t>(offset - boundary, MAX_AFFIX_SIZE);
-        auto get_suffix = boundary < offset ? impl::replace_tab_and_newline({&chunk[boundary], MAX_AFFIX_SIZE}) : impl::affix {};
+    if (m_lines)
+    {
+        file.lines = std::make_unique<LineReporter>(file.name, m_line_numbers, m_before_context, m_after_context, true);
+    }
 
-        auto prefix = std::holds_alternative<std::string_view>(get_prefix) ? std::get<std::string_view>(get_prefix)
-                                                                           : std::get<std::string>(get_prefix);
+    const std::string_view data {buffer.data(), read};
+    if (!classify(file, data))
+    {
+        return read;
+    }
 
-        auto suffix = std::holds_alternative<std::string_view>(get_suffix) ? std::get<std::string_view>(get_suffix)
-                                                                           : std::get<std::string>(get_suffix);
+    grep_chunk(data, 0, read, 0, 0, file);
 
-        std::string output = fmt::format_str("%s(%d): %.*s\033[1;32m%s\033[0m%.*s", file_name->c_str(), result_pos, prefix.size(), prefix.data(), m_pattern.c_str(), suffix.size(), suffix.data());
-        log::info(output.c_str());
+    if (file.ordered)
+    {
+        file.ordered->close(1, impl::output_slot());
     }
+    finish_part(file);
+
+    return read;
 }
 
-impl::affix impl::replace_tab_and_newline(std::string_view affix) noexcept
+void Grep::grep_pipe(const std::filesystem::path& pipe_path)
 {
-    auto find = std::find_if(affix.begin(), affix.end(), [](char c) {
-        return c == '\t' || c == '\n' || c == '\r';
+    count(FilesSearched);
+
+    auto from_stdin = pipe_path == STDIN_PATH;
+    auto file       = std::make_shared<FileContext>();
+    file->path      = from_stdin ? "(standard input)" : pipe_path.string();
+    file->name      = file->path;
+    if (m_ordered)
+    {
+        file->ordered = std::make_unique<util::io::OrderedGroup>(m_output);
+    }
+
+    // the size of a stream is only known once it ends
+    file->size = std::numeric_limits<uint64_t>::max();
+    if (m_lines)
+    {
+        file->lines = std::make_unique<LineReporter>(file->name, m_line_numbers, m_before_context, m_after_context, false);
+    }
+
+    if (from_stdin)
+    {
+        util::sys::binary_stdin();
+    }
+
+    std::unique_ptr<std::FILE, int (*)(std::FILE*)> stream {from_stdin ? stdin : std::fopen(file->name.data(), "rb"),
+                                                             from_stdin ? [](std::FILE*) { return 0; } : std::fclose};
+    if (!stream)
+    {
+        log::error("Unable to open %s.", file->name.data());
+        return;
+    }
+
+    // a pipe returns short reads as the writer produces bytes, which fread keeps reading past until the buffer is full;
+    // with a pool the workers search the previous buffers meanwhile
+    grep_stream(file, [&](char* data, size_t size) {
+        auto read = std::fread(data, 1, size, stream.get());
+        count(BytesRead, read);
+        return read;
     });
 
-    if (find != affix.end())
+    if (std::ferror(stream.get()))
+    {
+        log::error("Unable to read %s to its end.", file->name.data());
+    }
+}
+
+void Grep::grep_mapped(std::shared_ptr<const FileContext> file)
+{
+    auto size = file->mapping.size();
+    if (size < m_min_pattern_size)
+    {
+        return;
+    }
+
+    count(BytesMapped, size);
+    file->mapping.advise(util::sys::MappedFile::Advice::Sequential);
+    file->mapping.advise(util::sys::MappedFile::Advice::WillNeed, 0, m_chunk_size);
+    if (!classify(*file, file->mapping.view()))
+    {
+        return;
+    }
+
+    // don't queue to thread pool if the file is a single chunk or when not using a pool;
+    // files found by the traversal are already being searched on a worker.
+    // with a match limit, chunks run in order so that the first matches are the ones counted
+    auto threaded = m_threadpool && size > m_chunk_size && !m_sequential;
+
+    // chunks are views into the mapping, so the neighbouring bytes needed for overlap and affixes are always there
+    uint64_t index {0};
+    for (size_t begin {0}; begin < size && !file->done; begin += m_chunk_size, ++index)
+    {
+        auto end = std::min(begin + m_chunk_size, size);
+        if (threaded)
+        {
+            queue_chunk(file, index, [&, file, begin, end, index] {
+                grep_chunk(file->mapping.view(), begin, end, 0, index, *file);
+            });
+        }
+        else
+        {
+            grep_chunk(file->mapping.view(), begin, end, 0, index, *file);
+        }
+    }
+
+    if (file->ordered)
+    {
+        file->ordered->close(index, impl::output_slot());
+    }
+    finish_part(*file);
+}
+
+void Grep::grep_async(std::shared_ptr<const FileContext> file)
+{
+    auto size = file->handle.size();
+    if (size < m_min_pattern_size)
+    {
+        return;
+    }
+
+    // each read covers the chunk plus the lookback and affix bytes before it, and the bytes completing a match after it
+    const uint64_t before = MAX_AFFIX_SIZE + m_lookback;
+    const uint64_t after  = m_max_pattern_size - 1 + MAX_AFFIX_SIZE;
+
+    // a file of one chunk is classified when its read completes; a larger one needs its first block beforehand
+    auto single = size <= m_chunk_size;
+    if (!single)
+    {
+        std::array<char, BINARY_SNIFF_SIZE> head;
+        auto start = std::chrono::steady_clock::now();
+        auto read  = file->handle.read(head.data(), head.size(), 0);
+        count(BytesRead, read);
+        count(ReadNanos, impl::elapsed_ns(start));
+        if (!classify(*file, {head.data(), read}))
+        {
+            return;
+        }
+    }
+
+    uint64_t index {0};
+    for (uint64_t begin {0}; begin < size && !file->done; begin += m_chunk_size, ++index)
     {
-        std::string out {affix.begin(), find};
-        for (auto it = ++find; it != affix.end(); ++it)
+        // an ordered part is read once its turn is close enough, like a queued chunk
+        while (file->ordered && !file->ordered->room(index))
         {
-            switch (*it)
+            if (!m_threadpool->help())
             {
-                case '\t':
-                    out += "\\t";
-                    break;
-                case '\r':
-                    out += "\\r";
-                    break;
-                case '\n':
-                    out += "\\n";
-                    break;
-                default:
-                    out += *it;
+                std::this_thread::yield();
+            }
+        }
+
+        auto end        = std::min<uint64_t>(begin + m_chunk_size, size);
+        auto read_begin = begin - std::min(begin, before);
+        size_t length   = std::min(end + after, size) - read_begin;
+        auto chunk      = acquire_buffer();
+        auto data       = chunk.data();
+
+        // the read counts as pool work until its chunk is queued, so that the pool doesn't stop meanwhile
+        ++file->pending;
+        m_threadpool->hold();
+        auto task = [this, file, chunk {std::move(chunk)}, begin, end, read_begin, length, index, single](int64_t result) mutable {
+            // a failed read leaves nothing to search; the chunk still runs to keep the file's order and count
+            if (result != static_cast<int64_t>(length))
+            {
+                file->done = true;
+            }
+
+            m_threadpool->try_add_task([this, file, chunk {std::move(chunk)}, begin, end, read_begin, length, index, single] {
+                count(BytesRead, length);
+                count(ChunksQueued);
+                if (single && !file->done)
+                {
+                    classify(*file, {chunk.data(), length});
+                }
+                grep_chunk({chunk.data(), length}, begin - read_begin, end - read_begin, read_begin, index, *file);
+                finish_part(*file);
+            });
+            m_threadpool->release();
+        };
+
+        // the task is only moved from once the read is queued
+        while (!m_reader->try_read(file->handle.get(), data, length, read_begin, std::move(task)))
+        {
+            // the queue is full: run queued chunks rather than wait
+            if (!m_threadpool->help())
+            {
+                std::this_thread::yield();
             }
         }
-        return out;
     }
 
-    return affix;
+    if (file->ordered)
+    {
+        file->ordered->close(index, impl::output_slot());
+    }
+    finish_part(*file);
 }
 
-constexpr size_t impl::overlap_offset(std::string_view pattern) noexcept
+void Grep::grep_buffered(std::shared_ptr<const FileContext> file)
 {
-    size_t position {0};
-
-    auto subpattern = pattern.substr(0, pattern.size() - 1);
-    while (subpattern.size() > 1)
+    // skip file if logical size is too small
+    if (file->size < m_min_pattern_size)
     {
-        subpattern = pattern.substr(0, subpattern.size() - 1);
-        position   = pattern.find_last_of(subpattern);
+        return;
     }
 
-    return position > 0 ? position : pattern.size();
+    if (std::ifstream stream {file->name.data(), std::ios::binary}; stream.good())
+    {
+        grep_stream(std::move(file), [&](char* data, size_t size) {
+            stream.read(data, static_cast<std::streamsize>(size));
+            auto read = static_cast<size_t>(stream.gcount());
+            count(BytesRead, read);
+            return read;
+        });
+    }
 }
 
-opt_err impl::validate_args(std::string_view path, std::string_view pattern) noexcept
+void Grep::grep_ranges(std::shared_ptr<const FileContext> file)
 {
-    if (pattern.size() > MAX_PATTERN_SIZE)
+    // each read covers the chunk plus the lookback and affix bytes before it, and the bytes completing a match after it
+    const uint64_t size   = file->size;
+    const uint64_t before = MAX_AFFIX_SIZE + m_lookback;
+    const uint64_t after  = m_max_pattern_size - 1 + MAX_AFFIX_SIZE;
+
+    std::array<char, BINARY_SNIFF_SIZE> head;
+    auto head_start = std::chrono::steady_clock::now();
+    auto head_read  = file->handle.read(head.data(), head.size(), 0);
+    count(BytesRead, head_read);
+    count(ReadNanos, impl::elapsed_ns(head_start));
+    if (!classify(*file, {head.data(), head_read}))
+    {
+        return;
+    }
+
+    // consecutive chunks of a range are read by the same worker, which keeps its reads sequential
+    const uint64_t range_size = uint64_t {m_chunk_size} * RANGE_CHUNKS;
+
+    uint64_t parts {0};
+    for (uint64_t range {0}; range < size && !file->done; range += range_size)
     {
-        return {"Pattern size exceeds the limit."};
+        auto range_end   = std::min(range + range_size, size);
+        auto range_parts = (range_end - range + m_chunk_size - 1) / m_chunk_size;
+        queue_chunk(file, parts + range_parts - 1, [this, file, range, range_end, size, before, after, first_index = parts] {
+            auto chunk = acquire_buffer();
+            auto index = first_index;
+            for (auto begin = range; begin < range_end; begin += m_chunk_size, ++index)
+            {
+                // an ordered file still needs every part once no more results are needed
+                if (file->done)
+                {
+                    if (file->ordered)
+                    {
+                        file->ordered->add(index, {}, impl::output_slot());
+                    }
+                    continue;
+                }
+
+                auto end        = std::min(begin + m_chunk_size, range_end);
+                auto read_begin = begin - std::min(begin, before);
+                size_t length   = std::min(end + after, size) - read_begin;
+
+                auto start = std::chrono::steady_clock::now();
+                auto read  = file->handle.read(chunk.data(), length, read_begin);
+                count(BytesRead, read);
+                count(ReadNanos, impl::elapsed_ns(start));
+
+                // a file truncated meanwhile ends the search; the chunk still runs to keep the file's order
+                if (read != length)
+                {
+                    file->done = true;
+                }
+
+                auto chunk_end = std::min<size_t>(end - read_begin, read);
+                grep_chunk({chunk.data(), read}, std::min<size_t>(begin - read_begin, chunk_end), chunk_end, read_begin, index, *file);
+            }
+        });
+
+        parts += range_parts;
     }
 
-    if (auto path_check = validate_path(path); !path_check)
+    if (file->ordered)
     {
-        return path_check;
+        file->ordered->close(parts, impl::output_slot());
     }
+    finish_part(*file);
+}
 
-    return true;
+void Grep::grep_compressed(std::shared_ptr<const FileContext> file, util::io::InflateReader& reader)
+{
+    count(CompressedFiles);
+
+    uint64_t compressed {0};
+    grep_stream(file, [&](char* data, size_t size) {
+        auto read = reader.read(data, size);
+        count(BytesInflated, read);
+        count(BytesRead, reader.compressed_bytes() - compressed);
+        compressed = reader.compressed_bytes();
+        return read;
+    });
+
+    // the bytes decompressed up to the error are searched anyway, as zcat would print them
+    if (reader.failed())
+    {
+        log::error("Corrupt or truncated compressed data in %s.", file->name.data());
+    }
 }
 
-opt_err impl::validate_path(const fs::path& path) noexcept
+void Grep::grep_stream(std::shared_ptr<const FileContext> file, const std::function<size_t(char* data, size_t size)>& source)
 {
+    // each buffer starts with the tail of the previous one instead of seeking back and re-reading it
+    const size_t overlap   = impl::buffer_overlap(m_max_pattern_size, m_lookback);
+    const size_t lookahead = overlap - MAX_AFFIX_SIZE - m_lookback;
+
+    // don't queue to thread pool if the file is a single chunk or when not using a pool,
+    // nor when the chunks must run in order
+    auto threaded = m_threadpool && file->size > m_chunk_size && !m_sequential;
+
+    std::array<char, impl::buffer_overlap(MAX_PATTERN_SIZE, 2 * SYNC_INTERVAL)> tail;
+    size_t tail_size {0};
+    uint64_t index {0};
+    for (uint64_t data_offset {0}; !file->done;)
+    {
+        auto chunk = acquire_buffer();
+        std::copy_n(tail.data(), tail_size, chunk.data());
+        auto start = std::chrono::steady_clock::now();
+
+        // final chunk may not be a full read so don't rely on the buffer size but rather on bytes last read
+        auto read = source(chunk.data() + tail_size, m_chunk_size);
+        count(ReadNanos, impl::elapsed_ns(start));
+        auto size = tail_size + read;
+        auto eof  = read < m_chunk_size;
+
+        // a stream's size is known once it ends, and line reporting needs it to complete the last line
+        if (eof)
+        {
+            file->size = data_offset + size;
+        }
+
+        // the first chunk has no preceding bytes; the last one owns everything up to eof
+        size_t begin = data_offset ? MAX_AFFIX_SIZE + m_lookback : 0U;
+        size_t end   = eof ? size : size - lookahead;
+
+        if (!data_offset && !classify(*file, {chunk.data(), size}))
+        {
+            break;
+        }
+
+        if (!eof)
+        {
+            tail_size = overlap;
+            std::copy_n(chunk.data() + size - overlap, overlap, tail.data());
+        }
+
+        if (begin < end && size >= m_min_pattern_size)
+        {
+            if (threaded)
+            {
+                // the buffer goes back to the pool when the task is done with it
+                auto task = [&, chunk {std::move(chunk)}, size, begin, end, data_offset, index, file] {
+                    grep_chunk({chunk.data(), size}, begin, end, data_offset, index, *file);
+                };
+
+                queue_chunk(file, index, std::move(task));
+            }
+            else
+            {
+                grep_chunk({chunk.data(), size}, begin, end, data_offset, index, *file);
+            }
+            ++index;
+        }
+
+        if (eof)
+        {
+            break;
+        }
+
+        data_offset += size - overlap;
+    }
+
+    if (file->ordered)
+    {
+        file->ordered->close(index, impl::output_slot());
+    }
+    finish_part(*file);
+}
+
+template <typename Task>
+void Grep::queue_chunk(const std::shared_ptr<const FileContext>& file, uint64_t last_part, Task&& task)
+{
+    // parts finishing ahead of their turn are held by the ordered group: past a bound, run queued chunks rather than
+    // queue more
+    while (file->ordered && !file->ordered->room(last_part))
+    {
+        if (!m_threadpool->help())
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    ++file->pending;
+    count(ChunksQueued);
+    m_threadpool->try_add_task([this, file, task {std::forward<Task>(task)}]() mutable {
+        task();
+        finish_part(*file);
+    });
+}
+
+void Grep::finish_part(const FileContext& file)
+{
+    if (--file.pending || !file.matches)
+    {
+        return;
+    }
+
+    if (m_sink)
+    {
+        m_sink->file_done(announce(file), file.matches);
+        return;
+    }
+
+    if (m_report != ReportMode::Count)
+    {
+        return;
+    }
+
+    auto slot = impl::output_slot();
+    m_output.slot(slot).append("Info: ").append(file.name).append(": ").append_number(file.matches).append('\n');
+    m_output.commit(slot);
+}
+
+uint32_t Grep::announce(const FileContext& file)
+{
+    // concurrent chunks of the file wait until it is announced, so that no record precedes it
+    std::call_once(file.announced, [&] {
+        file.id = m_next_file_id++;
+        m_sink->file_found(file.id, file.name);
+    });
+
+    return file.id;
+}
+
+bool Grep::classify(const FileContext& file, std::string_view head) noexcept
+{
+    if (m_binary == BinaryMode::Text || !impl::is_binary(head.substr(0, BINARY_SNIFF_SIZE)))
+    {
+        return true;
+    }
+
+    count(BinaryFiles);
+    if (m_binary == BinaryMode::Skip)
+    {
+        file.done = true;
+        return false;
+    }
+
+    file.binary = true;
+    return true;
+}
+
+util::misc::BufferPool::Buffer Grep::acquire_buffer() noexcept
+{
+    // the buffers are held by queued chunks: a worker helps running them rather than blocking the pool
+    for (;;)
+    {
+        if (auto buffer = m_buffers->try_acquire())
+        {
+            return buffer;
+        }
+
+        if (!m_threadpool || !m_threadpool->help())
+        {
+            if (auto buffer = m_buffers->try_acquire(std::chrono::milliseconds {1}))
+            {
+                return buffer;
+            }
+        }
+    }
+}
+
+void Grep::grep_dir(const std::filesystem::path& dir_path)
+{
+    m_walk_start = std::chrono::steady_clock::now().time_since_epoch().count();
+    m_walk_end   = m_walk_start.load();
+
+    // each directory is a task, so that workers list directories and search files concurrently
+    if (m_threadpool)
+    {
+        m_threadpool->try_add_task([this, dir_path] { walk_dir(dir_path, nullptr); });
+    }
+    else
+    {
+        walk_dir(dir_path, nullptr);
+    }
+}
+
+bool Grep::grep_indexed() noexcept
+{
+    // regular expressions and UTF-8 case folding have no literal trigrams to look up
+    if (m_regex)
+    {
+        log::info("The index only narrows literal searches. Searching every file...");
+        return false;
+    }
+
+    // the index holds the trigrams of the compressed bytes, not of the bytes searched
+    if (m_search_zip)
+    {
+        log::info("The index doesn't cover the decompressed bytes of compressed files. Searching every file...");
+        return false;
+    }
+
+    try
+    {
+        auto index      = TrigramIndex::update(m_index_path, m_path, m_filter, m_threadpool.get());
+        // an approximate match holds one of the pieces of its pattern exactly
+        auto patterns = m_patterns;
+        if (m_max_edits)
+        {
+            patterns.clear();
+            for (const auto& pattern: m_patterns)
+            {
+                auto pieces = fuzzy_pieces(pattern, m_max_edits);
+                patterns.insert(patterns.end(), pieces.begin(), pieces.end());
+            }
+        }
+
+        auto candidates = index.candidates(patterns);
+
+        auto skipped   = index.file_count() - candidates.size();
+        auto reduction = index.file_count() ? 100.0 * static_cast<double>(skipped) / static_cast<double>(index.file_count()) : 0.0;
+        log::info("Index: %lu of %lu files are candidates (%.1f%% skipped).", candidates.size(), index.file_count(), reduction);
+
+        count(FilesVisited, candidates.size());
+        for (auto& candidate: candidates)
+        {
+            if (m_threadpool)
+            {
+                m_threadpool->try_add_task([this, path = fs::path {std::move(candidate)}] {
+                    try
+                    {
+                        grep_file(path);
+                    }
+                    catch (fs::filesystem_error&)
+                    {
+                    }
+                });
+            }
+            else
+            {
+                try
+                {
+                    grep_file(candidate);
+                }
+                catch (fs::filesystem_error&)
+                {
+                }
+            }
+        }
+    }
+    catch (std::exception& e)
+    {
+        log::error("Unable to use the index: %s Searching every file...", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+void Grep::walk_dir(const std::filesystem::path& dir_path, PathFilter::ScopePtr parent)
+{
+    // NOTE: After the user-provided directory path is validated for read access,
+    // there is no requirement to report/handle denied access on contained entries.
+    // The non accessible entries will be skipped, without informing the user.
+
+    // the entries are listed first, so that the directory's ignore files apply to all of them
+    std::vector<std::pair<std::string, util::sys::EntryType>> entries;
+    auto has_gitignore {false};
+    auto has_ignore {false};
+    auto add_entry = [&](std::string_view name, util::sys::EntryType type) {
+        has_gitignore |= type == util::sys::EntryType::File && name == ".gitignore";
+        has_ignore |= type == util::sys::EntryType::File && name == ".ignore";
+        entries.emplace_back(name, type);
+    };
+
+    if (m_directories)
+    {
+        m_directories->list(dir_path.string().c_str(), add_entry);
+    }
+    else
+    {
+        util::sys::list_directory(dir_path.string().c_str(), add_entry);
+    }
+
+    // small files are searched in batches, their paths interned in the batch
+    auto scope = m_filter.enter(parent, dir_path.string(), has_gitignore, has_ignore);
+    std::shared_ptr<FileBatch> batch;
+    for (const auto& [name, type]: entries)
+    {
+        auto path = dir_path / name;
+        switch (type)
+        {
+            case util::sys::EntryType::Directory:
+                // a pruned directory is never opened
+                if (!m_filter.accept(scope, path.string(), name, true))
+                {
+                    count(PrunedDirs);
+                }
+                else if (m_threadpool)
+                {
+                    m_threadpool->try_add_task([this, path, scope] { walk_dir(path, scope); });
+                }
+                else
+                {
+                    // without a pool the files listed before the directory are searched before it, in listing order
+                    if (batch)
+                    {
+                        grep_batch(std::move(batch), 0);
+                    }
+                    walk_dir(path, scope);
+                }
+                break;
+
+            case util::sys::EntryType::File:
+                count(FilesVisited);
+                if (!m_filter.accept(scope, path.string(), name, false))
+                {
+                    std::error_code ec;
+                    auto size = fs::file_size(path, ec);
+                    count(SkippedFiles);
+                    count(SkippedBytes, ec ? 0 : size);
+                    break;
+                }
+
+                // decompressing takes longer than listing, so compressed files decompress concurrently in their own tasks
+                if (m_threadpool && m_search_zip && impl::is_compressed(path))
+                {
+                    m_threadpool->try_add_task([this, path] {
+                        try
+                        {
+                            grep_file(path);
+                        }
+                        catch (fs::filesystem_error&)
+                        {
+                        }
+                    });
+                    break;
+                }
+
+                if (!batch)
+                {
+                    batch = std::make_shared<FileBatch>();
+                }
+
+                batch->files.push_back(static_cast<uint32_t>(batch->names.size()));
+                batch->names.append(path.string()).push_back('\0');
+                if (batch->files.size() < BATCH_FILES)
+                {
+                    break;
+                }
+
+                if (m_threadpool)
+                {
+                    m_threadpool->try_add_task([this, full {std::move(batch)}] { grep_batch(full, 0); });
+                }
+                else
+                {
+                    grep_batch(std::move(batch), 0);
+                }
+                break;
+
+            case util::sys::EntryType::Other:
+                break;
+        }
+    }
+
+    // the last batch is searched here, the directory being listed
+    if (batch)
+    {
+        grep_batch(std::move(batch), 0);
+    }
+
+    count(DirsVisited);
+
+    // the traversal ends with the last directory listed
+    auto now  = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto last = m_walk_end.load();
+    while (last < now && !m_walk_end.compare_exchange_weak(last, now))
+    {
+    }
+}
+
+void Grep::grep_chunk(std::string_view data, size_t begin, size_t end, uint64_t data_offset, uint64_t index, const FileContext& file)
+{
+    // results go straight to this thread's output slot, or are collected for the file's ordered group
+    auto slot = impl::output_slot();
+    util::io::OutputBuffer ordered_out;
+    auto& out = file.ordered ? ordered_out : m_output.slot(slot);
+
+    // matches must start inside the chunk, but may end in the bytes following it
+    const auto search_end  = data.data() + std::min(data.size(), end + m_max_pattern_size - 1);
+    const auto chunk_begin = data.data() + begin;
+    const auto chunk_end   = data.data() + end;
+
+    // a queued chunk of a file that needs no more results is skipped
+    const auto synced     = m_regex || m_max_edits;
+    const auto scan_begin = file.done ? chunk_end
+                            : synced  ? data.data() + impl::last_sync(data, data_offset, std::string_view::npos, begin)
+                                      : chunk_begin;
+
+    // with a match limit the chunks run in order, so the matches of the previous chunks are final
+    const auto previous = file.matches.load();
+    uint64_t found {0};
+    std::vector<LineReporter::Match> line_matches;
+
+    // records for the result sink are handed over in batches, without allocating
+    std::array<MatchRecord, 64> records;
+    size_t record_count {0};
+    auto deliver = [&] {
+        if (record_count)
+        {
+            m_sink->matches(records.data(), record_count, data, data_offset);
+            record_count = 0;
+        }
+    };
+
+    // a regex or approximate match is searched within the span between the sync points around it: one crossing the end
+    // of the span, or found from an earlier span, is searched again from where the scan is in the span
+    auto span_begin = scan_begin;
+    auto span_end   = scan_begin;
+    auto next_match = [&](const char* from) {
+        auto match = m_searcher->find(from, search_end);
+        while (synced && match.position != search_end)
+        {
+            if (match.position >= span_end)
+            {
+                auto sync  = impl::last_sync(data, data_offset, static_cast<size_t>(span_end - data.data()),
+                                             static_cast<size_t>(match.position - data.data()));
+                span_begin = data.data() + sync;
+                span_end   = std::min(data.data() + impl::next_sync(data, data_offset, sync), search_end);
+            }
+
+            if (from >= span_begin && match.position + match.length <= span_end)
+            {
+                return match;
+            }
+
+            match = m_searcher->find(std::max(from, span_begin), span_end);
+            if (match.position != span_end)
+            {
+                return match;
+            }
+
+            from  = span_end;
+            match = m_searcher->find(from, search_end);
+        }
+        return match;
+    };
+
+    // a regex or approximate match is skipped whole, so the scan starts where the previous chunk's scan is in step
+    for (auto match = next_match(scan_begin); match.position < chunk_end;
+         match = next_match(match.position + (synced ? match.length : m_increment)))
+    {
+        if (match.position < chunk_begin)
+        {
+            continue;
+        }
+
+        // a binary file is reported by its first match alone, since its bytes would print as garbage
+        if (m_report == ReportMode::FilesWithMatches || (m_report == ReportMode::Matches && file.binary))
+        {
+            // the chunk that finds the first match reports the file
+            if (!file.done.exchange(true))
+            {
+                ++found;
+                if (m_sink)
+                {
+                    auto position = data_offset + static_cast<uint64_t>(match.position - data.data());
+                    records[record_count++] = {announce(file), match.pattern, position, match.length, match.edits};
+                    break;
+                }
+
+                out.append("Info: ").append(file.name).append(file.binary && m_report == ReportMode::Matches ? ": binary file matches\n" : "\n");
+                if (!file.ordered)
+                {
+                    m_output.commit(slot);
+                }
+            }
+            break;
+        }
+
+        ++found;
+        if (m_report == ReportMode::Count)
+        {
+            if (previous + found == m_max_count)
+            {
+                file.done = true;
+                break;
+            }
+            continue;
+        }
+
+        // the line reporter prints the lines once they are complete, which may be in a later chunk; a sink gets records
+        auto boundary = static_cast<size_t>(match.position - data.data());
+        if (m_sink || file.lines)
+        {
+            if (!m_sink)
+            {
+                line_matches.emplace_back(data_offset + boundary, match.length);
+            }
+            else
+            {
+                records[record_count++] = {announce(file), match.pattern, data_offset + boundary, match.length, match.edits};
+                if (record_count == records.size())
+                {
+                    deliver();
+                }
+            }
+
+            if (previous + found == m_max_count)
+            {
+                file.done = true;
+                break;
+            }
+            continue;
+        }
+
+        // get affixes from the bytes surrounding the match
+        auto prefix_size = std::min<size_t>(boundary, MAX_AFFIX_SIZE);
+        auto prefix      = data.substr(boundary - prefix_size, prefix_size);
+        auto suffix      = data.substr(boundary + match.length, MAX_AFFIX_SIZE);
+
+        // the highlighted text is the pattern that matched, and an approximate match is followed by its edit distance
+        out.append("Info: ").append(file.name).append('(').append_number(data_offset + boundary);
+        if (m_max_edits)
+        {
+            out.append(", distance ").append_number(match.edits);
+        }
+        out.append("): ");
+        out.append_escaped(prefix).append("\033[1;32m").append(data.substr(boundary, match.length)).append("\033[0m");
+        out.append_escaped(suffix).append('\n');
+
+        if (!file.ordered)
+        {
+            m_output.commit(slot);
+        }
+
+        if (previous + found == m_max_count)
+        {
+            file.done = true;
+            break;
+        }
+    }
+
+    if (m_sink)
+    {
+        deliver();
+    }
+
+    if (file.lines)
+    {
+        file.lines->report(data, data_offset, data_offset + end, line_matches, file.done || data_offset + end >= file.size, out);
+        if (!file.ordered)
+        {
+            m_output.commit(slot);
+        }
+    }
+
+    file.matches += found;
+    count(Matches, found);
+    count(ChunksSearched);
+    count(BytesScanned, static_cast<uint64_t>(search_end - scan_begin));
+
+    if (file.ordered)
+    {
+        file.ordered->add(index, ordered_out.view(), slot);
+    }
+}
+
+constexpr size_t impl::overlap_offset(std::string_view pattern) noexcept
+{
+    size_t position {0};
+
+    auto subpattern = pattern.substr(0, pattern.size() - 1);
+    while (subpattern.size() > 1)
+    {
+        subpattern = pattern.substr(0, subpattern.size() - 1);
+        position   = pattern.find_last_of(subpattern);
+    }
+
+    return position > 0 ? position : pattern.size();
+}
+
+std::unique_ptr<const Searcher> impl::build_searcher(const std::vector<std::string>& patterns, size_t max_length, const Options& options)
+{
+    if (options.max_edits)
+    {
+        return build_fuzzy_searcher(patterns, options.max_edits, options.searcher, options.ignore_case);
+    }
+
+    if (!needs_regex(patterns, options))
+    {
+        return Searcher::build(patterns, options.searcher, options.ignore_case);
+    }
+
+    if (options.regex)
+    {
+        return build_regex_searcher(patterns, max_length, options.searcher, options.ignore_case);
+    }
+
+    std::vector<std::string> escaped;
+    std::transform(patterns.begin(), patterns.end(), std::back_inserter(escaped), escape_regex);
+
+    return build_regex_searcher(escaped, max_length, options.searcher, true);
+}
+
+size_t impl::next_sync(std::string_view data, uint64_t data_offset, size_t sync) noexcept
+{
+    // the first multiple an interval after the sync point has no line start before it in its interval
+    auto multiple = (data_offset + sync + 2 * SYNC_INTERVAL - 1) / SYNC_INTERVAL * SYNC_INTERVAL - data_offset;
+    auto limit    = static_cast<size_t>(std::min<uint64_t>(multiple, data.size()));
+    auto line     = data.substr(0, limit).find('\n', sync);
+    return line == std::string_view::npos ? limit : line + 1;
+}
+
+size_t impl::last_sync(std::string_view data, uint64_t data_offset, size_t known, size_t position) noexcept
+{
+    // two intervals without a line break end with one without a line start, so its multiple is a sync point
+    auto low  = std::max(position - std::min<size_t>(position, 2 * SYNC_INTERVAL), known == std::string_view::npos ? 0 : known);
+    auto line = data.substr(low, position - low).rfind('\n');
+    auto sync = low + line + 1;
+    if (line == std::string_view::npos)
+    {
+        if (low != known && data_offset + low)
+        {
+            return position - (data_offset + position) % SYNC_INTERVAL;
+        }
+        sync = low;
+    }
+
+    // then the multiples following a line start
+    for (auto next = next_sync(data, data_offset, sync); next <= position; next = next_sync(data, data_offset, sync))
+    {
+        sync = next;
+    }
+    return sync;
+}
+
+bool impl::is_binary(std::string_view head) noexcept
+{
+    if (head.find('\0') != std::string_view::npos)
+    {
+        return true;
+    }
+
+    for (size_t i {0}; i < head.size();)
+    {
+        if (static_cast<unsigned char>(head[i]) < 0x80)
+        {
+            ++i;
+            continue;
+        }
+
+        // a sequence cut off by the end of the block doesn't count against the file
+        char32_t code_point {0};
+        auto size = casefold::decode_utf8(head.substr(i), code_point);
+        if (!size)
+        {
+            return head.size() - i >= 4;
+        }
+        i += size;
+    }
+
+    return false;
+}
+
+bool impl::is_compressed(const fs::path& path) noexcept
+{
+    auto extension = path.extension().string();
+    return extension == ".gz" || extension == ".tgz" || extension == ".zz";
+}
+
+opt_err impl::validate_args(std::string_view path, const std::vector<std::string>& patterns, const Options& options) noexcept
+{
+    if (patterns.empty())
+    {
+        return {"No pattern to search for."};
+    }
+
+    // no pattern length leaves room for more edits
+    static_assert(2 * MAX_EDITS + 1 <= MAX_PATTERN_SIZE);
+    if (options.max_edits > MAX_EDITS)
+    {
+        return {fmt::format_str("Approximate matching allows at most %u edits.", MAX_EDITS)};
+    }
+
+    for (const auto& pattern: patterns)
+    {
+        if (pattern.empty())
+        {
+            return {"Pattern is empty."};
+        }
+
+        if (pattern.size() > MAX_PATTERN_SIZE)
+        {
+            return {"Pattern size exceeds the limit."};
+        }
+
+        // an approximate match may be longer than its pattern by its edits
+        if (options.max_edits && (pattern.size() <= options.max_edits || pattern.size() + options.max_edits > MAX_PATTERN_SIZE))
+        {
+            return {fmt::format_str("With %u edits, a pattern must have between %u and %u characters.", options.max_edits,
+                                    options.max_edits + 1, MAX_PATTERN_SIZE - options.max_edits)};
+        }
+    }
+
+    if (options.max_edits && options.regex)
+    {
+        return {"Approximate matching only takes literal patterns."};
+    }
+
+    if (options.queue_depth && !impl::thread_count(options))
+    {
+        return {"Asynchronous reads need worker threads."};
+    }
+
+    if (options.chunk_size < MIN_CHUNK_SIZE || options.chunk_size > MAX_CHUNK_SIZE)
+    {
+        return {fmt::format_str("Chunk size must be between %u and %u bytes.", MIN_CHUNK_SIZE, MAX_CHUNK_SIZE)};
+    }
+
+    if (auto path_check = validate_path(path); !path_check)
+    {
+        return path_check;
+    }
+
+    return true;
+}
+
+opt_err impl::validate_path(const fs::path& path) noexcept
+{
+    if (path == STDIN_PATH)
+    {
+        return true;
+    }
+
     try
     {
         if (!fs::exists(path))
@@ -257,9 +1565,9 @@ opt_err impl::validate_path(const fs::path& path) noexcept
             return {"Path does not exist."};
         }
 
-        if (!fs::is_regular_file(path) && !fs::is_directory(path))
+        if (!fs::is_regular_file(path) && !fs::is_directory(path) && !fs::is_fifo(path))
         {
-            return {"Path is not regular file or directory."};
+            return {"Path is not regular file, directory or pipe."};
         }
 
 #ifdef WIN32_BUILD
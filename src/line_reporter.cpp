@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "line_reporter.h"
+#include "simd.h"
+
+namespace cppgrep {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+/// Signature shared by the newline counters.
+using NewlineCounter = size_t (*)(const char* first, const char* last) noexcept;
+
+size_t count_newlines_scalar(const char* first, const char* last) noexcept
+{
+    return static_cast<size_t>(std::count(first, last, '\n'));
+}
+
+#ifdef X86_BUILD
+// each block adds 0 or 1 to the byte counters, which are summed before they can overflow
+constexpr std::ptrdiff_t MAX_BLOCKS {255};
+
+CPPGREP_TARGET("sse2")
+size_t count_newlines_sse2(const char* first, const char* last) noexcept
+{
+    constexpr std::ptrdiff_t width {16};
+    const auto newline = _mm_set1_epi8('\n');
+
+    size_t total {0};
+    while (last - first >= width)
+    {
+        auto counts = _mm_setzero_si128();
+        for (auto blocks = std::min((last - first) / width, MAX_BLOCKS); blocks > 0; --blocks, first += width)
+        {
+            counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(newline, _mm_loadu_si128(reinterpret_cast<const __m128i*>(first))));
+        }
+
+        auto sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+        total += static_cast<size_t>(_mm_extract_epi16(sums, 0) + _mm_extract_epi16(sums, 4));
+    }
+
+    return total + count_newlines_scalar(first, last);
+}
+
+CPPGREP_TARGET("avx2")
+size_t count_newlines_avx2(const char* first, const char* last) noexcept
+{
+    constexpr std::ptrdiff_t width {32};
+    const auto newline = _mm256_set1_epi8('\n');
+
+    size_t total {0};
+    while (last - first >= width)
+    {
+        auto counts = _mm256_setzero_si256();
+        for (auto blocks = std::min((last - first) / width, MAX_BLOCKS); blocks > 0; --blocks, first += width)
+        {
+            counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(newline, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first))));
+        }
+
+        auto sums = _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        auto half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        total += static_cast<size_t>(_mm_extract_epi16(half, 0) + _mm_extract_epi16(half, 4));
+    }
+
+    return total + count_newlines_sse2(first, last);
+}
+#endif
+
+/// Picks the widest counter the CPU supports.
+NewlineCounter pick_newline_counter() noexcept
+{
+#ifdef X86_BUILD
+    const auto& cpu = util::sys::cpu_features();
+    if (cpu.avx2)
+    {
+        return count_newlines_avx2;
+    }
+
+    if (cpu.sse2)
+    {
+        return count_newlines_sse2;
+    }
+#endif
+
+    return count_newlines_scalar;
+}
+
+} // namespace impl
+
+size_t count_newlines(const char* first, const char* last) noexcept
+{
+    static const auto counter = impl::pick_newline_counter();
+    return counter(first, last);
+}
+
+struct LineReporter::Window
+{
+    std::string_view carry;
+    uint64_t carry_offset;
+    std::string_view data;
+    uint64_t data_offset;
+
+    /// Returns the first offset reachable.
+    uint64_t begin() const noexcept
+    {
+        return carry.empty() ? data_offset : std::min(carry_offset, data_offset);
+    }
+
+    /// Returns the offset following the last byte reachable.
+    uint64_t end() const noexcept
+    {
+        return data_offset + data.size();
+    }
+
+    /// Splits a range into at most two pieces: the carried bytes before the buffer, then the buffer.
+    /// @returns the number of pieces
+    size_t pieces(uint64_t from, uint64_t to, std::array<std::pair<std::string_view, uint64_t>, 2>& out) const noexcept
+    {
+        size_t count {0};
+        from = std::max(from, begin());
+        to   = std::min(to, end());
+
+        if (from < data_offset && from < to)
+        {
+            auto stop = std::min({to, data_offset, carry_offset + carry.size()});
+            if (from < stop)
+            {
+                out[count++] = {carry.substr(from - carry_offset, stop - from), from};
+            }
+            from = std::max(from, data_offset);
+        }
+
+        if (from < to)
+        {
+            out[count++] = {data.substr(from - data_offset, to - from), from};
+        }
+
+        return count;
+    }
+
+    /// Returns the offset of the first line break in a range, or the end of the range.
+    uint64_t find_newline(uint64_t from, uint64_t to) const noexcept
+    {
+        std::array<std::pair<std::string_view, uint64_t>, 2> parts;
+        for (size_t i {0}, count = pieces(from, to, parts); i < count; ++i)
+        {
+            auto [piece, offset] = parts[i];
+            if (auto found = static_cast<const char*>(std::memchr(piece.data(), '\n', piece.size())))
+            {
+                return offset + static_cast<uint64_t>(found - piece.data());
+            }
+        }
+
+        return to;
+    }
+
+    /// Returns the start of the line holding an offset, or the first offset reachable if the line starts before it.
+    uint64_t line_start(uint64_t position) const noexcept
+    {
+        std::array<std::pair<std::string_view, uint64_t>, 2> parts;
+        for (auto count = pieces(begin(), position, parts); count > 0; --count)
+        {
+            auto [piece, offset] = parts[count - 1];
+            if (auto found = piece.rfind('\n'); found != std::string_view::npos)
+            {
+                return offset + found + 1;
+            }
+        }
+
+        return begin();
+    }
+
+    /// Counts the line breaks in a range.
+    uint64_t count(uint64_t from, uint64_t to) const noexcept
+    {
+        std::array<std::pair<std::string_view, uint64_t>, 2> parts;
+        uint64_t total {0};
+        for (size_t i {0}, count = pieces(from, to, parts); i < count; ++i)
+        {
+            total += count_newlines(parts[i].first.data(), parts[i].first.data() + parts[i].first.size());
+        }
+
+        return total;
+    }
+
+    /// Appends the bytes of a range.
+    void append(uint64_t from, uint64_t to, util::io::OutputBuffer& out) const
+    {
+        std::array<std::pair<std::string_view, uint64_t>, 2> parts;
+        for (size_t i {0}, count = pieces(from, to, parts); i < count; ++i)
+        {
+            out.append(parts[i].first);
+        }
+    }
+};
+
+LineReporter::LineReporter(std::string_view name, bool line_numbers, size_t before, size_t after, bool retained)
+    : m_name {name}, m_line_numbers {line_numbers}, m_before {before}, m_after {after}, m_retained {retained}
+{
+}
+
+void LineReporter::report(std::string_view data, uint64_t data_offset, uint64_t end, const std::vector<Match>& matches, bool last,
+                          util::io::OutputBuffer& out)
+{
+    // with the bytes retained, a chunk that neither matches nor completes earlier lines costs nothing
+    if (m_finished || (m_retained && matches.empty() && !m_pending && !m_after_left))
+    {
+        m_finished |= last;
+        return;
+    }
+
+    const Window window {m_carry, m_carry_offset, data, data_offset};
+    const auto limit = last ? window.end() : end;
+
+    for (const auto& match: matches)
+    {
+        auto start = window.line_start(match.first);
+        if (m_pending && start == m_pending_start)
+        {
+            m_pending_matches.push_back(match);
+            continue;
+        }
+
+        // a new matching line completes the previous one, and bounds its context
+        if (m_pending)
+        {
+            print_pending(window, start, false, out);
+        }
+        else
+        {
+            print_after(window, start, false, out);
+        }
+
+        // context before the line, without repeating printed lines
+        auto number = line_number(window, start);
+        auto first  = start;
+        auto floor  = std::max(m_printed, window.begin());
+        size_t count {0};
+        for (; count < m_before && first > floor; ++count)
+        {
+            first = window.line_start(first - 1);
+        }
+
+        if (m_any_printed && first > m_printed && (m_before || m_after))
+        {
+            out.append("Info: --\n");
+        }
+
+        for (auto line = first; line < start; --count)
+        {
+            auto line_end = window.find_newline(line, start);
+            print_line(window, line, line_end, number - count, '-', out);
+            line = line_end + 1;
+        }
+
+        m_any_printed    = true;
+        m_pending        = true;
+        m_pending_start  = start;
+        m_pending_number = number;
+        m_pending_matches.assign(1, match);
+    }
+
+    if (m_pending)
+    {
+        print_pending(window, limit, last, out);
+    }
+    else
+    {
+        print_after(window, limit, last, out);
+    }
+
+    if (last)
+    {
+        m_finished = true;
+        return;
+    }
+
+    if (m_retained)
+    {
+        return;
+    }
+
+    // the buffer goes away: count its lines now, and carry the bytes that lines crossing its end still need
+    if (m_line_numbers && m_counted < end)
+    {
+        m_lines += window.count(m_counted, end);
+        m_counted = end;
+    }
+
+    auto needed = window.line_start(end);
+    for (size_t i {0}; i < m_before && needed > window.begin(); ++i)
+    {
+        needed = window.line_start(needed - 1);
+    }
+    needed = std::max(needed, m_printed);
+
+    if (m_pending)
+    {
+        needed = std::min(needed, m_pending_start);
+    }
+
+    if (m_after_left)
+    {
+        needed = std::min(needed, m_printed);
+    }
+
+    needed = std::max({needed, end - std::min<uint64_t>(end, MAX_LINE_CARRY), window.begin()});
+
+    std::string carry;
+    std::array<std::pair<std::string_view, uint64_t>, 2> parts;
+    for (size_t i {0}, count = window.pieces(needed, end, parts); i < count; ++i)
+    {
+        carry.append(parts[i].first);
+    }
+
+    m_carry        = std::move(carry);
+    m_carry_offset = needed;
+}
+
+uint64_t LineReporter::line_number(const Window& window, uint64_t line_start) noexcept
+{
+    // lines counted past the start were counted in the middle of this line
+    if (m_counted < line_start)
+    {
+        m_lines += window.count(m_counted, line_start);
+        m_counted = line_start;
+    }
+
+    return m_lines + 1;
+}
+
+void LineReporter::print_pending(const Window& window, uint64_t limit, bool last, util::io::OutputBuffer& out)
+{
+    auto line_end = window.find_newline(m_pending_start, limit);
+    if (line_end == limit && !last)
+    {
+        return;
+    }
+
+    print_line(window, m_pending_start, line_end, m_pending_number, ':', out);
+    m_pending        = false;
+    m_printed        = line_end < limit ? line_end + 1 : limit;
+    m_printed_number = m_pending_number;
+    m_after_left     = m_after;
+    m_pending_matches.clear();
+
+    print_after(window, limit, last, out);
+}
+
+void LineReporter::print_after(const Window& window, uint64_t limit, bool last, util::io::OutputBuffer& out)
+{
+    while (m_after_left && m_printed < limit)
+    {
+        auto line_end = window.find_newline(m_printed, limit);
+        if (line_end == limit && !last)
+        {
+            return;
+        }
+
+        print_line(window, m_printed, line_end, ++m_printed_number, '-', out);
+        m_printed = line_end < limit ? line_end + 1 : limit;
+        --m_after_left;
+    }
+}
+
+void LineReporter::print_line(const Window& window, uint64_t begin, uint64_t end, uint64_t number, char separator,
+                              util::io::OutputBuffer& out)
+{
+    out.append("Info: ").append(m_name);
+    if (m_line_numbers)
+    {
+        out.append(separator).append_number(number);
+    }
+    out.append(separator);
+
+    // overlapping matches, from several patterns, are highlighted as one
+    auto cursor = std::max(begin, window.begin());
+    if (separator == ':')
+    {
+        for (const auto& [position, length]: m_pending_matches)
+        {
+            auto match_begin = std::max(position, cursor);
+            auto match_end   = std::min(position + length, end);
+            if (match_begin >= match_end)
+            {
+                continue;
+            }
+
+            window.append(cursor, match_begin, out);
+            out.append("\033[1;32m");
+            window.append(match_begin, match_end, out);
+            out.append("\033[0m");
+            cursor = match_end;
+        }
+    }
+
+    window.append(cursor, end, out);
+    out.append('\n');
+}
+
+} // namespace cppgrep
@@ -1,32 +1,655 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "grep.h"
+#include "util/local_socket.h"
 #include "util/log.h"
 
 using cppgrep::Grep;
 
-int main(int argc, char* argv[])
+namespace {
+
+constexpr auto USAGE {"Usage: cppgrep [options] <path> <string>, where <path> is a file or "
+                      "directory, and <string> is the text to find.\n"
+                      "       cppgrep [options] --patterns-file=<file> <path>, to find any of the lines of <file>.\n"
+                      "       cppgrep [options] --serve=<socket>, to answer searches sent with --connect=<socket>.\n"
+                      "Options:\n"
+                      "  -a, --text              search binary files like text\n"
+                      "  -A, --after-context=<n> print <n> lines after each matching line\n"
+                      "  -B, --before-context=<n>  print <n> lines before each matching line\n"
+                      "  --binary-files=<mode>   files with a NUL byte or invalid UTF-8 at the start: binary (report a match\n"
+                      "                          once, the default), without-match (skip them) or text\n"
+                      "  --chunk-size=<size>     bytes searched per task, 64K to 16M (default 256K)\n"
+                      "  --connect=<socket>      send the search to a server listening on <socket>, and print its answer\n"
+                      "  -c, --count             print the number of matches of each matching file\n"
+                      "  -C, --context=<n>       print <n> lines before and after each matching line\n"
+                      "  --fuzzy=<k>             find text within <k> substitutions, insertions or deletions of a literal\n"
+                      "                          pattern, and print the edit distance of each match\n"
+                      "  -I                      skip binary files, same as --binary-files=without-match\n"
+                      "  -i, --ignore-case       ignore the case of letters\n"
+                      "  --index=<file>          narrow directory searches with a trigram index, updated first\n"
+                      "  --include=<glob>        only search files whose name matches; may be repeated\n"
+                      "  --exclude=<glob>        skip files whose name matches; may be repeated\n"
+                      "  --exclude-dir=<glob>    skip directories whose name matches; may be repeated\n"
+                      "  --no-ignore             don't honor .gitignore and .ignore files, nor skip .git directories\n"
+                      "  -l, --files-with-matches  print only the names of the matching files\n"
+                      "  -m, --max-count=<n>     stop searching a file after <n> matches\n"
+                      "  --max-memory=<size>     bytes of buffers held by queued chunks, which bounds the memory of a\n"
+                      "                          stream whatever its length (default 1024M)\n"
+                      "  -n, --line-number       print matching lines whole, with their line numbers\n"
+                      "  --ordered               group the results per file, in offset order\n"
+                      "  --patterns-file=<file>  search for every non-empty line of the file at once\n"
+                      "  --queue-depth=<n>       read files asynchronously, keeping up to <n> reads in flight\n"
+                      "  --range-size=<size>     read files of at least <size> bytes in ranges, with positional reads on each\n"
+                      "                          worker, instead of mapping them; files that can't be mapped always are\n"
+                      "  --regex                 treat the patterns as regular expressions\n"
+                      "  --searcher=<kernel>     literal search kernel: auto, boyer-moore, scalar, sse2, avx2 or avx512\n"
+                      "  --serve=<socket>        answer searches on a local socket, keeping threads, buffers and directory\n"
+                      "                          listings across them\n"
+                      "  --stats[=<format>]      print traversal, I/O, scheduling and output counters at the end: text\n"
+                      "                          (the default) or json, which goes to stderr\n"
+                      "  --threads=<n>           number of worker threads; 0 searches on the main thread\n"
+                      "  -z, --search-zip        search the decompressed bytes of gzip and zlib files (.gz, .tgz, .zz)"};
+
+/// Max bytes of a query sent to a server.
+constexpr size_t MAX_QUERY_SIZE {1U << 20};
+
+/// Time a client has to send its query, since queries are answered one at a time.
+constexpr std::chrono::milliseconds QUERY_TIMEOUT {5000};
+
+/// Short forms of the options that don't take a value.
+constexpr std::pair<std::string_view, std::string_view> SHORT_OPTIONS[] {
+    {"-a", "--text"}, {"-c", "--count"}, {"-I", "--binary-files=without-match"}, {"-i", "--ignore-case"}, {"-l", "--files-with-matches"},
+    {"-n", "--line-number"}, {"-z", "--search-zip"}};
+
+/// Short forms of the options that take the next argument as their value.
+constexpr std::pair<std::string_view, std::string_view> SHORT_VALUE_OPTIONS[] {
+    {"-A", "--after-context"}, {"-B", "--before-context"}, {"-C", "--context"}, {"-m", "--max-count"}};
+
+/// Parses an unsigned number, rejecting trailing characters.
+template <typename T>
+bool parse_number(std::string_view value, T& number)
+{
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+    return ec == std::errc {} && end == value.data() + value.size() && !value.empty();
+}
+
+/// Parses a size in bytes, with an optional K or M suffix.
+template <typename T>
+bool parse_size(std::string_view value, T& size)
+{
+    T multiplier {1};
+    if (!value.empty() && (value.back() == 'K' || value.back() == 'M'))
+    {
+        multiplier = value.back() == 'K' ? 1024 : 1024 * 1024;
+        value.remove_suffix(1);
+    }
+
+    if (!parse_number(value, size))
+    {
+        return false;
+    }
+
+    size *= multiplier;
+    return true;
+}
+
+/// Reads the non-empty lines of a file, without line breaks.
+/// @returns false if the file can't be read
+bool read_patterns(const std::string& path, std::vector<std::string>& patterns)
+{
+    std::ifstream stream {path, std::ios::binary};
+    if (!stream.good())
+    {
+        return false;
+    }
+
+    for (std::string line; std::getline(stream, line);)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        if (!line.empty())
+        {
+            patterns.push_back(std::move(line));
+        }
+    }
+
+    return !stream.bad();
+}
+
+/// Parses an option of the form --name=value into the search options.
+/// @returns false if the option is unknown or its value is invalid
+bool parse_option(std::string_view arg, cppgrep::Options& options, std::string& patterns_file)
+{
+    auto separator = arg.find('=');
+    auto name      = arg.substr(0, separator);
+    auto value     = separator == std::string_view::npos ? std::string_view {} : arg.substr(separator + 1);
+
+    if (name == "--after-context")
+    {
+        return parse_number(value, options.after_context);
+    }
+
+    if (name == "--before-context")
+    {
+        return parse_number(value, options.before_context);
+    }
+
+    if (name == "--binary-files")
+    {
+        constexpr std::pair<std::string_view, cppgrep::BinaryMode> modes[] {
+            {"binary", cppgrep::BinaryMode::Report}, {"without-match", cppgrep::BinaryMode::Skip}, {"text", cppgrep::BinaryMode::Text}};
+        auto mode = std::find_if(std::begin(modes), std::end(modes), [value](const auto& entry) { return entry.first == value; });
+        if (mode == std::end(modes))
+        {
+            return false;
+        }
+
+        options.binary = mode->second;
+        return true;
+    }
+
+    if (name == "--chunk-size")
+    {
+        return parse_size(value, options.chunk_size);
+    }
+
+    if (name == "--context")
+    {
+        auto valid             = parse_number(value, options.after_context);
+        options.before_context = options.after_context;
+        return valid;
+    }
+
+    if (name == "--count")
+    {
+        options.report = cppgrep::ReportMode::Count;
+        return value.empty();
+    }
+
+    if (name == "--exclude")
+    {
+        options.exclude.emplace_back(value);
+        return !value.empty();
+    }
+
+    if (name == "--exclude-dir")
+    {
+        options.exclude_dir.emplace_back(value);
+        return !value.empty();
+    }
+
+    if (name == "--files-with-matches")
+    {
+        options.report = cppgrep::ReportMode::FilesWithMatches;
+        return value.empty();
+    }
+
+    if (name == "--fuzzy")
+    {
+        return parse_number(value, options.max_edits) && options.max_edits > 0;
+    }
+
+    if (name == "--ignore-case")
+    {
+        options.ignore_case = true;
+        return value.empty();
+    }
+
+    if (name == "--include")
+    {
+        options.include.emplace_back(value);
+        return !value.empty();
+    }
+
+    if (name == "--index")
+    {
+        options.index_path = value;
+        return !value.empty();
+    }
+
+    if (name == "--line-number")
+    {
+        options.line_numbers = true;
+        return value.empty();
+    }
+
+    if (name == "--max-count")
+    {
+        return parse_number(value, options.max_count) && options.max_count > 0;
+    }
+
+    if (name == "--max-memory")
+    {
+        return parse_size(value, options.max_memory) && options.max_memory > 0;
+    }
+
+    if (name == "--no-ignore")
+    {
+        options.ignore_files = false;
+        return value.empty();
+    }
+
+    if (name == "--ordered")
+    {
+        options.ordered = true;
+        return value.empty();
+    }
+
+    if (name == "--patterns-file")
+    {
+        patterns_file = value;
+        return !value.empty();
+    }
+
+    if (name == "--queue-depth")
+    {
+        return parse_number(value, options.queue_depth) && options.queue_depth > 0;
+    }
+
+    if (name == "--range-size")
+    {
+        return parse_size(value, options.range_read_size) && options.range_read_size > 0;
+    }
+
+    if (name == "--regex")
+    {
+        options.regex = true;
+        return value.empty();
+    }
+
+    if (name == "--search-zip")
+    {
+        options.search_zip = true;
+        return value.empty();
+    }
+
+    if (name == "--searcher")
+    {
+        return cppgrep::parse_searcher_kind(value, options.searcher);
+    }
+
+    if (name == "--stats")
+    {
+        constexpr std::pair<std::string_view, cppgrep::StatsFormat> formats[] {
+            {"", cppgrep::StatsFormat::Text}, {"text", cppgrep::StatsFormat::Text}, {"json", cppgrep::StatsFormat::Json}};
+        auto format = std::find_if(std::begin(formats), std::end(formats), [value](const auto& entry) { return entry.first == value; });
+        if (format == std::end(formats) || (value.empty() && separator != std::string_view::npos))
+        {
+            return false;
+        }
+
+        options.stats = format->second;
+        return true;
+    }
+
+    if (name == "--text")
+    {
+        options.binary = cppgrep::BinaryMode::Text;
+        return value.empty();
+    }
+
+    if (name == "--threads")
+    {
+        return parse_number(value, options.max_threads);
+    }
+
+    return false;
+}
+
+/// Arguments of a search, from the command line or from a query sent to a server.
+struct Command
+{
+    cppgrep::Options options;
+    std::string patterns_file;
+    std::vector<std::string> positional;
+    std::string serve;   //!< Socket to answer queries on, instead of searching; empty for none.
+    std::string connect; //!< Socket of a server that runs the search instead; empty for none.
+};
+
+/// Parses arguments, without the program name, into a command.
+/// @param invalid - receives the argument that isn't valid, if any
+/// @returns false if an argument isn't valid
+bool parse_args(const std::vector<std::string_view>& args, Command& command, std::string& invalid)
+{
+    std::string expanded;
+    for (size_t i {0}; i < args.size(); ++i)
+    {
+        auto arg = args[i];
+        if (auto alias = std::find_if(std::begin(SHORT_OPTIONS), std::end(SHORT_OPTIONS), [arg](const auto& entry) { return entry.first == arg; });
+            alias != std::end(SHORT_OPTIONS))
+        {
+            arg = alias->second;
+        }
+        else if (auto value_alias = std::find_if(std::begin(SHORT_VALUE_OPTIONS), std::end(SHORT_VALUE_OPTIONS),
+                                                 [arg](const auto& entry) { return entry.first == arg; });
+                 value_alias != std::end(SHORT_VALUE_OPTIONS) && i + 1 < args.size())
+        {
+            expanded = std::string {value_alias->second} + '=' + std::string {args[++i]};
+            arg      = expanded;
+        }
+
+        if (arg.size() > 2 && arg.substr(0, 2) == "--")
+        {
+            auto separator = arg.find('=');
+            auto name      = arg.substr(0, separator);
+            auto value     = separator == std::string_view::npos ? std::string_view {} : arg.substr(separator + 1);
+            if (name == "--serve" || name == "--connect")
+            {
+                (name == "--serve" ? command.serve : command.connect) = value;
+                if (!value.empty())
+                {
+                    continue;
+                }
+            }
+            else if (parse_option(arg, command.options, command.patterns_file))
+            {
+                continue;
+            }
+
+            invalid = args[i];
+            return false;
+        }
+
+        command.positional.emplace_back(arg);
+    }
+
+    return true;
+}
+
+/// Checks if a command has a path and a pattern, or a path and a patterns file.
+bool has_search(const Command& command) noexcept
+{
+    return command.positional.size() == (command.patterns_file.empty() ? 2U : 1U);
+}
+
+/// Runs the search of a command.
+/// @param message - receives the number of results, or the error that prevented the search
+/// @returns false on an error
+bool run_search(const Command& command, std::string& message)
+{
+    std::vector<std::string> patterns;
+    if (!command.patterns_file.empty() && !read_patterns(command.patterns_file, patterns))
+    {
+        message = "Unable to read the patterns file: " + command.patterns_file;
+        return false;
+    }
+
+    if (command.patterns_file.empty())
+    {
+        patterns.push_back(command.positional[1]);
+    }
+
+    try
+    {
+        auto grep  = Grep::build_grep(command.positional[0], std::move(patterns), command.options);
+        auto count = grep.search();
+
+        message = util::fmt::format_str("Found %lu results.", count);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        message = e.what();
+        return false;
+    }
+}
+
+/// Sends what is logged to std::cout and std::cerr while it lives to a client, so that the log lines and statistics
+/// of a query go along with its results.
+class ClientLog final : public std::streambuf
 {
-    const auto max_threads {std::thread::hardware_concurrency()};
-    const uint64_t max_memory {1073741824}; // 1GB RAM (max amount of buffers queued to thread pool)
+public:
+    explicit ClientLog(const util::sys::LocalSocket& client)
+        : m_client {client}, m_out {std::cout.flush().rdbuf(this)}, m_err {std::cerr.rdbuf(this)}
+    {
+    }
+
+    ~ClientLog() noexcept override
+    {
+        std::cout.rdbuf(m_out);
+        std::cerr.rdbuf(m_err);
+    }
 
-    if (argc == 3)
+    ClientLog(const ClientLog&) = delete;
+    ClientLog& operator=(const ClientLog&) = delete;
+
+protected:
+    int_type overflow(int_type c) override
     {
-        try
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
         {
-            auto grep  = Grep::build_grep(argv[1], argv[2], max_memory, max_threads);
-            auto count = grep.search();
+            auto byte = traits_type::to_char_type(c);
+            m_client.send({&byte, 1});
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize size) override
+    {
+        m_client.send({data, static_cast<size_t>(size)});
+        return size;
+    }
 
-            util::log::info("Found %lu results.", count);
+private:
+    const util::sys::LocalSocket& m_client;
+    std::streambuf* m_out; //!< Buffer of std::cout before the query.
+    std::streambuf* m_err; //!< Buffer of std::cerr before the query.
+};
+
+/// Reads a query: the client's working directory, the number of arguments, then the arguments, each followed by a
+/// null character.
+/// @returns false if the client went away, or was idle for QUERY_TIMEOUT, before the query was complete
+bool read_query(const util::sys::LocalSocket& client, std::vector<std::string>& query)
+{
+    std::string received;
+    std::array<char, 4096> buffer;
+    size_t count {2};
+    for (size_t begin {0}; query.size() < count;)
+    {
+        auto end = received.find('\0', begin);
+        if (end == std::string::npos)
+        {
+            auto size = client.receive(buffer.data(), buffer.size());
+            if (!size || received.size() + size > MAX_QUERY_SIZE)
+            {
+                return false;
+            }
+
+            received.append(buffer.data(), size);
+            continue;
+        }
+
+        query.push_back(received.substr(begin, end - begin));
+        begin = end + 1;
+        if (query.size() == 2)
+        {
+            if (!parse_number(query[1], count))
+            {
+                return false;
+            }
+            count += 2;
+        }
+    }
+
+    return true;
+}
+
+/// Answers a query with the output of its search, then the number of results or an error.
+/// Relative paths are resolved against the client's working directory, and results name files by absolute path.
+void answer(const util::sys::LocalSocket& client, const cppgrep::Options& defaults, const std::shared_ptr<cppgrep::SharedResources>& shared)
+{
+    std::vector<std::string> query;
+    if (!read_query(client, query))
+    {
+        return;
+    }
+
+    auto reply = [&client](std::string_view prefix, std::string_view text) { client.send(std::string {prefix}.append(text).append("\n")); };
+
+    Command command;
+    command.options.chunk_size = defaults.chunk_size;
+    command.options.max_memory = defaults.max_memory;
+
+    std::string invalid;
+    if (!parse_args({query.begin() + 2, query.end()}, command, invalid))
+    {
+        reply("Error: ", "Invalid option: " + invalid);
+        return;
+    }
+
+    if (!command.serve.empty() || !command.connect.empty() || !has_search(command))
+    {
+        reply("Error: ", "Two arguments are required, or one with a patterns file!");
+        return;
+    }
+
+    if (command.positional[0] == cppgrep::STDIN_PATH)
+    {
+        reply("Error: ", "The standard input can't be searched through a server.");
+        return;
+    }
+
+    const std::filesystem::path directory {query[0]};
+    for (auto path: {&command.positional[0], &command.patterns_file, &command.options.index_path})
+    {
+        if (!path->empty())
+        {
+            *path = (directory / *path).string();
+        }
+    }
+
+    command.options.shared    = shared;
+    command.options.output_fd = client.get();
+
+    std::string message;
+    auto found = [&] {
+        ClientLog log {client};
+        return run_search(command, message);
+    }();
+    reply(found ? "Info: " : "Error: ", message);
+}
+
+/// Answers queries on a local socket until the process is stopped, one at a time, keeping the worker threads, the
+/// read buffers and the directory listings across queries.
+void serve(const Command& command)
+{
+    util::sys::LocalListener listener {command.serve.c_str()};
+    if (!listener.valid())
+    {
+        util::log::error("Unable to listen on %s; another server may be listening there.", command.serve.c_str());
+        return;
+    }
+
+    auto shared = std::make_shared<cppgrep::SharedResources>(command.options);
+    util::log::info("Serving searches on %s with %u threads.", command.serve.c_str(), shared->threads);
+
+    for (;;)
+    {
+        // an idle client would hold up the others
+        if (auto client = listener.accept(); client.valid() && client.set_receive_timeout(QUERY_TIMEOUT))
+        {
+            // a query that fails ends with an error, and the server goes on with the next one
+            try
+            {
+                answer(client, command.options, shared);
+            }
+            catch (const std::exception& e)
+            {
+                client.send(std::string {"Error: "}.append(e.what()).append("\n"));
+            }
+        }
+    }
+}
+
+/// Sends the arguments to a server as a query, and copies its answer to stdout.
+void connect(const std::string& socket_path, const std::vector<std::string_view>& args)
+{
+    auto server = util::sys::LocalSocket::connect(socket_path.c_str());
+    if (!server.valid())
+    {
+        util::log::error("Unable to connect to a server on %s.", socket_path.c_str());
+        return;
+    }
+
+    std::vector<std::string_view> forwarded;
+    std::copy_if(args.begin(), args.end(), std::back_inserter(forwarded), [](auto arg) { return arg.substr(0, 10) != "--connect="; });
+
+    std::error_code ec;
+    std::string query = std::filesystem::current_path(ec).string();
+    query.append(1, '\0').append(std::to_string(forwarded.size())).append(1, '\0');
+    for (auto arg: forwarded)
+    {
+        query.append(arg).append(1, '\0');
+    }
+
+    if (!server.send(query))
+    {
+        util::log::error("Unable to send the query to the server on %s.", socket_path.c_str());
+        return;
+    }
+
+    std::array<char, 65536> buffer;
+    while (auto size = server.receive(buffer.data(), buffer.size()))
+    {
+        std::fwrite(buffer.data(), 1, size, stdout);
+    }
+    std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const std::vector<std::string_view> args(argv + 1, argv + argc);
+
+    Command command;
+    command.options.max_threads = std::thread::hardware_concurrency();
+
+    std::string invalid;
+    if (!parse_args(args, command, invalid))
+    {
+        util::log::error("Invalid option: %s\n%s", invalid.c_str(), USAGE);
+        return 0;
+    }
+
+    if (!command.connect.empty())
+    {
+        connect(command.connect, args);
+    }
+    else if (!command.serve.empty())
+    {
+        serve(command);
+    }
+    else if (has_search(command))
+    {
+        std::string message;
+        if (run_search(command, message))
+        {
+            util::log::info(message);
         }
-        catch (std::invalid_argument& e)
+        else
         {
-            util::log::error(e.what());
+            util::log::error(message);
         }
     }
     else
     {
-        util::log::error("Two arguments are required!\n"
-                         "Usage: cppgrep <path> <string>, where <path> is a file or "
-                         "directory, and <string> is the text to find.");
+        util::log::error("Two arguments are required, or one with a patterns file!\n%s", USAGE);
     }
 
     return 0;
@@ -0,0 +1,591 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#include "case_fold.h"
+#include "multi_searcher.h"
+#include "simd.h"
+#include "util/sys.h"
+
+namespace cppgrep {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+constexpr uint32_t NO_PATTERN {UINT32_MAX};
+constexpr size_t TEDDY_BUCKETS {8};       //!< One bit per bucket in the fingerprint masks.
+constexpr size_t TEDDY_MAX_PATTERNS {32}; //!< Above this the buckets get too crowded to filter anything.
+constexpr size_t TEDDY_MAX_FINGERPRINT {3};
+
+constexpr size_t FILTER_BITS {1048576};      //!< Size of the fingerprint filter of the automaton, in bits.
+constexpr size_t MIN_FILTER_FINGERPRINT {3}; //!< Shorter fingerprints let too many candidates through.
+
+/// Aho-Corasick automaton flattened into a dense transition table.
+/// Bytes that don't occur in any pattern share a single class, so each row only has one entry per distinct pattern
+/// byte, which keeps the table cache friendly with thousands of patterns.
+/// Walking the automaton is bound by the latency of each lookup, so when all patterns are long enough, a bitmap of
+/// their hashed leading bytes picks the candidate starts first, and the automaton only verifies those.
+/// Folding case costs nothing in the automaton, as both cases of a letter share a byte class.
+class AhoCorasickSearcher final : public Searcher
+{
+public:
+    AhoCorasickSearcher(const std::vector<std::string>& patterns, bool ignore_case);
+
+    Match find(const char* first, const char* last) const noexcept override;
+
+    std::string_view name() const noexcept override
+    {
+        return "aho-corasick";
+    }
+
+private:
+    /// Flags a transition into a state where a pattern ends, so the scan loop needs a single load per byte.
+    static constexpr uint32_t ACCEPTING {0x80000000U};
+
+    /// Scans with the automaton alone, following failure transitions.
+    Match find_unanchored(const char* first, const char* last) const noexcept;
+
+    /// Scans the candidate starts let through by the fingerprint filter.
+    Match find_filtered(const char* first, const char* last) const noexcept;
+
+    /// Finds the longest pattern starting exactly at start.
+    /// @returns the match, or a match of length 0 if there is none
+    Match longest_at(const char* start, const char* last) const noexcept;
+
+    /// Hashes the fingerprint bytes, given as the first 4 bytes of a pattern or of the text.
+    uint32_t filter_key(uint32_t word) const noexcept
+    {
+        if (m_fold)
+        {
+            word = casefold::to_lower(word);
+        }
+
+        return (word & m_fingerprint_mask) * 0x9e3779b1U >> 12;
+    }
+
+    std::vector<std::string> m_patterns;
+    bool m_fold;
+    std::array<uint16_t, 256> m_classes {}; //!< Byte class of each byte value; 0 for bytes not in any pattern.
+    uint32_t m_class_count {1};
+    std::vector<uint32_t> m_delta {};       //!< Row offset of the next state, indexed by row offset + class.
+    std::vector<uint32_t> m_longest {};     //!< Longest pattern ending in each state, indexed by row offset / class count.
+    std::vector<uint32_t> m_depth {};       //!< Length of the path from the root to each state.
+    size_t m_max_size {0};
+    size_t m_fingerprint {SIZE_MAX};        //!< Number of leading bytes hashed by the filter.
+    uint32_t m_fingerprint_mask {0};        //!< Keeps the fingerprint bytes of a 4 byte word.
+    std::vector<uint64_t> m_filter {};      //!< Bit set of the hashed fingerprints; empty when not filtering.
+};
+
+AhoCorasickSearcher::AhoCorasickSearcher(const std::vector<std::string>& patterns, bool ignore_case)
+    : m_patterns {patterns}, m_fold {ignore_case}
+{
+    for (auto& pattern: m_patterns)
+    {
+        if (m_fold)
+        {
+            pattern = casefold::to_lower(pattern);
+        }
+
+        for (auto c: pattern)
+        {
+            auto& byte_class = m_classes[static_cast<uint8_t>(c)];
+            if (!byte_class)
+            {
+                byte_class = static_cast<uint16_t>(m_class_count++);
+            }
+        }
+
+        m_max_size    = std::max(m_max_size, pattern.size());
+        m_fingerprint = std::min(m_fingerprint, pattern.size());
+    }
+
+    // patterns are lowercase, so uppercase letters only need to follow the same transitions
+    for (char c {'A'}; m_fold && c <= 'Z'; ++c)
+    {
+        m_classes[static_cast<uint8_t>(c)] = m_classes[static_cast<uint8_t>(casefold::to_lower(c))];
+    }
+
+    // trie of the patterns; a 0 transition is missing, since the root is never a child
+    const auto width = m_class_count;
+    m_delta.assign(width, 0);
+    m_longest.assign(1, NO_PATTERN);
+    m_depth.assign(1, 0);
+    for (uint32_t id {0}; id < m_patterns.size(); ++id)
+    {
+        uint32_t state {0};
+        for (auto c: m_patterns[id])
+        {
+            auto index = state * width + m_classes[static_cast<uint8_t>(c)];
+            if (!m_delta[index])
+            {
+                if (m_delta.size() + width >= ACCEPTING)
+                {
+                    throw std::invalid_argument {"The pattern set is too large."};
+                }
+
+                m_delta[index] = static_cast<uint32_t>(m_longest.size());
+                m_longest.push_back(NO_PATTERN);
+                m_depth.push_back(m_depth[state] + 1);
+                m_delta.resize(m_delta.size() + width, 0);
+            }
+            state = m_delta[index];
+        }
+
+        // duplicates report the first occurrence
+        if (m_longest[state] == NO_PATTERN)
+        {
+            m_longest[state] = id;
+        }
+    }
+
+    // breadth first, so the failure state of each state is complete before its own row is filled
+    std::vector<uint32_t> fail(m_longest.size(), 0);
+    std::vector<uint32_t> queue {};
+    queue.reserve(m_longest.size());
+    std::copy_if(m_delta.begin(), m_delta.begin() + width, std::back_inserter(queue), [](uint32_t next) { return next != 0; });
+
+    for (size_t head {0}; head < queue.size(); ++head)
+    {
+        auto state = queue[head];
+        if (m_longest[state] == NO_PATTERN)
+        {
+            // the longest suffix that is a pattern, if any
+            m_longest[state] = m_longest[fail[state]];
+        }
+
+        for (uint32_t byte_class {0}; byte_class < width; ++byte_class)
+        {
+            auto& next    = m_delta[state * width + byte_class];
+            auto fallback = m_delta[fail[state] * width + byte_class];
+            if (next)
+            {
+                fail[next] = fallback;
+                queue.push_back(next);
+            }
+            else
+            {
+                next = fallback;
+            }
+        }
+    }
+
+    // switch to row offsets and flag the accepting targets
+    for (auto& next: m_delta)
+    {
+        next = next * width | (m_longest[next] != NO_PATTERN ? ACCEPTING : 0);
+    }
+
+    m_fingerprint = std::min<size_t>(m_fingerprint, sizeof(uint32_t));
+    if (m_fingerprint < MIN_FILTER_FINGERPRINT)
+    {
+        return;
+    }
+
+    // the mask goes through memory like the words it is applied to, so it picks the same bytes whatever the endianness
+    const std::array<unsigned char, sizeof(uint32_t)> mask_bytes {0xff, 0xff, 0xff, static_cast<unsigned char>(m_fingerprint > 3 ? 0xff : 0)};
+    std::memcpy(&m_fingerprint_mask, mask_bytes.data(), sizeof(uint32_t));
+
+    std::vector<uint64_t> filter(FILTER_BITS / 64, 0);
+    size_t bits_set {0};
+    for (const auto& pattern: m_patterns)
+    {
+        uint32_t word {0};
+        std::memcpy(&word, pattern.data(), m_fingerprint);
+
+        auto key = filter_key(word);
+        auto bit = uint64_t {1} << (key % 64);
+        bits_set += (filter[key / 64] & bit) ? 0 : 1;
+        filter[key / 64] |= bit;
+    }
+
+    // a crowded filter lets most bytes through; scanning with the automaton alone is cheaper then
+    if (bits_set <= FILTER_BITS / 8)
+    {
+        m_filter = std::move(filter);
+    }
+}
+
+Match AhoCorasickSearcher::find(const char* first, const char* last) const noexcept
+{
+    return m_filter.empty() ? find_unanchored(first, last) : find_filtered(first, last);
+}
+
+Match AhoCorasickSearcher::find_filtered(const char* first, const char* last) const noexcept
+{
+    // candidates don't depend on each other, so unlike the automaton the loop isn't bound by load latency
+    auto it = first;
+    for (; last - it >= static_cast<std::ptrdiff_t>(sizeof(uint32_t)); ++it)
+    {
+        uint32_t word;
+        std::memcpy(&word, it, sizeof(word));
+
+        auto key = filter_key(word);
+        if (m_filter[key / 64] & uint64_t {1} << (key % 64))
+        {
+            if (auto match = longest_at(it, last); match.length)
+            {
+                return match;
+            }
+        }
+    }
+
+    // the last few starts can't hold a whole word, but may still hold a short pattern
+    for (; last - it >= static_cast<std::ptrdiff_t>(m_fingerprint); ++it)
+    {
+        if (auto match = longest_at(it, last); match.length)
+        {
+            return match;
+        }
+    }
+
+    return {last, 0, 0};
+}
+
+Match AhoCorasickSearcher::longest_at(const char* start, const char* last) const noexcept
+{
+    Match best {};
+    uint32_t row {0};
+    for (uint32_t depth {1}; depth <= m_max_size && depth <= last - start; ++depth)
+    {
+        row = m_delta[(row & ~ACCEPTING) + m_classes[static_cast<uint8_t>(start[depth - 1])]];
+
+        // a failure transition leaves the paths that begin at start
+        auto state = (row & ~ACCEPTING) / m_class_count;
+        if (m_depth[state] != depth)
+        {
+            break;
+        }
+
+        if (auto id = m_longest[state]; (row & ACCEPTING) && m_patterns[id].size() == depth)
+        {
+            best = {start, depth, id};
+        }
+    }
+
+    return best;
+}
+
+Match AhoCorasickSearcher::find_unanchored(const char* first, const char* last) const noexcept
+{
+    Match best {last, 0, 0};
+    auto stop = last;
+    uint32_t row {0};
+    for (auto it = first; it != stop; ++it)
+    {
+        row = m_delta[(row & ~ACCEPTING) + m_classes[static_cast<uint8_t>(*it)]];
+        if (!(row & ACCEPTING))
+        {
+            continue;
+        }
+
+        // the longest pattern ending here is the one that starts first; ending later it is also longer
+        auto id    = m_longest[(row & ~ACCEPTING) / m_class_count];
+        auto size  = m_patterns[id].size();
+        auto start = it + 1 - size;
+        if (start <= best.position)
+        {
+            best = {start, size, id};
+
+            // a match starting before this one has to end within reach of the longest pattern
+            stop = last - start > static_cast<std::ptrdiff_t>(m_max_size) ? start + m_max_size : last;
+        }
+    }
+
+    return best;
+}
+
+/// Patterns prepared for the Teddy kernels.
+/// The first bytes of each pattern (its fingerprint) are split into nibbles, and every nibble value maps to a mask
+/// of the buckets that have a pattern with that nibble at that position. Shuffles then look up 16 or 32 candidate
+/// starts at once, and only starts whose buckets survive all fingerprint bytes are verified.
+/// When folding, the patterns are lowercase, and a letter is also entered under the high nibble of its uppercase.
+struct Teddy
+{
+    std::vector<std::string> patterns;
+    bool fold;
+    std::array<std::vector<uint32_t>, TEDDY_BUCKETS> buckets {}; //!< Pattern ids of each bucket, longest first.
+    size_t fingerprint {TEDDY_MAX_FINGERPRINT};                  //!< Number of leading bytes used as fingerprint.
+    alignas(16) uint8_t low[TEDDY_MAX_FINGERPRINT][16] {};       //!< Buckets by low nibble, per fingerprint byte.
+    alignas(16) uint8_t high[TEDDY_MAX_FINGERPRINT][16] {};      //!< Buckets by high nibble, per fingerprint byte.
+
+    Teddy(const std::vector<std::string>& patterns, bool ignore_case);
+};
+
+/// Signature shared by the Teddy kernels.
+using TeddyKernel = Match (*)(const char* first, const char* last, const Teddy& teddy) noexcept;
+
+Teddy::Teddy(const std::vector<std::string>& texts, bool ignore_case)
+    : patterns {texts}, fold {ignore_case}
+{
+    for (auto& pattern: patterns)
+    {
+        if (fold)
+        {
+            pattern = casefold::to_lower(pattern);
+        }
+    }
+
+    // neighbours in sorted order share prefixes, so grouping them keeps the bucket masks sparse
+    std::vector<uint32_t> order(patterns.size());
+    std::iota(order.begin(), order.end(), 0U);
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return patterns[a] < patterns[b]; });
+
+    for (const auto& pattern: patterns)
+    {
+        fingerprint = std::min(fingerprint, pattern.size());
+    }
+
+    for (size_t i {0}; i < order.size(); ++i)
+    {
+        auto bucket = i * TEDDY_BUCKETS / order.size();
+        buckets[bucket].push_back(order[i]);
+
+        const auto& pattern = patterns[order[i]];
+        for (size_t j {0}; j < fingerprint; ++j)
+        {
+            auto byte = static_cast<uint8_t>(pattern[j]);
+            low[j][byte & 0x0f] |= static_cast<uint8_t>(1U << bucket);
+            high[j][byte >> 4] |= static_cast<uint8_t>(1U << bucket);
+            if (fold && casefold::is_letter(pattern[j]))
+            {
+                high[j][(byte & ~0x20U) >> 4] |= static_cast<uint8_t>(1U << bucket);
+            }
+        }
+    }
+
+    for (auto& bucket: buckets)
+    {
+        std::stable_sort(bucket.begin(), bucket.end(), [this](uint32_t a, uint32_t b) { return patterns[a].size() > patterns[b].size(); });
+    }
+}
+
+/// Verifies the patterns of the given buckets at a candidate start.
+/// @returns the longest match, or a match of length 0 if there is none
+inline Match verify(const char* start, const char* last, unsigned bucket_mask, const Teddy& teddy) noexcept
+{
+    Match best {};
+    for (; bucket_mask; bucket_mask &= bucket_mask - 1)
+    {
+        for (auto id: teddy.buckets[simd::lowest_bit(bucket_mask)])
+        {
+            const auto& pattern = teddy.patterns[id];
+            if (pattern.size() <= best.length)
+            {
+                // the rest of the bucket is shorter
+                break;
+            }
+
+            if (static_cast<size_t>(last - start) < pattern.size())
+            {
+                continue;
+            }
+
+            auto equal = teddy.fold ? casefold::equal(start, pattern.data(), pattern.size())
+                                    : std::memcmp(start, pattern.data(), pattern.size()) == 0;
+            if (equal)
+            {
+                best = {start, pattern.size(), id};
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
+/// Verifies the candidates of a block, where each bit in mask is a candidate start relative to block and
+/// candidate_buckets holds the buckets of each start.
+/// @returns the first verified match, or a match of length 0 if there is none
+inline Match verify(const char* block, const char* last, uint32_t mask, const uint8_t* candidate_buckets, const Teddy& teddy) noexcept
+{
+    for (; mask; mask &= mask - 1)
+    {
+        auto offset = simd::lowest_bit(mask);
+        if (auto match = verify(block + offset, last, candidate_buckets[offset], teddy); match.length)
+        {
+            return match;
+        }
+    }
+
+    return {};
+}
+
+/// Scalar kernel, used for the tail of a buffer that is shorter than a vector.
+Match find_teddy_scalar(const char* first, const char* last, const Teddy& teddy) noexcept
+{
+    const auto fingerprint = static_cast<std::ptrdiff_t>(teddy.fingerprint);
+    for (auto it = first; last - it >= fingerprint; ++it)
+    {
+        unsigned bucket_mask {0xff};
+        for (size_t i {0}; i < teddy.fingerprint; ++i)
+        {
+            auto byte = static_cast<uint8_t>(it[i]);
+            bucket_mask &= teddy.low[i][byte & 0x0f] & teddy.high[i][byte >> 4];
+        }
+
+        if (bucket_mask)
+        {
+            if (auto match = verify(it, last, bucket_mask, teddy); match.length)
+            {
+                return match;
+            }
+        }
+    }
+
+    return {last, 0, 0};
+}
+
+#ifdef X86_BUILD
+CPPGREP_TARGET("ssse3")
+Match find_teddy_ssse3(const char* first, const char* last, const Teddy& teddy) noexcept
+{
+    constexpr std::ptrdiff_t width {16};
+    const auto nibble = _mm_set1_epi8(0x0f);
+
+    __m128i low[TEDDY_MAX_FINGERPRINT];
+    __m128i high[TEDDY_MAX_FINGERPRINT];
+    for (size_t i {0}; i < teddy.fingerprint; ++i)
+    {
+        low[i]  = _mm_load_si128(reinterpret_cast<const __m128i*>(teddy.low[i]));
+        high[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(teddy.high[i]));
+    }
+
+    // every load of the fingerprint bytes must stay in the buffer
+    auto it = first;
+    for (const auto span = width - 1 + static_cast<std::ptrdiff_t>(teddy.fingerprint); last - it >= span; it += width)
+    {
+        auto candidates = _mm_set1_epi8(-1);
+        for (size_t i {0}; i < teddy.fingerprint; ++i)
+        {
+            auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it + i));
+            auto lo    = _mm_shuffle_epi8(low[i], _mm_and_si128(bytes, nibble));
+            auto hi    = _mm_shuffle_epi8(high[i], _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+            candidates = _mm_and_si128(candidates, _mm_and_si128(lo, hi));
+        }
+
+        auto empty = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(candidates, _mm_setzero_si128())));
+        if (auto mask = ~empty & 0xffffU)
+        {
+            alignas(16) uint8_t candidate_buckets[width];
+            _mm_store_si128(reinterpret_cast<__m128i*>(candidate_buckets), candidates);
+            if (auto match = verify(it, last, mask, candidate_buckets, teddy); match.length)
+            {
+                return match;
+            }
+        }
+    }
+
+    return find_teddy_scalar(it, last, teddy);
+}
+
+CPPGREP_TARGET("avx2")
+Match find_teddy_avx2(const char* first, const char* last, const Teddy& teddy) noexcept
+{
+    constexpr std::ptrdiff_t width {32};
+    const auto nibble = _mm256_set1_epi8(0x0f);
+
+    // shuffles work within 128 bit lanes, so both lanes get the same tables
+    __m256i low[TEDDY_MAX_FINGERPRINT];
+    __m256i high[TEDDY_MAX_FINGERPRINT];
+    for (size_t i {0}; i < teddy.fingerprint; ++i)
+    {
+        low[i]  = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(teddy.low[i])));
+        high[i] = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(teddy.high[i])));
+    }
+
+    auto it = first;
+    for (const auto span = width - 1 + static_cast<std::ptrdiff_t>(teddy.fingerprint); last - it >= span; it += width)
+    {
+        auto candidates = _mm256_set1_epi8(-1);
+        for (size_t i {0}; i < teddy.fingerprint; ++i)
+        {
+            auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it + i));
+            auto lo    = _mm256_shuffle_epi8(low[i], _mm256_and_si256(bytes, nibble));
+            auto hi    = _mm256_shuffle_epi8(high[i], _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+            candidates = _mm256_and_si256(candidates, _mm256_and_si256(lo, hi));
+        }
+
+        auto empty = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(candidates, _mm256_setzero_si256())));
+        if (auto mask = ~empty)
+        {
+            alignas(32) uint8_t candidate_buckets[width];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(candidate_buckets), candidates);
+            if (auto match = verify(it, last, mask, candidate_buckets, teddy); match.length)
+            {
+                return match;
+            }
+        }
+    }
+
+    // finish with half width vectors before going scalar
+    return find_teddy_ssse3(it, last, teddy);
+}
+#endif
+
+/// Searcher backed by one of the Teddy kernels.
+class TeddySearcher final : public Searcher
+{
+public:
+    TeddySearcher(const std::vector<std::string>& patterns, bool ignore_case, TeddyKernel kernel, std::string_view name)
+        : m_teddy {patterns, ignore_case}, m_kernel {kernel}, m_name {name}
+    {
+    }
+
+    Match find(const char* first, const char* last) const noexcept override
+    {
+        return m_kernel(first, last, m_teddy);
+    }
+
+    std::string_view name() const noexcept override
+    {
+        return m_name;
+    }
+
+private:
+    Teddy m_teddy;
+    TeddyKernel m_kernel;
+    std::string_view m_name;
+};
+
+} // namespace impl
+
+std::unique_ptr<const Searcher> build_multi_searcher(const std::vector<std::string>& patterns, SearcherKind kind, bool ignore_case)
+{
+#ifdef X86_BUILD
+    const auto& cpu = util::sys::cpu_features();
+
+    if (patterns.size() <= impl::TEDDY_MAX_PATTERNS)
+    {
+        // walk down from the requested width until the CPU supports the kernel
+        switch (kind)
+        {
+            case SearcherKind::Auto:
+            case SearcherKind::Avx512:
+            case SearcherKind::Avx2:
+                if (cpu.avx2)
+                {
+                    return std::make_unique<impl::TeddySearcher>(patterns, ignore_case, impl::find_teddy_avx2, "teddy-avx2");
+                }
+                [[fallthrough]];
+            case SearcherKind::Sse2:
+                if (cpu.ssse3)
+                {
+                    return std::make_unique<impl::TeddySearcher>(patterns, ignore_case, impl::find_teddy_ssse3, "teddy-ssse3");
+                }
+                [[fallthrough]];
+            case SearcherKind::Scalar:
+            case SearcherKind::BoyerMoore:
+                break;
+        }
+    }
+#else
+    (void)kind;
+#endif
+
+    return std::make_unique<impl::AhoCorasickSearcher>(patterns, ignore_case);
+}
+
+} // namespace cppgrep
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <fstream>
+
+#include "path_filter.h"
+
+#include "util/sys.h"
+
+namespace cppgrep {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+/// Line of an ignore file.
+struct IgnoreRule
+{
+    Glob glob;
+    bool negate;   //!< Re-includes what an earlier rule excluded.
+    bool dir_only; //!< Only matches directories; the line ended with "/".
+    bool anchored; //!< Matches the path from the ignore file's directory, rather than the name at any depth.
+};
+
+/// Appends the rules of an ignore file. A missing file has none.
+void read_rules(const std::string& path, std::vector<IgnoreRule>& rules);
+
+/// Finds the "]" closing a class. A "]" right after the opening bracket, or after its negation, is part of the class.
+/// @returns the position of the "]", or npos if the class isn't closed
+inline size_t class_end(std::string_view pattern, size_t open) noexcept
+{
+    auto first = open + 1;
+    if (first < pattern.size() && (pattern[first] == '!' || pattern[first] == '^'))
+    {
+        ++first;
+    }
+
+    return pattern.find(']', first + 1);
+}
+
+/// Checks if any of the globs matches a text.
+inline bool match_any(const std::vector<Glob>& globs, std::string_view text) noexcept
+{
+    return std::any_of(globs.begin(), globs.end(), [text](const auto& glob) { return glob.match(text); });
+}
+
+} // namespace impl
+
+struct PathFilter::Scope
+{
+    std::string dir;                     //!< Directory of the ignore files.
+    std::vector<impl::IgnoreRule> rules; //!< Rules of the directory, in file order.
+    ScopePtr parent;                     //!< Scope of the closest parent directory with ignore files.
+};
+
+Glob::Glob(std::string_view pattern)
+{
+    // a literal, or a star followed by a literal, is compared directly
+    constexpr std::string_view meta {"*?[\\"};
+    if (pattern.find_first_of(meta) == std::string_view::npos)
+    {
+        m_kind    = Kind::Literal;
+        m_literal = pattern;
+        return;
+    }
+
+    if (pattern.size() > 1 && pattern[0] == '*' && pattern.substr(1).find_first_of(meta) == std::string_view::npos)
+    {
+        m_kind    = Kind::Suffix;
+        m_literal = pattern.substr(1);
+        return;
+    }
+
+    for (size_t i {0}; i < pattern.size(); ++i)
+    {
+        auto c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size())
+        {
+            m_tokens.push_back({Token::Type::Byte, static_cast<unsigned char>(pattern[++i])});
+        }
+        else if (c == '*')
+        {
+            auto stars = i;
+            while (i + 1 < pattern.size() && pattern[i + 1] == '*')
+            {
+                ++i;
+            }
+
+            // "**/" at the start of a component also matches no directory at all
+            if (i == stars)
+            {
+                m_tokens.push_back({Token::Type::Star});
+            }
+            else if (i + 1 < pattern.size() && pattern[i + 1] == '/' && (stars == 0 || pattern[stars - 1] == '/'))
+            {
+                m_tokens.push_back({Token::Type::Directories});
+                ++i;
+            }
+            else
+            {
+                m_tokens.push_back({Token::Type::AnyPath});
+            }
+        }
+        else if (c == '?')
+        {
+            m_tokens.push_back({Token::Type::Any});
+        }
+        else if (auto close = c == '[' ? impl::class_end(pattern, i) : std::string_view::npos; close != std::string_view::npos)
+        {
+            auto first  = i + 1;
+            auto negate = pattern[first] == '!' || pattern[first] == '^';
+
+            std::bitset<256> bytes;
+            for (auto j = first + (negate ? 1 : 0); j < close; ++j)
+            {
+                auto low = static_cast<unsigned char>(pattern[j]);
+                if (j + 2 < close && pattern[j + 1] == '-')
+                {
+                    for (unsigned byte {low}; byte <= static_cast<unsigned char>(pattern[j + 2]); ++byte)
+                    {
+                        bytes.set(byte);
+                    }
+                    j += 2;
+                }
+                else
+                {
+                    bytes.set(low);
+                }
+            }
+
+            if (negate)
+            {
+                bytes.flip();
+            }
+            bytes.reset('/');
+
+            m_tokens.push_back({Token::Type::Class, 0, m_classes.size()});
+            m_classes.push_back(bytes);
+            i = close;
+        }
+        else
+        {
+            m_tokens.push_back({Token::Type::Byte, static_cast<unsigned char>(c)});
+        }
+    }
+}
+
+bool Glob::match(std::string_view text) const noexcept
+{
+    switch (m_kind)
+    {
+        case Kind::Literal:
+            return text == m_literal;
+
+        case Kind::Suffix:
+            return text.size() >= m_literal.size() && text.substr(text.size() - m_literal.size()) == m_literal &&
+                   text.find('/') >= text.size() - m_literal.size();
+
+        case Kind::General:
+            break;
+    }
+
+    return match(0, text);
+}
+
+bool Glob::match(size_t token, std::string_view text) const noexcept
+{
+    for (; token < m_tokens.size(); ++token)
+    {
+        const auto& current = m_tokens[token];
+        switch (current.type)
+        {
+            case Token::Type::Byte:
+                if (text.empty() || static_cast<unsigned char>(text[0]) != current.byte)
+                {
+                    return false;
+                }
+                text.remove_prefix(1);
+                break;
+
+            case Token::Type::Any:
+                if (text.empty() || text[0] == '/')
+                {
+                    return false;
+                }
+                text.remove_prefix(1);
+                break;
+
+            case Token::Type::Class:
+                if (text.empty() || !m_classes[current.index].test(static_cast<unsigned char>(text[0])))
+                {
+                    return false;
+                }
+                text.remove_prefix(1);
+                break;
+
+            case Token::Type::Star:
+                for (size_t skip {0};; ++skip)
+                {
+                    if (match(token + 1, text.substr(skip)))
+                    {
+                        return true;
+                    }
+
+                    if (skip == text.size() || text[skip] == '/')
+                    {
+                        return false;
+                    }
+                }
+
+            case Token::Type::AnyPath:
+                for (size_t skip {0}; skip <= text.size(); ++skip)
+                {
+                    if (match(token + 1, text.substr(skip)))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+
+            case Token::Type::Directories:
+                if (match(token + 1, text))
+                {
+                    return true;
+                }
+
+                for (size_t skip {0}; skip < text.size(); ++skip)
+                {
+                    if (text[skip] == '/' && match(token + 1, text.substr(skip + 1)))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+        }
+    }
+
+    return text.empty();
+}
+
+PathFilter::PathFilter(const std::vector<std::string>& include, const std::vector<std::string>& exclude,
+                       const std::vector<std::string>& exclude_dir, bool ignore_files)
+    : m_include {include.begin(), include.end()},
+      m_exclude {exclude.begin(), exclude.end()},
+      m_exclude_dir {exclude_dir.begin(), exclude_dir.end()},
+      m_ignore_files {ignore_files}
+{
+}
+
+PathFilter::~PathFilter() noexcept = default;
+
+bool PathFilter::ignore_files() const noexcept
+{
+    return m_ignore_files;
+}
+
+PathFilter::ScopePtr PathFilter::enter(const ScopePtr& parent, const std::string& dir, bool has_gitignore, bool has_ignore) const
+{
+    if (!m_ignore_files || (!has_gitignore && !has_ignore))
+    {
+        return parent;
+    }
+
+    // .ignore comes last, so that its rules win over the ones of .gitignore
+    std::vector<impl::IgnoreRule> rules;
+    auto separator = dir.empty() || dir.back() == '/' || dir.back() == '\\' ? "" : "/";
+    if (has_gitignore)
+    {
+        impl::read_rules(dir + separator + ".gitignore", rules);
+    }
+    if (has_ignore)
+    {
+        impl::read_rules(dir + separator + ".ignore", rules);
+    }
+
+    if (rules.empty())
+    {
+        return parent;
+    }
+
+    return std::make_shared<const Scope>(Scope {dir, std::move(rules), parent});
+}
+
+bool PathFilter::accept(const ScopePtr& scope, std::string_view path, std::string_view name, bool directory) const noexcept
+{
+    if (directory)
+    {
+        if ((m_ignore_files && name == ".git") || impl::match_any(m_exclude_dir, name))
+        {
+            return false;
+        }
+    }
+    else if ((!m_include.empty() && !impl::match_any(m_include, name)) || impl::match_any(m_exclude, name))
+    {
+        return false;
+    }
+
+    // the innermost ignore file with a matching rule decides; within a file, the last matching rule does
+    for (auto current = scope.get(); current; current = current->parent.get())
+    {
+        auto relative = path.substr(std::min(current->dir.size(), path.size()));
+        while (!relative.empty() && (relative[0] == '/' || relative[0] == '\\'))
+        {
+            relative.remove_prefix(1);
+        }
+
+#ifdef WIN32_BUILD
+        // ignore files use "/" whatever the platform
+        std::string generic {relative};
+        std::replace(generic.begin(), generic.end(), '\\', '/');
+        relative = generic;
+#endif
+
+        for (auto rule = current->rules.rbegin(); rule != current->rules.rend(); ++rule)
+        {
+            if ((!rule->dir_only || directory) && rule->glob.match(rule->anchored ? relative : name))
+            {
+                return rule->negate;
+            }
+        }
+    }
+
+    return true;
+}
+
+void impl::read_rules(const std::string& path, std::vector<IgnoreRule>& rules)
+{
+    std::ifstream stream {path, std::ios::binary};
+    for (std::string line; std::getline(stream, line);)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        // trailing spaces don't count, unless escaped
+        while (!line.empty() && line.back() == ' ' && !(line.size() > 1 && line[line.size() - 2] == '\\'))
+        {
+            line.pop_back();
+        }
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::string_view text {line};
+        auto negate = text[0] == '!';
+        if (negate || (text.size() > 1 && text[0] == '\\' && (text[1] == '#' || text[1] == '!')))
+        {
+            text.remove_prefix(1);
+        }
+
+        auto dir_only = !text.empty() && text.back() == '/';
+        if (dir_only)
+        {
+            text.remove_suffix(1);
+        }
+
+        // a "/" anywhere but at the end ties the pattern to the ignore file's directory
+        auto anchored = text.find('/') != std::string_view::npos;
+        if (!text.empty() && text[0] == '/')
+        {
+            text.remove_prefix(1);
+        }
+
+        if (!text.empty())
+        {
+            rules.push_back({Glob {text}, negate, dir_only, anchored});
+        }
+    }
+}
+
+} // namespace cppgrep
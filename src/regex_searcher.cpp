@@ -0,0 +1,1177 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "case_fold.h"
+#include "regex_searcher.h"
+
+namespace cppgrep {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+constexpr size_t UNBOUNDED {SIZE_MAX};
+constexpr uint32_t UNBOUNDED_REPEAT {UINT32_MAX};
+constexpr uint32_t MAX_REPEAT {1000};         //!< Largest count of a {n,m} quantifier.
+constexpr size_t MAX_NFA_STATES {65536};      //!< Larger patterns are rejected.
+constexpr size_t DFA_CACHE_SIZE {2097152};    //!< Budget of the lazy DFA of each thread, in bytes.
+constexpr size_t DFA_STATE_OVERHEAD {64};     //!< Approximate bookkeeping of a cached state, in bytes.
+constexpr uint32_t UNKNOWN {UINT32_MAX};      //!< Transition that hasn't been computed yet.
+constexpr uint32_t DEAD {0};                  //!< DFA state that can't lead to a match.
+
+using ByteSet = std::bitset<256>;
+
+/// Syntax tree of a regular expression.
+struct RegexNode
+{
+    enum class Type
+    {
+        Bytes,     //!< Matches one byte of the set.
+        Concat,    //!< Matches the children in sequence.
+        Alternate, //!< Matches any of the children.
+        Repeat     //!< Matches the only child between min and max times.
+    };
+
+    Type type {Type::Concat};
+    ByteSet bytes {};
+    std::vector<RegexNode> children {};
+    uint32_t min {0};
+    uint32_t max {0};
+};
+
+/// Recursive descent parser of the supported syntax.
+/// A valid UTF-8 sequence outside of bracket classes is a single atom. When folding case, it matches any of the
+/// case variants of its code point, and ASCII letters match both cases everywhere.
+class RegexParser
+{
+public:
+    RegexParser(std::string_view pattern, bool ignore_case) noexcept
+        : m_pattern {pattern}, m_fold {ignore_case}
+    {
+    }
+
+    /// @throws std::invalid_argument if the pattern isn't valid
+    RegexNode parse()
+    {
+        auto root = parse_alternate();
+        if (m_pos != m_pattern.size())
+        {
+            fail("unbalanced parenthesis");
+        }
+
+        return root;
+    }
+
+private:
+    /// Branches separated by "|".
+    RegexNode parse_alternate();
+
+    /// Quantified atoms, up to the next "|" or ")".
+    RegexNode parse_concat();
+
+    /// An atom and the quantifiers following it.
+    RegexNode parse_repeat();
+
+    RegexNode parse_atom();
+
+    /// Bracket class, after the "[".
+    ByteSet parse_class();
+
+    /// Escape sequence, after the "\".
+    ByteSet parse_escape();
+
+    /// Parses the bounds of a {n}, {n,} or {n,m} quantifier, after the "{".
+    /// @returns false, without consuming anything, if the brace doesn't start a quantifier
+    bool parse_bounds(uint32_t& min, uint32_t& max);
+
+    bool parse_count(uint32_t& count);
+
+    /// Parses a UTF-8 sequence of several bytes, starting with the byte before the current position.
+    /// @returns false, without consuming anything, if there is no valid sequence there
+    bool parse_utf8(RegexNode& node);
+
+    /// Adds the other case of the ASCII letters of a set, when folding.
+    ByteSet cased(const ByteSet& bytes) const noexcept;
+
+    bool at_end() const noexcept
+    {
+        return m_pos == m_pattern.size();
+    }
+
+    char peek() const noexcept
+    {
+        return m_pattern[m_pos];
+    }
+
+    [[noreturn]] void fail(std::string_view reason) const
+    {
+        throw std::invalid_argument {"Invalid regex: " + std::string {reason} + "."};
+    }
+
+    std::string_view m_pattern;
+    bool m_fold;
+    size_t m_pos {0};
+};
+
+/// Returns a set holding a single byte.
+inline ByteSet single(char c) noexcept
+{
+    return ByteSet {}.set(static_cast<uint8_t>(c));
+}
+
+/// Returns a set holding the bytes in [first, last].
+inline ByteSet range(char first, char last) noexcept
+{
+    ByteSet bytes;
+    for (auto c = static_cast<uint8_t>(first); c <= static_cast<uint8_t>(last); ++c)
+    {
+        bytes.set(c);
+    }
+
+    return bytes;
+}
+
+/// Complements a set; the result never holds a line break, as matches don't span lines.
+inline ByteSet negate(const ByteSet& bytes) noexcept
+{
+    return ~bytes & ~single('\n');
+}
+
+RegexNode RegexParser::parse_alternate()
+{
+    RegexNode node {RegexNode::Type::Alternate};
+    node.children.push_back(parse_concat());
+    while (!at_end() && peek() == '|')
+    {
+        ++m_pos;
+        node.children.push_back(parse_concat());
+    }
+
+    if (node.children.size() == 1)
+    {
+        return std::move(node.children.front());
+    }
+
+    return node;
+}
+
+RegexNode RegexParser::parse_concat()
+{
+    RegexNode node {RegexNode::Type::Concat};
+    while (!at_end() && peek() != '|' && peek() != ')')
+    {
+        // flatten groups, so that literal runs inside them stay visible to the prefilter
+        auto child = parse_repeat();
+        if (child.type == RegexNode::Type::Concat)
+        {
+            std::move(child.children.begin(), child.children.end(), std::back_inserter(node.children));
+        }
+        else
+        {
+            node.children.push_back(std::move(child));
+        }
+    }
+
+    if (node.children.size() == 1)
+    {
+        return std::move(node.children.front());
+    }
+
+    return node;
+}
+
+RegexNode RegexParser::parse_repeat()
+{
+    auto node = parse_atom();
+    while (!at_end())
+    {
+        uint32_t min {0};
+        uint32_t max {UNBOUNDED_REPEAT};
+        switch (peek())
+        {
+            case '*':
+                ++m_pos;
+                break;
+            case '+':
+                ++m_pos;
+                min = 1;
+                break;
+            case '?':
+                ++m_pos;
+                max = 1;
+                break;
+            case '{':
+                ++m_pos;
+                if (!parse_bounds(min, max))
+                {
+                    --m_pos;
+                    return node;
+                }
+                break;
+            default:
+                return node;
+        }
+
+        RegexNode repeat {RegexNode::Type::Repeat};
+        repeat.min = min;
+        repeat.max = max;
+        repeat.children.push_back(std::move(node));
+        node = std::move(repeat);
+    }
+
+    return node;
+}
+
+RegexNode RegexParser::parse_atom()
+{
+    RegexNode node {RegexNode::Type::Bytes};
+    auto c = m_pattern[m_pos++];
+    switch (c)
+    {
+        case '(':
+            if (m_pattern.substr(m_pos, 2) == "?:")
+            {
+                m_pos += 2;
+            }
+
+            node = parse_alternate();
+            if (at_end() || peek() != ')')
+            {
+                fail("unbalanced parenthesis");
+            }
+            ++m_pos;
+            break;
+        case '[':
+            node.bytes = parse_class();
+            break;
+        case '\\':
+            node.bytes = cased(parse_escape());
+            break;
+        case '.':
+            node.bytes = negate({});
+            break;
+        case '*':
+        case '+':
+        case '?':
+            fail("nothing to repeat");
+        case '^':
+        case '$':
+            fail("anchors are not supported");
+        default:
+            if (!parse_utf8(node))
+            {
+                node.bytes = cased(single(c));
+            }
+            break;
+    }
+
+    return node;
+}
+
+ByteSet RegexParser::parse_class()
+{
+    ByteSet bytes;
+    auto negated = !at_end() && peek() == '^';
+    if (negated)
+    {
+        ++m_pos;
+    }
+
+    // a leading "]" is a literal
+    for (auto first = true; first || at_end() || peek() != ']'; first = false)
+    {
+        if (at_end())
+        {
+            fail("unterminated bracket class");
+        }
+
+        auto c    = m_pattern[m_pos++];
+        auto item = c == '\\' ? parse_escape() : single(c);
+
+        // a "-" before the closing bracket is a literal
+        if (m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos + 1] != ']')
+        {
+            ++m_pos;
+            auto last      = m_pattern[m_pos++];
+            auto last_item = last == '\\' ? parse_escape() : single(last);
+            if (item.count() != 1 || last_item.count() != 1)
+            {
+                fail("invalid range in bracket class");
+            }
+
+            // single bytes, so find the values by scanning the sets
+            size_t low {0};
+            size_t high {0};
+            while (!item[low])
+            {
+                ++low;
+            }
+            while (!last_item[high])
+            {
+                ++high;
+            }
+
+            if (low > high)
+            {
+                fail("invalid range in bracket class");
+            }
+
+            item = range(static_cast<char>(low), static_cast<char>(high));
+        }
+
+        bytes |= item;
+    }
+    ++m_pos;
+
+    // fold before negating, so that a negated letter excludes both cases
+    bytes = cased(bytes);
+    return negated ? negate(bytes) : bytes;
+}
+
+ByteSet RegexParser::parse_escape()
+{
+    if (at_end())
+    {
+        fail("trailing backslash");
+    }
+
+    const auto digit = range('0', '9');
+    const auto word  = digit | range('a', 'z') | range('A', 'Z') | single('_');
+    const auto space = single(' ') | single('\t') | single('\n') | single('\r') | single('\f') | single('\v');
+
+    auto c = m_pattern[m_pos++];
+    switch (c)
+    {
+        case 'd':
+            return digit;
+        case 'D':
+            return negate(digit);
+        case 'w':
+            return word;
+        case 'W':
+            return negate(word);
+        case 's':
+            return space;
+        case 'S':
+            return negate(space);
+        case 't':
+            return single('\t');
+        case 'n':
+            return single('\n');
+        case 'r':
+            return single('\r');
+        case 'f':
+            return single('\f');
+        case 'v':
+            return single('\v');
+        case 'x':
+        {
+            auto hex = m_pattern.substr(m_pos, 2);
+            if (hex.size() != 2 || !std::isxdigit(static_cast<unsigned char>(hex[0])) || !std::isxdigit(static_cast<unsigned char>(hex[1])))
+            {
+                fail("invalid hex escape");
+            }
+
+            auto value = std::stoi(std::string {hex}, nullptr, 16);
+
+            m_pos += 2;
+            return single(static_cast<char>(value));
+        }
+        default:
+            // letters and digits are reserved for escapes with a meaning
+            if (std::isalnum(static_cast<unsigned char>(c)))
+            {
+                fail("unknown escape sequence");
+            }
+
+            return single(c);
+    }
+}
+
+bool RegexParser::parse_bounds(uint32_t& min, uint32_t& max)
+{
+    const auto start = m_pos;
+    if (!parse_count(min))
+    {
+        m_pos = start;
+        return false;
+    }
+
+    max = min;
+    if (!at_end() && peek() == ',')
+    {
+        ++m_pos;
+        max = UNBOUNDED_REPEAT;
+        if (!at_end() && peek() != '}' && !parse_count(max))
+        {
+            m_pos = start;
+            return false;
+        }
+    }
+
+    if (at_end() || peek() != '}')
+    {
+        m_pos = start;
+        return false;
+    }
+    ++m_pos;
+
+    if (min > max)
+    {
+        fail("invalid repetition bounds");
+    }
+
+    return true;
+}
+
+bool RegexParser::parse_count(uint32_t& count)
+{
+    const auto start = m_pos;
+    count            = 0;
+    while (!at_end() && peek() >= '0' && peek() <= '9')
+    {
+        count = count * 10 + static_cast<uint32_t>(m_pattern[m_pos++] - '0');
+        if (count > MAX_REPEAT)
+        {
+            fail("repetition count is too large");
+        }
+    }
+
+    return m_pos != start;
+}
+
+bool RegexParser::parse_utf8(RegexNode& node)
+{
+    char32_t code_point;
+    auto size = casefold::decode_utf8(m_pattern.substr(m_pos - 1), code_point);
+    if (size < 2)
+    {
+        return false;
+    }
+    m_pos += size - 1;
+
+    // each variant is a sequence of bytes
+    node = {RegexNode::Type::Alternate};
+    for (auto variant: m_fold ? casefold::variants(code_point) : std::vector<char32_t> {code_point})
+    {
+        RegexNode sequence {RegexNode::Type::Concat};
+        for (auto byte: casefold::encode_utf8(variant))
+        {
+            sequence.children.push_back({RegexNode::Type::Bytes, single(byte)});
+        }
+        node.children.push_back(std::move(sequence));
+    }
+
+    if (node.children.size() == 1)
+    {
+        auto only = std::move(node.children.front());
+        node      = std::move(only);
+    }
+
+    return true;
+}
+
+ByteSet RegexParser::cased(const ByteSet& bytes) const noexcept
+{
+    if (!m_fold)
+    {
+        return bytes;
+    }
+
+    auto folded = bytes;
+    for (char c {'a'}; c <= 'z'; ++c)
+    {
+        auto upper = static_cast<char>(c & ~0x20);
+        if (bytes[static_cast<uint8_t>(c)] || bytes[static_cast<uint8_t>(upper)])
+        {
+            folded |= single(c) | single(upper);
+        }
+    }
+
+    return folded;
+}
+
+/// Adds two lengths, saturating at UNBOUNDED.
+inline size_t add_lengths(size_t a, size_t b) noexcept
+{
+    return a == UNBOUNDED || b == UNBOUNDED ? UNBOUNDED : a + b;
+}
+
+/// Returns the length of the shortest match of a node.
+size_t min_length(const RegexNode& node) noexcept
+{
+    switch (node.type)
+    {
+        case RegexNode::Type::Bytes:
+            return 1;
+        case RegexNode::Type::Concat:
+        {
+            size_t length {0};
+            for (const auto& child: node.children)
+            {
+                length += min_length(child);
+            }
+            return length;
+        }
+        case RegexNode::Type::Alternate:
+        {
+            auto length = UNBOUNDED;
+            for (const auto& child: node.children)
+            {
+                length = std::min(length, min_length(child));
+            }
+            return length;
+        }
+        case RegexNode::Type::Repeat:
+            return node.min * min_length(node.children.front());
+    }
+
+    return 0;
+}
+
+/// Returns the length of the longest match of a node, or UNBOUNDED.
+size_t max_length(const RegexNode& node) noexcept
+{
+    switch (node.type)
+    {
+        case RegexNode::Type::Bytes:
+            return 1;
+        case RegexNode::Type::Concat:
+        {
+            size_t length {0};
+            for (const auto& child: node.children)
+            {
+                length = add_lengths(length, max_length(child));
+            }
+            return length;
+        }
+        case RegexNode::Type::Alternate:
+        {
+            size_t length {0};
+            for (const auto& child: node.children)
+            {
+                length = std::max(length, max_length(child));
+            }
+            return length;
+        }
+        case RegexNode::Type::Repeat:
+        {
+            auto child = max_length(node.children.front());
+            if (child == 0)
+            {
+                return 0;
+            }
+
+            return child == UNBOUNDED || node.max == UNBOUNDED_REPEAT ? UNBOUNDED : node.max * child;
+        }
+    }
+
+    return 0;
+}
+
+/// Literal that every match contains, between min_before and max_before bytes after the start of the match.
+struct RequiredLiteral
+{
+    std::string text;
+    size_t min_before {0};
+    size_t max_before {0};
+    bool folded {false}; //!< Letters of text also match their uppercase.
+};
+
+/// Finds the longest run of single byte nodes in a node, if it is a sequence.
+/// A node holding both cases of a letter counts as a single byte, found by a prefilter that folds case.
+/// @returns false if there is none
+bool required_literal(const RegexNode& node, RequiredLiteral& literal)
+{
+    if (node.type == RegexNode::Type::Bytes)
+    {
+        size_t byte {0};
+        while (byte < 256 && !node.bytes[byte])
+        {
+            ++byte;
+        }
+
+        // the lowest byte of a folded letter is its uppercase, and the other byte has to be its lowercase
+        auto c      = static_cast<char>(byte);
+        auto folded = node.bytes.count() == 2 && casefold::is_letter(c) && node.bytes[static_cast<uint8_t>(c ^ 0x20)];
+        if (node.bytes.count() != 1 && !folded)
+        {
+            return false;
+        }
+
+        literal = {std::string(1, folded ? casefold::to_lower(c) : c), 0, 0, folded};
+        return true;
+    }
+
+    if (node.type != RegexNode::Type::Concat)
+    {
+        return false;
+    }
+
+    RequiredLiteral run;
+    size_t min_before {0};
+    size_t max_before {0};
+    for (const auto& child: node.children)
+    {
+        RequiredLiteral byte;
+        if (required_literal(child, byte) && byte.text.size() == 1)
+        {
+            if (run.text.empty())
+            {
+                run = {"", min_before, max_before};
+            }
+            run.text += byte.text;
+            run.folded = run.folded || byte.folded;
+        }
+        else
+        {
+            run.text.clear();
+        }
+
+        if (run.text.size() > literal.text.size())
+        {
+            literal = run;
+        }
+
+        min_before += min_length(child);
+        max_before = add_lengths(max_before, max_length(child));
+    }
+
+    return !literal.text.empty();
+}
+
+/// Finds a required literal in each branch of the root.
+/// @returns an empty set if a branch has none
+std::vector<RequiredLiteral> required_literals(const RegexNode& root)
+{
+    std::vector<RequiredLiteral> literals;
+    auto branches = root.type == RegexNode::Type::Alternate ? root.children : std::vector<RegexNode> {root};
+    for (const auto& branch: branches)
+    {
+        RequiredLiteral literal;
+        if (!required_literal(branch, literal))
+        {
+            return {};
+        }
+
+        literals.push_back(std::move(literal));
+    }
+
+    return literals;
+}
+
+/// State of a Thompson NFA.
+struct NfaState
+{
+    enum class Type
+    {
+        Bytes, //!< Consumes a byte of the set and moves to out.
+        Split, //!< Moves to both out and out2 without consuming anything.
+        Match  //!< A match ends here.
+    };
+
+    Type type {Type::Match};
+    uint32_t out {0};
+    uint32_t out2 {0};
+    ByteSet bytes {};
+};
+
+/// Thompson NFA, with an anchored start and an unanchored one that can skip any number of bytes first.
+struct Nfa
+{
+    std::vector<NfaState> states {};
+    uint32_t start {0};
+    uint32_t unanchored_start {0};
+
+    explicit Nfa(const RegexNode& root);
+
+private:
+    uint32_t add(NfaState state);
+
+    /// Compiles a node so that it continues into next.
+    /// @returns the entry state of the node
+    uint32_t compile(const RegexNode& node, uint32_t next);
+};
+
+Nfa::Nfa(const RegexNode& root)
+{
+    auto match = add({NfaState::Type::Match});
+    start      = compile(root, match);
+
+    // the loop consumes any byte and comes back, so a match may start anywhere
+    unanchored_start = add({NfaState::Type::Split, 0, start});
+    auto loop        = add({NfaState::Type::Bytes, unanchored_start, 0, ByteSet {}.set()});
+    states[unanchored_start].out = loop;
+}
+
+uint32_t Nfa::add(NfaState state)
+{
+    if (states.size() >= MAX_NFA_STATES)
+    {
+        throw std::invalid_argument {"Invalid regex: the pattern is too large."};
+    }
+
+    states.push_back(state);
+    return static_cast<uint32_t>(states.size() - 1);
+}
+
+uint32_t Nfa::compile(const RegexNode& node, uint32_t next)
+{
+    switch (node.type)
+    {
+        case RegexNode::Type::Bytes:
+            return add({NfaState::Type::Bytes, next, 0, node.bytes});
+
+        case RegexNode::Type::Concat:
+            for (auto child = node.children.rbegin(); child != node.children.rend(); ++child)
+            {
+                next = compile(*child, next);
+            }
+            return next;
+
+        case RegexNode::Type::Alternate:
+        {
+            auto entry = compile(node.children.back(), next);
+            for (auto child = node.children.rbegin() + 1; child != node.children.rend(); ++child)
+            {
+                entry = add({NfaState::Type::Split, compile(*child, next), entry});
+            }
+            return entry;
+        }
+
+        case RegexNode::Type::Repeat:
+        {
+            const auto& child = node.children.front();
+            auto entry        = next;
+            if (node.max == UNBOUNDED_REPEAT)
+            {
+                // the loop state is created first, so the child can continue into it
+                entry               = add({NfaState::Type::Split, 0, next});
+                auto body           = compile(child, entry);
+                states[entry].out   = body;
+            }
+            else
+            {
+                // each optional copy either continues into the next one or skips the rest
+                for (auto i = node.min; i < node.max; ++i)
+                {
+                    entry = add({NfaState::Type::Split, compile(child, entry), next});
+                }
+            }
+
+            for (uint32_t i {0}; i < node.min; ++i)
+            {
+                entry = compile(child, entry);
+            }
+            return entry;
+        }
+    }
+
+    return next;
+}
+
+/// Lazily built DFA of one thread. States are sets of NFA states, added as the text reaches them.
+struct DfaCache
+{
+    uint64_t owner {0};                                  //!< Id of the searcher the states belong to.
+    uint64_t generation {0};                             //!< Incremented when the cache is cleared.
+    std::map<std::vector<uint32_t>, uint32_t> ids {};    //!< DFA state of each NFA state set.
+    std::vector<const std::vector<uint32_t>*> sets {};   //!< NFA state set of each DFA state; keys of ids.
+    std::vector<uint32_t> delta {};                      //!< Next state, indexed by state * class count + class.
+    std::vector<uint8_t> accepting {};                   //!< Whether a match ends in each state.
+    std::array<uint32_t, 2> starts {UNKNOWN, UNKNOWN};   //!< Unanchored and anchored start states.
+    size_t memory {0};
+};
+
+/// Searcher running a regular expression through a lazy DFA, optionally behind a literal prefilter.
+class RegexSearcher final : public Searcher
+{
+public:
+    RegexSearcher(const RegexNode& root, size_t length_limit, SearcherKind kind);
+
+    Match find(const char* first, const char* last) const noexcept override
+    {
+        return m_prefilter ? find_filtered(first, last) : find_unanchored(first, last);
+    }
+
+    std::string_view name() const noexcept override
+    {
+        return m_name;
+    }
+
+private:
+    /// Scans with the unanchored DFA, and looks for the start of a match behind each position where one ends.
+    Match find_unanchored(const char* first, const char* last) const noexcept;
+
+    /// Looks for the start of a match only around the occurrences of the required literals.
+    Match find_filtered(const char* first, const char* last) const noexcept;
+
+    /// Returns the length of the longest match starting exactly at start, or 0 if there is none.
+    size_t longest_at(DfaCache& dfa, const char* start, const char* last) const noexcept;
+
+    /// Returns the DFA of the calling thread, cleared if it was built for another searcher.
+    DfaCache& cache() const noexcept;
+
+    void reset(DfaCache& dfa) const noexcept;
+
+    /// Returns the DFA state of an NFA state set, adding it if needed.
+    uint32_t intern(DfaCache& dfa, std::vector<uint32_t> set) const noexcept;
+
+    uint32_t start_state(DfaCache& dfa, bool anchored) const noexcept;
+
+    uint32_t next_state(DfaCache& dfa, uint32_t state, char c) const noexcept
+    {
+        auto byte_class = m_classes[static_cast<uint8_t>(c)];
+        if (auto target = dfa.delta[state * m_class_count + byte_class]; target != UNKNOWN)
+        {
+            return target;
+        }
+
+        return compute_state(dfa, state, byte_class);
+    }
+
+    /// Computes a missing transition. Clears the cache first if the new state doesn't fit in it.
+    uint32_t compute_state(DfaCache& dfa, uint32_t state, uint32_t byte_class) const noexcept;
+
+    /// Adds the states reachable from the stacked ones without consuming a byte to a set, and sorts it.
+    void closure(std::vector<uint32_t>& stack, std::vector<uint32_t>& set) const noexcept;
+
+    Nfa m_nfa;
+    std::array<uint16_t, 256> m_classes {}; //!< Byte class of each byte value; bytes of a class are never told apart.
+    std::vector<uint8_t> m_representatives {};
+    uint32_t m_class_count {0};
+    size_t m_min_size;
+    size_t m_max_size;
+    std::unique_ptr<const Searcher> m_prefilter {};
+    size_t m_min_before {UNBOUNDED};
+    size_t m_max_before {0};
+    uint64_t m_id;
+    std::string m_name {"lazy-dfa"};
+};
+
+RegexSearcher::RegexSearcher(const RegexNode& root, size_t length_limit, SearcherKind kind)
+    : m_nfa {root},
+      m_min_size {min_length(root)},
+      m_max_size {std::min(length_limit, max_length(root))}
+{
+    static std::atomic_uint64_t next_id {1};
+    m_id = next_id++;
+
+    // a class starts at every byte where any of the sets changes
+    std::array<bool, 256> boundaries {};
+    boundaries[0] = true;
+    for (const auto& state: m_nfa.states)
+    {
+        for (size_t byte {1}; state.type == NfaState::Type::Bytes && byte < 256; ++byte)
+        {
+            boundaries[byte] = boundaries[byte] || state.bytes[byte] != state.bytes[byte - 1];
+        }
+    }
+
+    for (size_t byte {0}; byte < 256; ++byte)
+    {
+        if (boundaries[byte])
+        {
+            m_representatives.push_back(static_cast<uint8_t>(byte));
+        }
+        m_classes[byte] = static_cast<uint16_t>(m_representatives.size() - 1);
+    }
+    m_class_count = static_cast<uint32_t>(m_representatives.size());
+
+    // the windows behind each literal must be bounded, otherwise the unanchored scan is cheaper
+    auto literals = required_literals(root);
+    auto bounded  = !literals.empty() && std::all_of(literals.begin(), literals.end(), [](const RequiredLiteral& literal) {
+        return literal.max_before != UNBOUNDED;
+    });
+
+    if (bounded)
+    {
+        // folding a literal that has to match exactly only lets a few more candidates through
+        auto fold = std::any_of(literals.begin(), literals.end(), [](const RequiredLiteral& literal) { return literal.folded; });
+
+        std::vector<std::string> texts;
+        for (const auto& literal: literals)
+        {
+            m_min_before = std::min(m_min_before, literal.min_before);
+            m_max_before = std::max(m_max_before, literal.max_before);
+
+            auto text = fold ? casefold::to_lower(literal.text) : literal.text;
+            if (std::find(texts.begin(), texts.end(), text) == texts.end())
+            {
+                texts.push_back(std::move(text));
+            }
+        }
+
+        m_prefilter = Searcher::build(texts, kind, fold);
+        m_name += "+" + std::string {m_prefilter->name()};
+    }
+}
+
+Match RegexSearcher::find_unanchored(const char* first, const char* last) const noexcept
+{
+    auto& dfa  = cache();
+    auto state = start_state(dfa, false);
+
+    // starts are relative to first; any match ending at the first accepting position starts in the window behind it
+    std::ptrdiff_t next_start {0};
+    for (auto it = first; it != last; ++it)
+    {
+        state = next_state(dfa, state, *it);
+        if (!dfa.accepting[state])
+        {
+            continue;
+        }
+
+        auto end          = it + 1 - first;
+        auto window_begin = std::max(next_start, end - static_cast<std::ptrdiff_t>(m_max_size));
+        auto window_end   = end - static_cast<std::ptrdiff_t>(m_min_size);
+
+        // the match ending here may be longer than the limit, so the scan has to be able to go on
+        auto saved      = *dfa.sets[state];
+        auto generation = dfa.generation;
+        for (auto start = window_begin; start <= window_end; ++start)
+        {
+            if (auto length = longest_at(dfa, first + start, last))
+            {
+                return {first + start, length, 0};
+            }
+        }
+
+        next_start = std::max(next_start, window_end + 1);
+        if (dfa.generation != generation)
+        {
+            state = intern(dfa, std::move(saved));
+        }
+    }
+
+    return {last, 0, 0};
+}
+
+Match RegexSearcher::find_filtered(const char* first, const char* last) const noexcept
+{
+    auto& dfa = cache();
+    if (static_cast<size_t>(last - first) < m_min_before + m_min_size)
+    {
+        return {last, 0, 0};
+    }
+
+    // the windows only move forward, so each start is tried at most once and the first match is the leftmost
+    std::ptrdiff_t next_start {0};
+    for (auto literal = m_prefilter->find(first + m_min_before, last); literal.position != last;
+         literal = m_prefilter->find(literal.position + 1, last))
+    {
+        auto offset       = literal.position - first;
+        auto window_begin = std::max(next_start, offset - static_cast<std::ptrdiff_t>(m_max_before));
+        auto window_end   = offset - static_cast<std::ptrdiff_t>(m_min_before);
+        for (auto start = window_begin; start <= window_end; ++start)
+        {
+            if (auto length = longest_at(dfa, first + start, last))
+            {
+                return {first + start, length, 0};
+            }
+        }
+
+        next_start = std::max(next_start, window_end + 1);
+    }
+
+    return {last, 0, 0};
+}
+
+size_t RegexSearcher::longest_at(DfaCache& dfa, const char* start, const char* last) const noexcept
+{
+    auto state = start_state(dfa, true);
+    auto limit = std::min(m_max_size, static_cast<size_t>(last - start));
+
+    size_t longest {0};
+    for (size_t size {1}; size <= limit; ++size)
+    {
+        state = next_state(dfa, state, start[size - 1]);
+        if (state == DEAD)
+        {
+            break;
+        }
+
+        if (dfa.accepting[state])
+        {
+            longest = size;
+        }
+    }
+
+    return longest;
+}
+
+DfaCache& RegexSearcher::cache() const noexcept
+{
+    // the searcher is shared by the workers, so each thread builds its own DFA instead of locking one
+    thread_local DfaCache dfa;
+    if (dfa.owner != m_id)
+    {
+        dfa.owner = m_id;
+        reset(dfa);
+    }
+
+    return dfa;
+}
+
+void RegexSearcher::reset(DfaCache& dfa) const noexcept
+{
+    dfa.ids.clear();
+    dfa.sets.clear();
+    dfa.delta.clear();
+    dfa.accepting.clear();
+    dfa.starts = {UNKNOWN, UNKNOWN};
+    dfa.memory = 0;
+    ++dfa.generation;
+
+    // the empty set is the dead state
+    intern(dfa, {});
+}
+
+uint32_t RegexSearcher::intern(DfaCache& dfa, std::vector<uint32_t> set) const noexcept
+{
+    if (auto found = dfa.ids.find(set); found != dfa.ids.end())
+    {
+        return found->second;
+    }
+
+    auto id        = static_cast<uint32_t>(dfa.sets.size());
+    auto accepting = std::any_of(set.begin(), set.end(), [this](uint32_t nfa_state) {
+        return m_nfa.states[nfa_state].type == NfaState::Type::Match;
+    });
+
+    dfa.memory += (m_class_count + set.size()) * sizeof(uint32_t) + DFA_STATE_OVERHEAD;
+    auto inserted = dfa.ids.emplace(std::move(set), id).first;
+    dfa.sets.push_back(&inserted->first);
+    dfa.accepting.push_back(accepting ? 1 : 0);
+
+    // the dead state never leaves itself
+    dfa.delta.resize(dfa.delta.size() + m_class_count, id == DEAD ? DEAD : UNKNOWN);
+
+    return id;
+}
+
+uint32_t RegexSearcher::start_state(DfaCache& dfa, bool anchored) const noexcept
+{
+    auto& start = dfa.starts[anchored ? 1 : 0];
+    if (start == UNKNOWN)
+    {
+        std::vector<uint32_t> stack {anchored ? m_nfa.start : m_nfa.unanchored_start};
+        std::vector<uint32_t> set;
+        closure(stack, set);
+
+        // interning doesn't clear the cache, so the reference stays valid
+        start = intern(dfa, std::move(set));
+    }
+
+    return start;
+}
+
+uint32_t RegexSearcher::compute_state(DfaCache& dfa, uint32_t state, uint32_t byte_class) const noexcept
+{
+    auto byte = m_representatives[byte_class];
+
+    std::vector<uint32_t> stack;
+    for (auto nfa_state: *dfa.sets[state])
+    {
+        const auto& source = m_nfa.states[nfa_state];
+        if (source.type == NfaState::Type::Bytes && source.bytes[byte])
+        {
+            stack.push_back(source.out);
+        }
+    }
+
+    std::vector<uint32_t> set;
+    closure(stack, set);
+
+    // the caller only holds on to the state returned, so the cache may be cleared here
+    auto cost = (m_class_count + set.size()) * sizeof(uint32_t) + DFA_STATE_OVERHEAD;
+    if (dfa.memory + cost > DFA_CACHE_SIZE && dfa.ids.find(set) == dfa.ids.end())
+    {
+        reset(dfa);
+        return intern(dfa, std::move(set));
+    }
+
+    auto target = intern(dfa, std::move(set));
+    dfa.delta[state * m_class_count + byte_class] = target;
+
+    return target;
+}
+
+void RegexSearcher::closure(std::vector<uint32_t>& stack, std::vector<uint32_t>& set) const noexcept
+{
+    std::vector<bool> seen(m_nfa.states.size(), false);
+    while (!stack.empty())
+    {
+        auto id = stack.back();
+        stack.pop_back();
+        if (seen[id])
+        {
+            continue;
+        }
+        seen[id] = true;
+
+        const auto& state = m_nfa.states[id];
+        if (state.type == NfaState::Type::Split)
+        {
+            stack.push_back(state.out2);
+            stack.push_back(state.out);
+        }
+        else
+        {
+            set.push_back(id);
+        }
+    }
+
+    std::sort(set.begin(), set.end());
+}
+
+} // namespace impl
+
+std::unique_ptr<const Searcher> build_regex_searcher(const std::vector<std::string>& patterns, size_t max_length, SearcherKind kind,
+                                                     bool ignore_case)
+{
+    impl::RegexNode root {impl::RegexNode::Type::Alternate};
+    for (const auto& pattern: patterns)
+    {
+        auto node = impl::RegexParser {pattern, ignore_case}.parse();
+        if (impl::min_length(node) == 0)
+        {
+            throw std::invalid_argument {"Invalid regex: the pattern matches an empty string."};
+        }
+
+        root.children.push_back(std::move(node));
+    }
+
+    if (root.children.size() == 1)
+    {
+        auto only = std::move(root.children.front());
+        root      = std::move(only);
+    }
+
+    return std::make_unique<impl::RegexSearcher>(root, max_length, kind);
+}
+
+std::string escape_regex(std::string_view literal)
+{
+    std::string escaped;
+    for (auto c: literal)
+    {
+        if (std::ispunct(static_cast<unsigned char>(c)))
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+} // namespace cppgrep
@@ -0,0 +1,79 @@
+#include <algorithm>
+
+#include "result_sink.h"
+
+namespace cppgrep {
+
+void ResultSink::file_done(uint32_t, uint64_t)
+{
+}
+
+ResultQueue::ResultQueue(size_t capacity)
+    : m_capacity {std::max<size_t>(capacity, 1)}, m_ring(m_capacity)
+{
+}
+
+void ResultQueue::file_found(uint32_t id, std::string_view path)
+{
+    std::lock_guard g {m_mutex};
+    if (m_paths.size() <= id)
+    {
+        m_paths.resize(id + size_t {1});
+    }
+    m_paths[id] = path;
+}
+
+void ResultQueue::matches(const MatchRecord* records, size_t count, std::string_view, uint64_t)
+{
+    std::unique_lock lk {m_mutex};
+    while (count)
+    {
+        m_not_full.wait(lk, [this] { return m_size < m_capacity; });
+
+        // copy as many records as there is room for, which may wrap around the ring
+        auto batch = std::min(count, m_capacity - m_size);
+        for (size_t i {0}; i < batch; ++i)
+        {
+            m_ring[(m_head + m_size + i) % m_capacity] = records[i];
+        }
+
+        m_size += batch;
+        records += batch;
+        count -= batch;
+        m_not_empty.notify_one();
+    }
+}
+
+void ResultQueue::close()
+{
+    std::lock_guard g {m_mutex};
+    m_closed = true;
+    m_not_empty.notify_all();
+}
+
+bool ResultQueue::pop(std::vector<MatchRecord>& out, size_t max_count)
+{
+    std::unique_lock lk {m_mutex};
+    m_not_empty.wait(lk, [this] { return m_size || m_closed; });
+
+    out.clear();
+    auto batch = std::min(m_size, std::max<size_t>(max_count, 1));
+    for (size_t i {0}; i < batch; ++i)
+    {
+        out.push_back(m_ring[(m_head + i) % m_capacity]);
+    }
+
+    m_head = (m_head + batch) % m_capacity;
+    m_size -= batch;
+    m_not_full.notify_all();
+
+    return batch > 0;
+}
+
+std::string ResultQueue::path(uint32_t id) const
+{
+    std::lock_guard g {m_mutex};
+    return id < m_paths.size() ? m_paths[id] : std::string {};
+}
+
+} // namespace cppgrep
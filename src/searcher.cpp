@@ -0,0 +1,462 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+#include "case_fold.h"
+#include "multi_searcher.h"
+#include "searcher.h"
+#include "simd.h"
+#include "util/sys.h"
+
+namespace cppgrep {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+/// Approximate frequency rank of each byte in text, source code and logs; higher is more frequent.
+/// Bytes not listed (control characters, non-ASCII) rank lowest.
+constexpr auto BYTE_RANKS = [] {
+    constexpr std::string_view by_frequency {" etaoinsrlhdcumpfgywbv.,_-=:;()\"'/0123456789kxjqz"
+                                             "ETAOINSRLHDCUMPFGYWBVKXJQZ\n\t{}[]<>*#+&|!?@$%^~`\\\r"};
+
+    std::array<uint8_t, 256> ranks {};
+    for (size_t i {0}; i < by_frequency.size(); ++i)
+    {
+        ranks[static_cast<uint8_t>(by_frequency[i])] = static_cast<uint8_t>(255 - i);
+    }
+
+    return ranks;
+}();
+
+/// Max length of the patterns verified as two fixed width words.
+constexpr size_t MAX_WORD_PATTERN {16};
+
+/// Pattern prepared for the vector kernels: two of its rarest bytes filter the candidates, the rest are verified.
+/// When folding, the pattern is lowercase, and a filter byte that is a letter is compared after setting the case
+/// bit of the text, which only turns uppercase letters into lowercase ones when the result is a letter.
+/// A pattern of up to 16 bytes is verified as two words of the same width, which overlap for lengths between
+/// powers of two, with the case bits set the same way.
+struct Needle
+{
+    std::string pattern;              //!< The whole pattern, used to verify candidates.
+    size_t pos1 {0};                  //!< Position of the rarest byte.
+    size_t pos2 {0};                  //!< Position of the second rarest byte, preferably a different value.
+    char byte1 {0};                   //!< pattern[pos1]
+    char byte2 {0};                   //!< pattern[pos2]
+    char case1 {0};                   //!< Case bit set on the text before comparing it to byte1; 0 if not folding it.
+    char case2 {0};                   //!< Case bit set on the text before comparing it to byte2; 0 if not folding it.
+    bool fold {false};                //!< Verify candidates ignoring the case of ASCII letters.
+    size_t tail_pos {0};              //!< Position of the last word of a short pattern.
+    std::array<char, 8> head {};      //!< First word of a short pattern.
+    std::array<char, 8> tail {};      //!< Last word of a short pattern.
+    std::array<char, 8> head_case {}; //!< Case bits set on the text before comparing it to head.
+    std::array<char, 8> tail_case {}; //!< Case bits set on the text before comparing it to tail.
+
+    Needle(std::string_view text, bool ignore_case);
+};
+
+/// Signature shared by the vector kernels.
+using Kernel = const char* (*)(const char* first, const char* last, const Needle& needle) noexcept;
+
+/// Returns the width of the words that verify a pattern, in bytes: two of them cover the pattern. 0 for patterns
+/// too long, which are compared whole.
+constexpr size_t word_width(size_t length) noexcept
+{
+    return length > MAX_WORD_PATTERN ? 0 : length >= 8 ? 8 : length >= 4 ? 4 : length >= 2 ? 2 : 1;
+}
+
+/// Unsigned integer of a width, in bytes.
+template <size_t Width>
+using Word = std::conditional_t<Width == 8, uint64_t, std::conditional_t<Width == 4, uint32_t, std::conditional_t<Width == 2, uint16_t, uint8_t>>>;
+
+/// Loads an unaligned word.
+template <size_t Width>
+inline Word<Width> load(const char* data) noexcept
+{
+    Word<Width> word;
+    std::memcpy(&word, data, Width);
+    return word;
+}
+
+/// Compares a candidate to the pattern. With a known word width, the comparison is two loads and two compares
+/// the compiler keeps in registers; a single byte pattern was already compared whole by the filter.
+template <size_t Width>
+inline bool equal(const char* candidate, const Needle& needle) noexcept
+{
+    if constexpr (Width == 0)
+    {
+        return needle.fold ? casefold::equal(candidate, needle.pattern.data(), needle.pattern.size())
+                           : std::memcmp(candidate, needle.pattern.data(), needle.pattern.size()) == 0;
+    }
+    else if constexpr (Width == 1)
+    {
+        return true;
+    }
+    else
+    {
+        return (load<Width>(candidate) | load<Width>(needle.head_case.data())) == load<Width>(needle.head.data())
+               && (load<Width>(candidate + needle.tail_pos) | load<Width>(needle.tail_case.data())) == load<Width>(needle.tail.data());
+    }
+}
+
+/// Verifies the candidates of a block, where each bit in mask is a candidate start relative to block.
+/// @returns the first verified match, or nullptr
+template <size_t Width>
+inline const char* verify(const char* block, uint64_t mask, const Needle& needle) noexcept
+{
+    for (; mask; mask &= mask - 1)
+    {
+        auto candidate = block + simd::lowest_bit(mask);
+        if (equal<Width>(candidate, needle))
+        {
+            return candidate;
+        }
+    }
+
+    return nullptr;
+}
+
+/// Scalar kernel, used for the tail of a buffer that is shorter than a vector, and on CPUs without vectors.
+template <size_t Width>
+const char* find_scalar(const char* first, const char* last, const Needle& needle) noexcept
+{
+    const auto size = static_cast<std::ptrdiff_t>(needle.pattern.size());
+
+    // memchr jumps to the next occurrence of the rarest byte, unless its case is folded
+    if (!needle.case1)
+    {
+        for (auto it = first; last - it >= size; ++it)
+        {
+            auto found = static_cast<const char*>(std::memchr(it + needle.pos1, needle.byte1, static_cast<size_t>(last - it - size + 1)));
+            if (!found)
+            {
+                break;
+            }
+
+            it = found - needle.pos1;
+            if ((it[needle.pos2] | needle.case2) == needle.byte2 && equal<Width>(it, needle))
+            {
+                return it;
+            }
+        }
+
+        return last;
+    }
+
+    for (auto it = first; last - it >= size; ++it)
+    {
+        if ((it[needle.pos1] | needle.case1) == needle.byte1 && (it[needle.pos2] | needle.case2) == needle.byte2
+            && equal<Width>(it, needle))
+        {
+            return it;
+        }
+    }
+
+    return last;
+}
+
+/// Returns the instantiation of a kernel for the word width of a pattern.
+/// @param pick - returns the kernel for an std::integral_constant width
+template <typename Pick>
+Kernel for_length(size_t length, Pick&& pick) noexcept
+{
+    switch (word_width(length))
+    {
+        case 1:
+            return pick(std::integral_constant<size_t, 1> {});
+        case 2:
+            return pick(std::integral_constant<size_t, 2> {});
+        case 4:
+            return pick(std::integral_constant<size_t, 4> {});
+        case 8:
+            return pick(std::integral_constant<size_t, 8> {});
+        default:
+            return pick(std::integral_constant<size_t, 0> {});
+    }
+}
+
+#ifdef X86_BUILD
+template <size_t Width>
+CPPGREP_TARGET("sse2")
+const char* find_sse2(const char* first, const char* last, const Needle& needle) noexcept
+{
+    constexpr std::ptrdiff_t width {16};
+    const auto byte1 = _mm_set1_epi8(needle.byte1);
+    const auto byte2 = _mm_set1_epi8(needle.byte2);
+    const auto case1 = _mm_set1_epi8(needle.case1);
+    const auto case2 = _mm_set1_epi8(needle.case2);
+
+    // every candidate in the block must fit the whole pattern
+    auto it = first;
+    for (const auto span = width - 1 + static_cast<std::ptrdiff_t>(needle.pattern.size()); last - it >= span; it += width)
+    {
+        // a single byte pattern is filtered by one compare, since both filter bytes are that byte
+        auto eq = _mm_cmpeq_epi8(byte1, _mm_or_si128(case1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(it + needle.pos1))));
+        if constexpr (Width != 1)
+        {
+            eq = _mm_and_si128(eq, _mm_cmpeq_epi8(byte2, _mm_or_si128(case2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(it + needle.pos2)))));
+        }
+
+        if (auto match = verify<Width>(it, static_cast<uint32_t>(_mm_movemask_epi8(eq)), needle))
+        {
+            return match;
+        }
+    }
+
+    return find_scalar<Width>(it, last, needle);
+}
+
+template <size_t Width>
+CPPGREP_TARGET("avx2")
+const char* find_avx2(const char* first, const char* last, const Needle& needle) noexcept
+{
+    constexpr std::ptrdiff_t width {32};
+    const auto byte1 = _mm256_set1_epi8(needle.byte1);
+    const auto byte2 = _mm256_set1_epi8(needle.byte2);
+    const auto case1 = _mm256_set1_epi8(needle.case1);
+    const auto case2 = _mm256_set1_epi8(needle.case2);
+
+    auto it = first;
+    for (const auto span = width - 1 + static_cast<std::ptrdiff_t>(needle.pattern.size()); last - it >= span; it += width)
+    {
+        auto eq = _mm256_cmpeq_epi8(byte1, _mm256_or_si256(case1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it + needle.pos1))));
+        if constexpr (Width != 1)
+        {
+            eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(byte2, _mm256_or_si256(case2, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it + needle.pos2)))));
+        }
+
+        if (auto match = verify<Width>(it, static_cast<uint32_t>(_mm256_movemask_epi8(eq)), needle))
+        {
+            return match;
+        }
+    }
+
+    // finish with half width vectors before going scalar
+    return find_sse2<Width>(it, last, needle);
+}
+
+template <size_t Width>
+CPPGREP_TARGET("avx512f,avx512bw")
+const char* find_avx512(const char* first, const char* last, const Needle& needle) noexcept
+{
+    constexpr std::ptrdiff_t width {64};
+    const auto byte1 = _mm512_set1_epi8(needle.byte1);
+    const auto byte2 = _mm512_set1_epi8(needle.byte2);
+    const auto case1 = _mm512_set1_epi8(needle.case1);
+    const auto case2 = _mm512_set1_epi8(needle.case2);
+
+    auto it = first;
+    for (const auto span = width - 1 + static_cast<std::ptrdiff_t>(needle.pattern.size()); last - it >= span; it += width)
+    {
+        auto eq = _mm512_cmpeq_epi8_mask(byte1, _mm512_or_si512(case1, _mm512_loadu_si512(it + needle.pos1)));
+        if constexpr (Width != 1)
+        {
+            eq &= _mm512_cmpeq_epi8_mask(byte2, _mm512_or_si512(case2, _mm512_loadu_si512(it + needle.pos2)));
+        }
+
+        if (auto match = verify<Width>(it, eq, needle))
+        {
+            return match;
+        }
+    }
+
+    return find_avx2<Width>(it, last, needle);
+}
+#endif
+
+/// Searcher backed by one of the vector kernels.
+class VectorSearcher final : public Searcher
+{
+public:
+    VectorSearcher(std::string_view pattern, bool ignore_case, Kernel kernel, std::string_view name)
+        : m_needle {pattern, ignore_case}, m_kernel {kernel}, m_name {name}
+    {
+    }
+
+    Match find(const char* first, const char* last) const noexcept override
+    {
+        return {m_kernel(first, last, m_needle), m_needle.pattern.size(), 0};
+    }
+
+    std::string_view name() const noexcept override
+    {
+        return m_name;
+    }
+
+private:
+    Needle m_needle;
+    Kernel m_kernel;
+    std::string_view m_name;
+};
+
+/// Hashes bytes for the skip table of std::boyer_moore_searcher, optionally folding ASCII letters.
+template <bool Fold>
+struct ByteHash
+{
+    size_t operator()(char c) const noexcept
+    {
+        return static_cast<uint8_t>(Fold ? casefold::to_lower(c) : c);
+    }
+};
+
+/// Compares bytes for std::boyer_moore_searcher, optionally folding ASCII letters.
+template <bool Fold>
+struct ByteEqual
+{
+    bool operator()(char a, char b) const noexcept
+    {
+        return Fold ? casefold::to_lower(a) == casefold::to_lower(b) : a == b;
+    }
+};
+
+/// Searcher backed by std::boyer_moore_searcher, for CPUs without a vector kernel.
+/// When folding, the skip tables are built over lowercase bytes.
+template <bool Fold>
+class BoyerMooreSearcher final : public Searcher
+{
+public:
+    explicit BoyerMooreSearcher(std::string_view pattern)
+        : m_pattern {Fold ? casefold::to_lower(pattern) : std::string {pattern}}, m_searcher {m_pattern.begin(), m_pattern.end()}
+    {
+    }
+
+    Match find(const char* first, const char* last) const noexcept override
+    {
+        return {m_searcher(first, last).first, m_pattern.size(), 0};
+    }
+
+    std::string_view name() const noexcept override
+    {
+        return "boyer-moore";
+    }
+
+private:
+    std::string m_pattern;
+    std::boyer_moore_searcher<std::string::const_iterator, ByteHash<Fold>, ByteEqual<Fold>> m_searcher;
+};
+
+Needle::Needle(std::string_view text, bool ignore_case)
+    : pattern {ignore_case ? casefold::to_lower(text) : std::string {text}}, fold {ignore_case}
+{
+    auto rank = [](char c) { return BYTE_RANKS[static_cast<uint8_t>(c)]; };
+
+    for (size_t i {1}; i < pattern.size(); ++i)
+    {
+        if (rank(pattern[i]) < rank(pattern[pos1]))
+        {
+            pos1 = i;
+        }
+    }
+
+    // prefer a second byte with a different value, since a repeated one filters almost nothing extra
+    pos2 = pos1 ? 0 : pattern.size() - 1;
+    for (size_t i {0}; i < pattern.size(); ++i)
+    {
+        auto better_value = pattern[i] != pattern[pos1] && (pattern[pos2] == pattern[pos1] || rank(pattern[i]) < rank(pattern[pos2]));
+        if (i != pos1 && better_value)
+        {
+            pos2 = i;
+        }
+    }
+
+    byte1 = pattern[pos1];
+    byte2 = pattern[pos2];
+    case1 = fold && casefold::is_letter(byte1) ? 0x20 : 0;
+    case2 = fold && casefold::is_letter(byte2) ? 0x20 : 0;
+
+    if (auto width = word_width(pattern.size()))
+    {
+        tail_pos = pattern.size() - width;
+        for (size_t i {0}; i < width; ++i)
+        {
+            head[i]      = pattern[i];
+            tail[i]      = pattern[tail_pos + i];
+            head_case[i] = fold && casefold::is_letter(head[i]) ? 0x20 : 0;
+            tail_case[i] = fold && casefold::is_letter(tail[i]) ? 0x20 : 0;
+        }
+    }
+}
+
+} // namespace impl
+
+std::unique_ptr<const Searcher> Searcher::build(std::string_view pattern, SearcherKind kind, bool ignore_case)
+{
+#ifdef X86_BUILD
+    const auto& cpu = util::sys::cpu_features();
+
+    // walk down from the requested width until the CPU supports the kernel, instantiated for the pattern's length
+    switch (kind)
+    {
+        case SearcherKind::Auto:
+        case SearcherKind::Avx512:
+            if (cpu.avx512bw)
+            {
+                auto kernel = impl::for_length(pattern.size(), [](auto width) -> impl::Kernel { return impl::find_avx512<width>; });
+                return std::make_unique<impl::VectorSearcher>(pattern, ignore_case, kernel, "avx512");
+            }
+            [[fallthrough]];
+        case SearcherKind::Avx2:
+            if (cpu.avx2)
+            {
+                auto kernel = impl::for_length(pattern.size(), [](auto width) -> impl::Kernel { return impl::find_avx2<width>; });
+                return std::make_unique<impl::VectorSearcher>(pattern, ignore_case, kernel, "avx2");
+            }
+            [[fallthrough]];
+        case SearcherKind::Sse2:
+            if (cpu.sse2)
+            {
+                auto kernel = impl::for_length(pattern.size(), [](auto width) -> impl::Kernel { return impl::find_sse2<width>; });
+                return std::make_unique<impl::VectorSearcher>(pattern, ignore_case, kernel, "sse2");
+            }
+            [[fallthrough]];
+        case SearcherKind::Scalar:
+        case SearcherKind::BoyerMoore:
+            break;
+    }
+#endif
+
+    // without vectors, Boyer-Moore's skips only pay off for long patterns
+    if (kind == SearcherKind::Scalar || (kind != SearcherKind::BoyerMoore && pattern.size() <= impl::MAX_WORD_PATTERN))
+    {
+        auto kernel = impl::for_length(pattern.size(), [](auto width) -> impl::Kernel { return impl::find_scalar<width>; });
+        return std::make_unique<impl::VectorSearcher>(pattern, ignore_case, kernel, "scalar");
+    }
+
+    if (ignore_case)
+    {
+        return std::make_unique<impl::BoyerMooreSearcher<true>>(pattern);
+    }
+
+    return std::make_unique<impl::BoyerMooreSearcher<false>>(pattern);
+}
+
+std::unique_ptr<const Searcher> Searcher::build(const std::vector<std::string>& patterns, SearcherKind kind, bool ignore_case)
+{
+    return patterns.size() == 1 ? build(patterns.front(), kind, ignore_case) : build_multi_searcher(patterns, kind, ignore_case);
+}
+
+bool parse_searcher_kind(std::string_view name, SearcherKind& kind) noexcept
+{
+    constexpr std::pair<std::string_view, SearcherKind> names[] {
+        {"auto", SearcherKind::Auto},
+        {"boyer-moore", SearcherKind::BoyerMoore},
+        {"scalar", SearcherKind::Scalar},
+        {"sse2", SearcherKind::Sse2},
+        {"avx2", SearcherKind::Avx2},
+        {"avx512", SearcherKind::Avx512}};
+
+    auto found = std::find_if(std::begin(names), std::end(names), [name](const auto& entry) { return entry.first == name; });
+    if (found == std::end(names))
+    {
+        return false;
+    }
+
+    kind = found->second;
+    return true;
+}
+
+} // namespace cppgrep
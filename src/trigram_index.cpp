@@ -0,0 +1,645 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#include "case_fold.h"
+#include "trigram_index.h"
+
+#include "util/log.h"
+#include "util/sys.h"
+
+namespace fs = std::filesystem;
+using namespace util;
+
+namespace cppgrep {
+
+/// Implementation of helper functions not needed in the public interface.
+namespace impl {
+
+constexpr char INDEX_MAGIC[8] {'C', 'P', 'P', 'G', 'R', 'I', 'D', 'X'};
+constexpr uint32_t INDEX_VERSION {1};
+constexpr size_t TRIGRAM_COUNT {1U << 24};     //!< Number of distinct byte trigrams.
+constexpr uint32_t NO_FILE {UINT32_MAX};       //!< Marks a file that isn't carried over by an update.
+constexpr size_t TRIGRAM_READ_SIZE {1U << 18}; //!< Bytes read at once from a file that can't be mapped.
+
+/// Start of the index file.
+struct IndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t trigram_count;
+    uint32_t root_size;
+    uint64_t paths_size;
+    uint64_t postings_size;
+};
+
+/// A file found in the tree.
+struct TreeFile
+{
+    std::string path;
+    uint64_t size;
+    int64_t mtime;
+};
+
+/// Reads a value from a possibly unaligned position of the mapping.
+template <typename T>
+T load(const char* data) noexcept
+{
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+/// Writes the bytes of a table entry.
+template <typename T>
+void store(std::ofstream& stream, const T& value)
+{
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/// Rounds a size up to a multiple of 8, which keeps the tables aligned.
+constexpr size_t align8(size_t size) noexcept
+{
+    return (size + 7) & ~size_t {7};
+}
+
+/// Packs three bytes into a trigram.
+constexpr uint32_t pack(char a, char b, char c) noexcept
+{
+    return static_cast<uint32_t>(static_cast<unsigned char>(a)) << 16 | static_cast<uint32_t>(static_cast<unsigned char>(b)) << 8 |
+           static_cast<unsigned char>(c);
+}
+
+/// Returns the distinct case-folded trigrams of a text, in ascending order.
+std::vector<uint32_t> text_trigrams(std::string_view text);
+
+/// Returns the distinct case-folded trigrams of a file, in ascending order. A file that can't be read has none.
+std::vector<uint32_t> file_trigrams(const std::string& path);
+
+/// Lists the regular files of a tree that the filter accepts, with their size and modification time.
+/// @param skip - canonical path of a file left out, the index itself
+void list_tree(const fs::path& dir_path, const fs::path& skip, const PathFilter& filter, const PathFilter::ScopePtr& parent,
+               std::vector<TreeFile>& files);
+
+/// Writes a complete index to a temporary file, then replaces the index with it.
+void write_index(const fs::path& index_path, std::string_view root, const std::vector<TreeFile>& files,
+                 const std::vector<std::vector<uint32_t>>& trigrams);
+
+} // namespace impl
+
+TrigramIndex::TrigramIndex(util::sys::MappedFile mapping) noexcept
+    : m_mapping {std::move(mapping)}
+{
+    auto header       = impl::load<impl::IndexHeader>(m_mapping.view().data());
+    m_file_count      = header.file_count;
+    m_trigram_count   = header.trigram_count;
+    m_root_size       = header.root_size;
+    m_files_offset    = sizeof(impl::IndexHeader) + impl::align8(m_root_size);
+    m_trigrams_offset = m_files_offset + m_file_count * sizeof(FileEntry);
+    m_paths_offset    = m_trigrams_offset + m_trigram_count * sizeof(TrigramEntry);
+    m_postings_offset = m_paths_offset + impl::align8(header.paths_size);
+}
+
+std::optional<TrigramIndex> TrigramIndex::open(const fs::path& index_path)
+{
+    util::sys::MappedFile mapping {index_path.string().c_str()};
+    if (!mapping.valid() || mapping.size() < sizeof(impl::IndexHeader))
+    {
+        return std::nullopt;
+    }
+
+    auto header = impl::load<impl::IndexHeader>(mapping.view().data());
+    if (std::memcmp(header.magic, impl::INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != impl::INDEX_VERSION)
+    {
+        return std::nullopt;
+    }
+
+    // the sections must add up to the file, so that no offset points past the mapping
+    auto expected = sizeof(impl::IndexHeader) + impl::align8(header.root_size) + size_t {header.file_count} * sizeof(FileEntry) +
+                    size_t {header.trigram_count} * sizeof(TrigramEntry) + impl::align8(header.paths_size) + header.postings_size;
+    if (expected != mapping.size())
+    {
+        return std::nullopt;
+    }
+
+    return TrigramIndex {std::move(mapping)};
+}
+
+TrigramIndex TrigramIndex::update(const fs::path& index_path, const fs::path& root, const PathFilter& filter, util::misc::ThreadPool* pool)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    auto skip = fs::weakly_canonical(index_path, ec);
+
+    std::vector<impl::TreeFile> files;
+    impl::list_tree(root, skip, filter, nullptr, files);
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.path < b.path; });
+
+    auto previous = open(index_path);
+    if (previous && previous->root() != root.string())
+    {
+        previous.reset();
+    }
+
+    // unchanged files keep their trigrams; the others are read again
+    std::vector<std::vector<uint32_t>> trigrams(files.size());
+    std::vector<size_t> changed;
+    changed.reserve(files.size());
+    if (previous)
+    {
+        std::vector<uint32_t> kept(previous->file_count(), impl::NO_FILE);
+        for (size_t i {0}; i < files.size(); ++i)
+        {
+            auto id = previous->find_file(files[i].path);
+            if (auto entry = id ? previous->file(*id) : FileEntry {}; id && entry.size == files[i].size && entry.mtime == files[i].mtime)
+            {
+                kept[*id] = static_cast<uint32_t>(i);
+            }
+            else
+            {
+                changed.push_back(i);
+            }
+        }
+
+        // an unchanged tree keeps the index as it is
+        if (changed.empty() && files.size() == previous->file_count())
+        {
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            log::info("Index: all %lu files are up to date (%.3fs).", files.size(), elapsed);
+            return std::move(*previous);
+        }
+
+        previous->collect(kept, trigrams);
+        previous.reset();
+    }
+    else
+    {
+        for (size_t i {0}; i < files.size(); ++i)
+        {
+            changed.push_back(i);
+        }
+    }
+
+    if (pool)
+    {
+        // the calling thread runs reads too, rather than idling until the pool is done
+        std::atomic_size_t remaining {changed.size()};
+        for (auto i: changed)
+        {
+            pool->try_add_task([&, i] {
+                trigrams[i] = impl::file_trigrams(files[i].path);
+                --remaining;
+            });
+        }
+
+        while (remaining)
+        {
+            if (!pool->help())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+    else
+    {
+        for (auto i: changed)
+        {
+            trigrams[i] = impl::file_trigrams(files[i].path);
+        }
+    }
+
+    impl::write_index(index_path, root.string(), files, trigrams);
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    log::info("Index: read %lu of %lu files in %.3fs.", changed.size(), files.size(), elapsed);
+
+    auto index = open(index_path);
+    if (!index)
+    {
+        throw std::runtime_error {"Unable to read the index back."};
+    }
+
+    return std::move(*index);
+}
+
+size_t TrigramIndex::file_count() const noexcept
+{
+    return m_file_count;
+}
+
+std::string_view TrigramIndex::root() const noexcept
+{
+    return m_mapping.view().substr(sizeof(impl::IndexHeader), m_root_size);
+}
+
+std::vector<std::string> TrigramIndex::candidates(const std::vector<std::string>& patterns) const
+{
+    std::vector<bool> selected(m_file_count);
+    for (const auto& pattern: patterns)
+    {
+        if (pattern.size() < 3)
+        {
+            std::fill(selected.begin(), selected.end(), true);
+            break;
+        }
+
+        // a trigram no file has rules the pattern out; otherwise intersect from the shortest posting list
+        std::vector<TrigramEntry> entries;
+        auto complete = true;
+        for (auto trigram: impl::text_trigrams(pattern))
+        {
+            auto entry = find(trigram);
+            if (!entry)
+            {
+                complete = false;
+                break;
+            }
+            entries.push_back(*entry);
+        }
+
+        if (!complete)
+        {
+            continue;
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.count < b.count; });
+        auto ids = postings(entries.front());
+        for (auto entry = entries.begin() + 1; entry != entries.end() && !ids.empty(); ++entry)
+        {
+            auto other = postings(*entry);
+            ids.erase(std::set_intersection(ids.begin(), ids.end(), other.begin(), other.end(), ids.begin()), ids.end());
+        }
+
+        for (auto id: ids)
+        {
+            selected[id] = true;
+        }
+    }
+
+    std::vector<std::string> paths;
+    for (size_t id {0}; id < m_file_count; ++id)
+    {
+        if (selected[id])
+        {
+            paths.emplace_back(path(id));
+        }
+    }
+
+    return paths;
+}
+
+TrigramIndex::FileEntry TrigramIndex::file(size_t id) const noexcept
+{
+    return impl::load<FileEntry>(m_mapping.view().data() + m_files_offset + id * sizeof(FileEntry));
+}
+
+std::string_view TrigramIndex::path(size_t id) const noexcept
+{
+    auto entry = file(id);
+    return m_mapping.view().substr(m_paths_offset + entry.path_offset, entry.path_size);
+}
+
+TrigramIndex::TrigramEntry TrigramIndex::trigram(size_t index) const noexcept
+{
+    return impl::load<TrigramEntry>(m_mapping.view().data() + m_trigrams_offset + index * sizeof(TrigramEntry));
+}
+
+std::optional<TrigramIndex::TrigramEntry> TrigramIndex::find(uint32_t value) const noexcept
+{
+    size_t low {0};
+    size_t high {m_trigram_count};
+    while (low < high)
+    {
+        auto middle = low + (high - low) / 2;
+        auto entry  = trigram(middle);
+        if (entry.trigram == value)
+        {
+            return entry;
+        }
+
+        if (entry.trigram < value)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::vector<uint32_t> TrigramIndex::postings(const TrigramEntry& entry) const
+{
+    std::vector<uint32_t> ids;
+    ids.reserve(entry.count);
+
+    // each id is stored as the distance to the previous one, 7 bits per byte, lowest bits first
+    auto data = m_mapping.view().data() + m_postings_offset + entry.offset;
+    uint32_t id {0};
+    for (uint32_t i {0}; i < entry.count; ++i)
+    {
+        uint32_t delta {0};
+        for (unsigned shift {0};; shift += 7)
+        {
+            auto byte = static_cast<unsigned char>(*data++);
+            delta |= (byte & 0x7fU) << shift;
+            if (byte < 0x80)
+            {
+                break;
+            }
+        }
+
+        id += delta;
+        ids.push_back(id);
+    }
+
+    return ids;
+}
+
+std::optional<uint32_t> TrigramIndex::find_file(std::string_view file_path) const noexcept
+{
+    size_t low {0};
+    size_t high {m_file_count};
+    while (low < high)
+    {
+        auto middle = low + (high - low) / 2;
+        auto order  = path(middle).compare(file_path);
+        if (order == 0)
+        {
+            return static_cast<uint32_t>(middle);
+        }
+
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return std::nullopt;
+}
+
+void TrigramIndex::collect(const std::vector<uint32_t>& kept, std::vector<std::vector<uint32_t>>& trigrams) const
+{
+    // the table is in trigram order, so each file's trigrams come out ascending
+    for (size_t i {0}; i < m_trigram_count; ++i)
+    {
+        auto entry = trigram(i);
+        for (auto id: postings(entry))
+        {
+            if (kept[id] != impl::NO_FILE)
+            {
+                trigrams[kept[id]].push_back(entry.trigram);
+            }
+        }
+    }
+}
+
+std::vector<uint32_t> impl::text_trigrams(std::string_view text)
+{
+    std::vector<uint32_t> trigrams;
+    for (size_t i {2}; i < text.size(); ++i)
+    {
+        trigrams.push_back(pack(casefold::to_lower(text[i - 2]), casefold::to_lower(text[i - 1]), casefold::to_lower(text[i])));
+    }
+
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+    return trigrams;
+}
+
+std::vector<uint32_t> impl::file_trigrams(const std::string& path)
+{
+    // one bit per trigram marks the ones already found; only the set bits are cleared afterwards
+    thread_local std::vector<uint64_t> seen(TRIGRAM_COUNT / 64);
+    std::vector<uint32_t> trigrams;
+
+    uint32_t window {0};
+    size_t filled {0};
+    auto scan = [&](std::string_view data) {
+        for (auto c: data)
+        {
+            window = (window << 8 | static_cast<unsigned char>(casefold::to_lower(c))) & (TRIGRAM_COUNT - 1);
+            if (++filled < 3)
+            {
+                continue;
+            }
+
+            auto& word = seen[window / 64];
+            auto bit   = uint64_t {1} << (window % 64);
+            if (!(word & bit))
+            {
+                word |= bit;
+                trigrams.push_back(window);
+            }
+        }
+    };
+
+    if (util::sys::MappedFile mapping {path.c_str()}; mapping.valid())
+    {
+        mapping.advise(util::sys::MappedFile::Advice::Sequential);
+        scan(mapping.view());
+    }
+    else if (std::ifstream stream {path, std::ios::binary}; stream.good())
+    {
+        std::vector<char> buffer(TRIGRAM_READ_SIZE);
+        while (stream.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || stream.gcount() > 0)
+        {
+            scan({buffer.data(), static_cast<size_t>(stream.gcount())});
+        }
+    }
+
+    for (auto trigram: trigrams)
+    {
+        seen[trigram / 64] = 0;
+    }
+
+    std::sort(trigrams.begin(), trigrams.end());
+    return trigrams;
+}
+
+void impl::list_tree(const fs::path& dir_path, const fs::path& skip, const PathFilter& filter, const PathFilter::ScopePtr& parent,
+                     std::vector<TreeFile>& files)
+{
+    std::vector<std::pair<std::string, util::sys::EntryType>> entries;
+    auto has_gitignore {false};
+    auto has_ignore {false};
+    util::sys::list_directory(dir_path.string().c_str(), [&](std::string_view name, util::sys::EntryType type) {
+        has_gitignore |= type == util::sys::EntryType::File && name == ".gitignore";
+        has_ignore |= type == util::sys::EntryType::File && name == ".ignore";
+        entries.emplace_back(name, type);
+    });
+
+    // entries are named like the traversal names them, so that candidates are the paths a full search would print
+    auto scope = filter.enter(parent, dir_path.string(), has_gitignore, has_ignore);
+    for (const auto& [name, type]: entries)
+    {
+        auto path = dir_path / name;
+        if (type != util::sys::EntryType::Other && !filter.accept(scope, path.string(), name, type == util::sys::EntryType::Directory))
+        {
+            continue;
+        }
+
+        switch (type)
+        {
+            case util::sys::EntryType::Directory:
+                list_tree(path, skip, filter, scope, files);
+                break;
+
+            case util::sys::EntryType::File:
+            {
+                std::error_code ec;
+                if (name == skip.filename().string() && fs::weakly_canonical(path, ec) == skip)
+                {
+                    break;
+                }
+
+                auto size  = fs::file_size(path, ec);
+                auto mtime = fs::last_write_time(path, ec);
+                if (!ec)
+                {
+                    files.push_back({path.string(), size, mtime.time_since_epoch().count()});
+                }
+                break;
+            }
+
+            case util::sys::EntryType::Other:
+                break;
+        }
+    }
+}
+
+void impl::write_index(const fs::path& index_path, std::string_view root, const std::vector<TreeFile>& files,
+                       const std::vector<std::vector<uint32_t>>& trigrams)
+{
+    // count the files of each trigram, then turn the counts into the starts of the lists
+    std::vector<uint32_t> starts(TRIGRAM_COUNT);
+    for (const auto& list: trigrams)
+    {
+        for (auto trigram: list)
+        {
+            ++starts[trigram];
+        }
+    }
+
+    std::vector<uint32_t> present;
+    uint32_t total {0};
+    for (uint32_t trigram {0}; trigram < TRIGRAM_COUNT; ++trigram)
+    {
+        if (auto count = starts[trigram])
+        {
+            present.push_back(trigram);
+            starts[trigram] = total;
+            total += count;
+        }
+    }
+
+    // files are placed in id order, so each posting list is ascending
+    std::vector<uint32_t> ids(total);
+    for (uint32_t id {0}; id < trigrams.size(); ++id)
+    {
+        for (auto trigram: trigrams[id])
+        {
+            ids[starts[trigram]++] = id;
+        }
+    }
+
+    // after placing, each start is the end of its list
+    std::string postings;
+    std::vector<uint64_t> offsets;
+    offsets.reserve(present.size());
+    uint32_t begin {0};
+    for (auto trigram: present)
+    {
+        offsets.push_back(postings.size());
+
+        uint32_t previous {0};
+        for (auto i = begin; i < starts[trigram]; ++i)
+        {
+            auto delta = ids[i] - previous;
+            for (; delta >= 0x80; delta >>= 7)
+            {
+                postings += static_cast<char>((delta & 0x7fU) | 0x80U);
+            }
+            postings += static_cast<char>(delta);
+            previous = ids[i];
+        }
+        begin = starts[trigram];
+    }
+
+    std::string paths;
+    for (const auto& file: files)
+    {
+        paths += file.path;
+    }
+
+    auto temp_path = index_path;
+    temp_path += ".tmp";
+    {
+        std::ofstream stream {temp_path, std::ios::binary | std::ios::trunc};
+        const char padding[8] {};
+
+        IndexHeader header {};
+        std::memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.version       = INDEX_VERSION;
+        header.file_count    = static_cast<uint32_t>(files.size());
+        header.trigram_count = static_cast<uint32_t>(present.size());
+        header.root_size     = static_cast<uint32_t>(root.size());
+        header.paths_size    = paths.size();
+        header.postings_size = postings.size();
+        store(stream, header);
+        stream.write(root.data(), static_cast<std::streamsize>(root.size()));
+        stream.write(padding, static_cast<std::streamsize>(align8(root.size()) - root.size()));
+
+        uint64_t path_offset {0};
+        for (const auto& file: files)
+        {
+            store(stream, TrigramIndex::FileEntry {file.size, file.mtime, path_offset, file.path.size()});
+            path_offset += file.path.size();
+        }
+
+        for (size_t i {0}; i < present.size(); ++i)
+        {
+            auto end   = starts[present[i]];
+            auto count = end - (i ? starts[present[i - 1]] : 0U);
+            store(stream, TrigramIndex::TrigramEntry {present[i], count, offsets[i]});
+        }
+
+        stream.write(paths.data(), static_cast<std::streamsize>(paths.size()));
+        stream.write(padding, static_cast<std::streamsize>(align8(paths.size()) - paths.size()));
+        stream.write(postings.data(), static_cast<std::streamsize>(postings.size()));
+
+        // a partial index isn't left behind
+        if (!stream.good())
+        {
+            stream.close();
+            std::error_code ec;
+            fs::remove(temp_path, ec);
+            throw std::runtime_error {"Unable to write the index."};
+        }
+    }
+
+    // the old index stays usable until the new one is complete
+    std::error_code ec;
+    fs::rename(temp_path, index_path, ec);
+    if (ec)
+    {
+        auto message = ec.message();
+        fs::remove(temp_path, ec);
+        throw std::runtime_error {"Unable to replace the index: " + message};
+    }
+}
+
+} // namespace cppgrep
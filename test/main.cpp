@@ -0,0 +1,189 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "grep.h"
+#include "regex_searcher.h"
+#include "result_sink.h"
+
+namespace fs = std::filesystem;
+
+using namespace cppgrep;
+
+namespace {
+
+/// Fails the running test unless a condition holds.
+void check(bool condition, const std::string& message)
+{
+    if (!condition)
+    {
+        throw std::runtime_error {message};
+    }
+}
+
+/// Sink that drops the records, so that a search only counts its matches.
+class NullSink final : public ResultSink
+{
+public:
+    void file_found(uint32_t, std::string_view) override
+    {
+    }
+
+    void matches(const MatchRecord*, size_t, std::string_view, uint64_t) override
+    {
+    }
+};
+
+/// Writes a file of the test directory.
+fs::path write_file(const fs::path& dir, std::string_view name, std::string_view text)
+{
+    auto path = dir / name;
+    std::ofstream {path, std::ios::binary}.write(text.data(), static_cast<std::streamsize>(text.size()));
+    return path;
+}
+
+/// Returns random text of the given letters.
+std::string random_text(size_t size, std::string_view letters, uint32_t seed)
+{
+    std::mt19937 random {seed};
+    std::uniform_int_distribution<size_t> pick {0, letters.size() - 1};
+
+    std::string text(size, '\0');
+    for (auto& c: text)
+    {
+        c = letters[pick(random)];
+    }
+    return text;
+}
+
+/// Checks that a search finds as many matches whatever the chunk size, and however the file is read.
+void check_chunk_sizes(const fs::path& path, std::string_view pattern, const Options& options)
+{
+    NullSink sink;
+    uint64_t expected {0};
+    for (size_t chunk_size: {size_t {MIN_CHUNK_SIZE}, size_t {70001}, size_t {100000}, size_t {262144}})
+    {
+        for (auto [threads, range_read_size]: {std::pair {0U, uint64_t {0}}, std::pair {2U, uint64_t {0}}, std::pair {2U, uint64_t {1}}})
+        {
+            auto run            = options;
+            run.chunk_size      = chunk_size;
+            run.max_threads     = threads;
+            run.range_read_size = range_read_size;
+            run.sink            = &sink;
+
+            auto matches = Grep::build_grep(path.string(), std::string {pattern}, run).search();
+            if (!expected)
+            {
+                expected = matches;
+            }
+
+            check(matches && matches == expected, std::string {pattern} + " found " + std::to_string(matches) + " matches with chunks of " +
+                                                      std::to_string(chunk_size) + " bytes instead of " + std::to_string(expected) + ".");
+        }
+    }
+}
+
+/// Regex matches are skipped whole, including ones longer than the longest match, which restart the next scan.
+void test_regex_chunks(const fs::path& dir)
+{
+    Options options;
+    options.regex = true;
+
+    auto line = write_file(dir, "line.txt", std::string(300000, 'a'));
+    check_chunk_sizes(line, "a+", options);
+
+    auto text = write_file(dir, "text.txt", random_text(400000, "ababababab\n", 3));
+    check_chunk_sizes(text, "a[ab]*b", options);
+    check_chunk_sizes(text, "b(ab)+[ab\n]*a", options);
+}
+
+/// Approximate matches are skipped whole too, and end where their pattern first is within the edits allowed.
+void test_fuzzy_chunks(const fs::path& dir)
+{
+    Options options;
+    options.max_edits = 1;
+
+    auto line = write_file(dir, "line.txt", std::string(300000, 'a'));
+    check_chunk_sizes(line, "aaaa", options);
+
+    options.max_edits = 2;
+    auto random       = write_file(dir, "random.txt", random_text(400000, "ab", 5));
+    check_chunk_sizes(random, "abbaabab", options);
+
+    auto text = write_file(dir, "text.txt", random_text(400000, "ababababab\n", 3));
+    check_chunk_sizes(text, "abbaabab", options);
+}
+
+/// A bracket class of two different letters matches both of them, not only the first as if it were one letter with
+/// its case folded.
+void test_regex_classes(const fs::path&)
+{
+    auto text = random_text(1U << 20, "abcdefghijklmnopqrstuvwxyz ", 17);
+    for (const auto& [pattern, prefix, letters]: {std::tuple {"[ab]", "", "ab"}, std::tuple {"[rz]", "", "rz"}, std::tuple {"ba[rz]", "ba", "rz"}})
+    {
+        // the matches can't overlap, so they are the positions of the prefix followed by one of the letters
+        const std::string_view before {prefix};
+        uint64_t expected {0};
+        for (size_t i {0}; i + before.size() < text.size(); ++i)
+        {
+            expected += text.compare(i, before.size(), before) == 0 && std::string_view {letters}.find(text[i + before.size()]) != std::string_view::npos;
+        }
+
+        auto searcher = build_regex_searcher({pattern}, MAX_PATTERN_SIZE, SearcherKind::Auto);
+        uint64_t matches {0};
+        const auto last = text.data() + text.size();
+        for (auto match = searcher->find(text.data(), last); match.position < last; match = searcher->find(match.position + match.length, last))
+        {
+            ++matches;
+        }
+
+        check(matches == expected, std::string {pattern} + " found " + std::to_string(matches) + " matches instead of " + std::to_string(expected) + ".");
+    }
+}
+
+} // namespace
+
+int main()
+{
+    const std::vector<std::pair<std::string_view, std::function<void(const fs::path&)>>> tests {
+        {"regex_chunks", test_regex_chunks},
+        {"fuzzy_chunks", test_fuzzy_chunks},
+        {"regex_classes", test_regex_classes},
+    };
+
+    auto dir = fs::temp_directory_path() / "cppgrep_test";
+    fs::create_directories(dir);
+
+    // the searches log to std::cout
+    auto log_buffer = std::cout.rdbuf(nullptr);
+
+    int failed {0};
+    for (const auto& [name, test]: tests)
+    {
+        try
+        {
+            test(dir);
+            std::cerr << "Passed: " << name << '\n';
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Failed: " << name << ": " << e.what() << '\n';
+            ++failed;
+        }
+    }
+
+    std::cout.rdbuf(log_buffer);
+    std::cout.clear();
+
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace util::sys {
+
+/// Read-only file descriptor, closed when destroyed.
+class FileHandle
+{
+public:
+    ~FileHandle() noexcept;
+    FileHandle() noexcept = default;
+
+    /// Opens the file at the given path. Check valid() for the result.
+    explicit FileHandle(const char* path) noexcept;
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    FileHandle(FileHandle&& other) noexcept;
+    FileHandle& operator=(FileHandle&& other) noexcept;
+
+    /// Checks if the file is open.
+    bool valid() const noexcept;
+
+    /// Returns the descriptor, or -1 if the file isn't open.
+    int get() const noexcept;
+
+    /// Returns the size of a regular file, or 0 for anything else.
+    uint64_t size() const noexcept;
+
+    /// Reads a range of the file with a blocking call.
+    /// @returns the bytes read, which are fewer than requested at the end of the file or on failure
+    size_t read(char* buffer, size_t length, uint64_t offset) const noexcept;
+
+private:
+    int m_fd {-1};
+};
+
+/// Reads file ranges asynchronously, keeping up to a fixed number of reads in flight across any number of files.
+/// Uses io_uring on Linux, reading into registered buffers where the locked memory limit allows it. Where io_uring
+/// is unavailable, a pool of threads issues blocking pread calls instead.
+/// Callbacks run on an internal thread and should only hand the data over to other threads.
+class AsyncReader
+{
+public:
+    /// Read statistics, for tuning the queue depth.
+    struct Stats
+    {
+        uint64_t reads {0};      //!< Reads completed.
+        uint64_t bytes {0};      //!< Bytes read.
+        uint64_t fixed {0};      //!< Reads into registered buffers.
+        uint32_t peak {0};       //!< Most reads in flight at once.
+        uint32_t registered {0}; //!< Buffers registered with the kernel.
+    };
+
+    /// Starts a reader. Not available on platforms without pread; check valid().
+    /// @param depth - max reads in flight
+    /// @param buffer_size - size of the buffers read into; they are registered whole
+    /// @param max_buffers - max number of distinct buffers to register
+    AsyncReader(uint32_t depth, size_t buffer_size, size_t max_buffers) noexcept;
+
+    /// Waits for the reads in flight, then stops the internal threads.
+    ~AsyncReader() noexcept;
+
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+    AsyncReader(AsyncReader&&) = delete;
+    AsyncReader& operator=(AsyncReader&&) = delete;
+
+    /// Checks if the reader was started.
+    bool valid() const noexcept;
+
+    /// Returns the name of the backend: "io_uring" or "pread".
+    const char* backend() const noexcept;
+
+    /// Returns the max number of reads in flight.
+    uint32_t depth() const noexcept;
+
+    /// Returns the read statistics so far.
+    Stats stats() const noexcept;
+
+    /// Queues a read of a file range. The range is read whole unless the file ends or fails first.
+    /// @param fd - file to read; must stay open until the callback runs
+    /// @param buffer - destination; must stay valid until the callback runs
+    /// @param length - bytes to read
+    /// @param offset - file offset of the first byte
+    /// @param callback - called with the bytes read, or a negative errno value; moved, never copied
+    /// @returns false, without taking the callback, if the queue depth is reached
+    template <typename F>
+    bool try_read(int fd, char* buffer, size_t length, uint64_t offset, F&& callback) noexcept;
+
+private:
+    /// Type erased read request, owned by the reader while in flight.
+    class Request
+    {
+    public:
+        virtual ~Request() noexcept = default;
+        virtual void complete(int64_t result) noexcept = 0;
+
+        int fd {-1};
+        char* buffer {nullptr};
+        size_t length {0};
+        uint64_t offset {0};
+        size_t done {0}; //!< Bytes read so far, when a read comes back short.
+    };
+
+    template <typename F>
+    class RequestImpl final : public Request
+    {
+    public:
+        explicit RequestImpl(F&& function)
+            : m_function {std::forward<F>(function)}
+        {
+        }
+
+        void complete(int64_t result) noexcept override
+        {
+            m_function(result);
+        }
+
+    private:
+        std::decay_t<F> m_function;
+    };
+
+    struct Ring; //!< io_uring state.
+
+    /// Reserves a slot in the queue depth.
+    bool reserve() noexcept;
+
+    /// Issues the remaining part of a request.
+    void submit(Request* request) noexcept;
+
+    /// Accounts for a finished read, and issues the rest of a short one.
+    /// @returns true if the request is complete
+    bool advance(Request* request, int64_t result) noexcept;
+
+    /// Completes a request and frees its slot in the queue depth.
+    void finish(Request* request, int64_t result) noexcept;
+
+    /// io_uring completion loop.
+    void reap() noexcept;
+
+    /// pread worker loop.
+    void serve() noexcept;
+
+    const uint32_t m_depth;
+    std::unique_ptr<Ring> m_ring; //!< Null when using the pread fallback.
+    std::vector<std::thread> m_threads;
+
+    std::atomic_uint32_t m_in_flight {0};
+    std::atomic_bool m_valid {false};
+
+    // pread fallback queue
+    std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+    std::deque<Request*> m_requests {};
+    bool m_stop {false};
+
+    // statistics
+    std::atomic_uint64_t m_reads {0};
+    std::atomic_uint64_t m_bytes {0};
+    std::atomic_uint64_t m_fixed {0};
+    std::atomic_uint32_t m_peak {0};
+};
+
+template <typename F>
+bool AsyncReader::try_read(int fd, char* buffer, size_t length, uint64_t offset, F&& callback) noexcept
+{
+    if (!reserve())
+    {
+        return false;
+    }
+
+    auto request    = new RequestImpl<F>(std::forward<F>(callback));
+    request->fd     = fd;
+    request->buffer = buffer;
+    request->length = length;
+    request->offset = offset;
+    submit(request);
+
+    return true;
+}
+
+} // namespace util::sys
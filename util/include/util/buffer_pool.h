@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace util::misc {
+
+/// Fixed arena of reusable, page aligned buffers of equal size.
+/// Buffers are allocated on first use and recycled afterwards, so the memory held never exceeds the budget.
+class BufferPool
+{
+public:
+    /// Buffer checked out of a pool. Returns itself to the pool when destroyed.
+    class Buffer
+    {
+    public:
+        ~Buffer() noexcept;
+        Buffer() noexcept = default;
+
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+
+        /// Checks if the buffer was checked out successfully.
+        explicit operator bool() const noexcept;
+
+        char* data() const noexcept;
+        size_t size() const noexcept;
+
+    private:
+        friend class BufferPool;
+
+        Buffer(BufferPool* pool, char* data) noexcept;
+        void release() noexcept;
+
+        BufferPool* m_pool {nullptr};
+        char* m_data {nullptr};
+    };
+
+    /// @param buffer_size - size of each buffer, in bytes
+    /// @param max_memory - budget for all buffers, in bytes; at least one buffer is always available
+    BufferPool(size_t buffer_size, uint64_t max_memory) noexcept;
+
+    ~BufferPool() noexcept;
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    BufferPool(BufferPool&&) = delete;
+    BufferPool& operator=(BufferPool&&) = delete;
+
+    /// Checks out a buffer, blocking until one is returned if the budget or the memory is used up.
+    Buffer acquire() noexcept;
+
+    /// Checks out a buffer, waiting at most the given time if the budget or the memory is used up.
+    /// @returns an empty buffer on timeout
+    Buffer try_acquire(std::chrono::milliseconds timeout = std::chrono::milliseconds {0}) noexcept;
+
+    /// Returns the size of each buffer, in bytes.
+    size_t buffer_size() const noexcept;
+
+    /// Returns the max number of buffers.
+    size_t max_buffers() const noexcept;
+
+private:
+    /// Takes a free buffer, or allocates one if the budget allows it. Requires m_mutex.
+    /// @returns nullptr if the budget is used up or the allocation fails
+    char* take() noexcept;
+
+    void give_back(char* data) noexcept;
+
+    const size_t m_buffer_size;
+    const size_t m_max_buffers;
+
+    std::vector<char*> m_allocated {}; //!< Every buffer allocated so far, owned by the pool.
+    std::vector<char*> m_free {};      //!< Buffers available for checkout.
+    std::mutex m_mutex {};
+    std::condition_variable m_condition {};
+};
+
+} // namespace util::misc
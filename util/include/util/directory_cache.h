@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "util/sys.h"
+
+namespace util::sys {
+
+/// Directory listings kept across searches by a long-running process. A listing is reused while the modification
+/// time of its directory doesn't change, which happens whenever an entry is added, removed or renamed; a directory
+/// changed too recently for its time to tell is listed again. The listings are held up to a memory budget, and the
+/// cache starts over when a new one doesn't fit. Thread safe.
+class DirectoryCache
+{
+public:
+    static constexpr size_t DEFAULT_SIZE {67108864}; //!< Default budget of the listings, in bytes.
+
+    /// @param max_bytes - budget of the listings, roughly counted
+    explicit DirectoryCache(size_t max_bytes = DEFAULT_SIZE) noexcept;
+
+    /// Lists the entries of a directory like list_directory(), from the cache if the directory didn't change.
+    /// @param path - directory to list
+    /// @param callback - called with the name and type of each entry
+    /// @returns false if the directory can't be opened
+    bool list(const char* path, const std::function<void(std::string_view name, EntryType type)>& callback);
+
+private:
+    struct Listing
+    {
+        int64_t mtime; //!< Modification time of the directory when it was listed.
+        size_t bytes;  //!< Memory held by the listing and its path.
+        std::vector<std::pair<std::string, EntryType>> entries;
+    };
+
+    const size_t m_max_bytes;
+    size_t m_bytes {0}; //!< Memory held by the listings cached.
+    std::shared_mutex m_mutex {};
+    std::unordered_map<std::string, std::shared_ptr<const Listing>> m_listings {};
+};
+
+} // namespace util::sys
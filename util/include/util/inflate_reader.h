@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+namespace util::io {
+
+/// Reads the decompressed bytes of a gzip or zlib file, inflating its deflate stream as the bytes are read.
+/// Only the last 32K of output is kept, as the window back-references point into, so memory doesn't grow with the file.
+/// Concatenated gzip members are read as one stream. Checksums aren't verified; the gzip size field is.
+class InflateReader
+{
+public:
+    /// Opens a file and reads its header. Check valid() for the result.
+    explicit InflateReader(const char* path);
+
+    /// Checks if the file starts with a gzip or zlib header using deflate.
+    bool valid() const noexcept;
+
+    /// Checks if the compressed data was corrupt or truncated; the bytes read before the error stay valid.
+    bool failed() const noexcept;
+
+    /// Decompresses up to size bytes.
+    /// @param data - receives the bytes
+    /// @param size - bytes wanted
+    /// @returns the bytes decompressed; less than size only at the end of the stream, or on an error
+    size_t read(char* data, size_t size);
+
+    /// Returns the compressed bytes read from the file so far.
+    uint64_t compressed_bytes() const noexcept;
+
+private:
+    /// Canonical Huffman code, decoded through a lookup table for short codes.
+    struct Huffman
+    {
+        static constexpr unsigned FAST_BITS {10};
+
+        std::array<uint16_t, 1U << FAST_BITS> fast; //!< (symbol << 4) | length, indexed by the next bits; 0 for longer codes.
+        std::array<uint16_t, 16> counts;            //!< Number of codes of each length.
+        std::array<uint16_t, 288> symbols;          //!< Symbols ordered by code.
+
+        /// Builds the code from the length of each symbol's code.
+        /// @returns false if the lengths are over-subscribed
+        bool build(const uint8_t* lengths, size_t count) noexcept;
+    };
+
+    enum class State
+    {
+        BlockHeader, //!< Before a deflate block.
+        Stored,      //!< Inside an uncompressed block.
+        Huffman,     //!< Inside a compressed block.
+        Trailer,     //!< After the last block of a member.
+        End,         //!< Nothing left to read.
+        Failed       //!< The data is corrupt.
+    };
+
+    enum class Format
+    {
+        Gzip,
+        Zlib
+    };
+
+    /// Returns the fixed codes of the deflate format: literals and lengths, then distances.
+    static const std::array<Huffman, 2>& fixed_codes() noexcept;
+
+    /// Reads the header of a gzip member, up to its first block.
+    bool read_header();
+
+    /// Reads the header of a block, and the codes of a compressed block.
+    bool read_block_header();
+
+    /// Reads the codes of a block compressed with dynamic codes.
+    bool read_dynamic_codes();
+
+    /// Reads the trailer of a member, then checks for another member.
+    bool read_trailer();
+
+    /// Decodes a symbol with a code.
+    /// @returns the symbol, or -1 for an invalid code
+    int decode(const Huffman& code) noexcept;
+
+    /// Copies the pending back-reference into the output, as far as it fits.
+    void copy_match(char*& out, char* out_end) noexcept;
+
+    // bit reader, refilled from the file
+    /// Tops the bit buffer up to at least 57 bits, with zero bits past the end of the file.
+    void refill();
+
+    /// Consumes bits, the first one lowest; at most 16.
+    uint32_t bits(unsigned count);
+
+    /// Drops the bits up to the next byte boundary.
+    void align() noexcept;
+
+    /// Checks if bits past the end of the file were consumed.
+    bool overrun() const noexcept;
+
+    std::ifstream m_stream;
+    std::vector<char> m_input;
+    size_t m_input_pos {0};
+    size_t m_input_end {0};
+    uint64_t m_compressed {0};
+    uint64_t m_bits {0};    //!< Bits not consumed yet, the next one lowest.
+    unsigned m_count {0};   //!< Bits held by m_bits.
+    unsigned m_padding {0}; //!< Zero bits at the top of m_bits, appended past the end of the file.
+
+    bool m_valid {false};
+    Format m_format {Format::Gzip};
+    State m_state {State::Failed};
+    bool m_last_block {false};
+    uint32_t m_stored_left {0};
+    Huffman m_literals {};  //!< Dynamic codes of the current block.
+    Huffman m_distances {};
+    const Huffman* m_literal_code {nullptr};
+    const Huffman* m_distance_code {nullptr};
+
+    // output window
+    std::vector<char> m_window;
+    uint64_t m_produced {0};       //!< Bytes decompressed since the start of the member.
+    uint32_t m_match_length {0};   //!< Bytes of the pending back-reference not copied yet.
+    uint32_t m_match_distance {0}; //!< Distance of the pending back-reference.
+};
+
+} // namespace util::io
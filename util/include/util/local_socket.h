@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace util::sys {
+
+/// Connected local (Unix domain) socket. Closes itself when destroyed.
+/// Only implemented on Unix; elsewhere a socket is never valid.
+class LocalSocket
+{
+public:
+    ~LocalSocket() noexcept;
+    LocalSocket() noexcept = default;
+
+    /// Connects to a socket listening at a path. Check valid() for the result.
+    static LocalSocket connect(const char* path) noexcept;
+
+    LocalSocket(const LocalSocket&) = delete;
+    LocalSocket& operator=(const LocalSocket&) = delete;
+
+    LocalSocket(LocalSocket&& other) noexcept;
+    LocalSocket& operator=(LocalSocket&& other) noexcept;
+
+    /// Checks if the socket is connected.
+    bool valid() const noexcept;
+
+    /// Returns the descriptor, or -1 if the socket isn't connected.
+    int get() const noexcept;
+
+    /// Sends all the bytes, retrying on partial writes and interrupts.
+    /// @returns false if the peer went away
+    bool send(std::string_view data) const noexcept;
+
+    /// Receives the bytes available, up to a size, waiting for at least one.
+    /// @returns the bytes received; 0 once the peer closed the connection, on an error, or when the receive timeout
+    /// passed first
+    size_t receive(char* data, size_t size) const noexcept;
+
+    /// Bounds the wait of each receive.
+    /// @returns false if the timeout can't be set
+    bool set_receive_timeout(std::chrono::milliseconds timeout) const noexcept;
+
+private:
+    friend class LocalListener;
+
+    explicit LocalSocket(int fd) noexcept;
+
+    int m_fd {-1};
+};
+
+/// Local (Unix domain) socket listening at a path, which is removed when the listener is destroyed.
+/// A socket file left behind by a process that went away is replaced, while one that still accepts connections
+/// is left alone. Writing to a client that went away fails instead of raising SIGPIPE, for the whole process.
+class LocalListener
+{
+public:
+    /// Starts listening. Check valid() for the result.
+    explicit LocalListener(const char* path) noexcept;
+
+    ~LocalListener() noexcept;
+
+    LocalListener(const LocalListener&) = delete;
+    LocalListener& operator=(const LocalListener&) = delete;
+    LocalListener(LocalListener&&) = delete;
+    LocalListener& operator=(LocalListener&&) = delete;
+
+    /// Checks if the socket is listening.
+    bool valid() const noexcept;
+
+    /// Waits for the next client.
+    /// @returns the connection to the client; invalid on an error
+    LocalSocket accept() const noexcept;
+
+private:
+    std::string m_path;
+    int m_fd {-1};
+};
+
+} // namespace util::sys
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace util::sys {
+
+/// Read-only memory mapping of a whole file.
+/// Empty, special or otherwise unmappable files leave the object invalid, so that callers can fall back to buffered reads.
+class MappedFile
+{
+public:
+    /// Access pattern hints forwarded to the operating system.
+    enum class Advice
+    {
+        Sequential, //!< Pages are read in ascending order; read ahead aggressively and drop them early.
+        WillNeed    //!< Pages will be read soon; start faulting them in.
+    };
+
+    ~MappedFile() noexcept;
+    MappedFile() noexcept = default;
+
+    /// Maps the file at the given path. Check valid() for the result.
+    explicit MappedFile(const char* path) noexcept;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    /// Checks if the file is mapped.
+    bool valid() const noexcept;
+
+    /// Returns a view over the whole mapping.
+    std::string_view view() const noexcept;
+
+    /// Returns the mapped size, in bytes.
+    size_t size() const noexcept;
+
+    /// Hints the operating system about how a range of the mapping will be accessed.
+    /// @param advice - expected access pattern
+    /// @param offset - start of the range; rounded down to a page boundary
+    /// @param length - length of the range; 0 means until the end of the mapping
+    void advise(Advice advice, size_t offset = 0, size_t length = 0) const noexcept;
+
+private:
+    void unmap() noexcept;
+
+    const char* m_data {nullptr};
+    size_t m_size {0};
+};
+
+} // namespace util::sys
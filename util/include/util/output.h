@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace util::io {
+
+/// Append-only text buffer. Formats in place, so it doesn't allocate once its capacity is reached.
+class OutputBuffer
+{
+public:
+    explicit OutputBuffer(size_t capacity = 0);
+
+    OutputBuffer& append(std::string_view text);
+    OutputBuffer& append(char c);
+
+    /// Appends an unsigned number in decimal.
+    OutputBuffer& append_number(uint64_t number);
+
+    /// Appends text with tabs and line breaks replaced by their escape sequences.
+    OutputBuffer& append_escaped(std::string_view text);
+
+    std::string_view view() const noexcept;
+    size_t size() const noexcept;
+    bool empty() const noexcept;
+    void clear() noexcept;
+
+    /// Moves the content out, leaving the buffer empty.
+    std::string release() noexcept;
+
+private:
+    std::string m_data;
+};
+
+/// Buffered writer of records to a file descriptor.
+/// Each thread appends to its own slot, which is written with a single write call once it fills up,
+/// so threads only contend when flushing. Records are never split between writes.
+/// A writer may hold the output to write a long run of records through: the text of the other writers is kept back
+/// until it releases the output.
+class Output
+{
+public:
+    /// @param fd - file descriptor to write to
+    /// @param slots - number of threads that write concurrently, each using its own slot index
+    Output(int fd, size_t slots);
+
+    ~Output() noexcept;
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+    Output(Output&&) = delete;
+    Output& operator=(Output&&) = delete;
+
+    /// Returns the buffer of a slot, for formatting records in place. Call commit() after each record.
+    OutputBuffer& slot(size_t index) noexcept;
+
+    /// Writes the slot out if it is over the flush threshold.
+    void commit(size_t index) noexcept;
+
+    /// Writes out all slots, and the text kept back for a writer holding the output. Must not run concurrently with
+    /// writers.
+    void flush() noexcept;
+
+    /// Holds the output for a writer, unless another one holds it.
+    /// @param writer - identifies the writer
+    /// @returns true if the writer holds the output
+    bool hold(const void* writer) noexcept;
+
+    /// Writes text of the writer holding the output.
+    void write_held(const void* writer, std::string_view text) noexcept;
+
+    /// Releases the output held by a writer, and writes the text kept back meanwhile.
+    void release(const void* writer) noexcept;
+
+    /// Returns the number of bytes written so far.
+    uint64_t bytes_written() const noexcept;
+
+private:
+    /// Writes the text under the write lock, or keeps it back if another writer holds the output.
+    void write(std::string_view text, const void* writer = nullptr) noexcept;
+
+    /// Writes the text. Requires m_write_mutex.
+    void write_locked(std::string_view text) noexcept;
+
+    struct alignas(64) Slot
+    {
+        OutputBuffer buffer;
+    };
+
+    int m_fd;
+    std::vector<Slot> m_slots;
+    std::mutex m_write_mutex {};
+    uint64_t m_bytes_written {0};
+    const void* m_holder {nullptr}; //!< Writer holding the output, if any.
+    std::string m_held {};          //!< Text of the other writers, kept back while the output is held.
+};
+
+/// Reassembles a group of records (eg. the results of one file) produced out of order, in numbered parts.
+/// Parts are joined in index order, and the group is never interleaved with other output: a small group is committed
+/// to an output slot in one piece once all parts are in, while a group whose text outgrows a slot holds the output
+/// and writes its parts through as they come in turn. Only parts that arrive ahead of their turn are held apart, and
+/// producers bound them by waiting for room() before making a part further ahead.
+class OrderedGroup
+{
+public:
+    static constexpr uint64_t MAX_AHEAD {1024}; //!< Max distance of a part ahead of the next one in turn.
+
+    explicit OrderedGroup(Output& output) noexcept;
+
+    /// Releases the output if the group still holds it.
+    ~OrderedGroup() noexcept;
+
+    OrderedGroup(const OrderedGroup&) = delete;
+    OrderedGroup& operator=(const OrderedGroup&) = delete;
+    OrderedGroup(OrderedGroup&&) = delete;
+    OrderedGroup& operator=(OrderedGroup&&) = delete;
+
+    /// Checks if part number index is within MAX_AHEAD parts of the next one in turn, so that at most MAX_AHEAD parts
+    /// are ever held apart.
+    bool room(uint64_t index) noexcept;
+
+    /// Adds part number index; every index below the part count must be added once, even if empty.
+    /// @param slot - output slot of the calling thread
+    void add(uint64_t index, std::string_view text, size_t slot);
+
+    /// Sets the number of parts, once known.
+    /// @param slot - output slot of the calling thread
+    void close(uint64_t parts, size_t slot);
+
+private:
+    /// Writes the text in turn through the output while the group holds it, or commits the group if all parts are in.
+    /// Requires m_mutex.
+    void write_in_turn(size_t slot);
+
+    Output& m_output;
+    std::mutex m_mutex {};
+    uint64_t m_next {0};
+    uint64_t m_parts {UINT64_MAX};
+    std::map<uint64_t, std::string> m_pending {};
+    std::string m_text {};  //!< Text of the parts in turn, not written yet.
+    bool m_holding {false}; //!< The group holds the output.
+};
+
+} // namespace util::io
@@ -6,11 +6,48 @@
 #    define WIN32_BUILD
 #endif
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#    define X86_BUILD
+#endif
+
+#include <functional>
+#include <string_view>
+
 namespace util::sys {
 
+/// Type of a directory entry, as far as the traversal is concerned.
+enum class EntryType
+{
+    File,      //!< Regular file, or symlink to one.
+    Directory, //!< Directory; symlinks to directories are reported as Other to avoid cycles.
+    Other
+};
+
+/// Instruction set extensions used by the vectorized kernels.
+struct CpuFeatures
+{
+    bool sse2 {false};
+    bool ssse3 {false};
+    bool avx2 {false};
+    bool avx512bw {false};
+};
+
 /// Retrieves the operating system's pagesize value.
 unsigned long pagesize() noexcept;
 
+/// Detects the CPU features on first use. Takes OS support for the wider registers into account.
+const CpuFeatures& cpu_features() noexcept;
+
+/// Lists the entries of a single directory, skipping "." and "..".
+/// Uses the entry type reported by readdir where available; only symlinks and entries of unknown type are stat'ed.
+/// @param path - directory to list
+/// @param callback - called with the name and type of each entry
+/// @returns false if the directory can't be opened
+bool list_directory(const char* path, const std::function<void(std::string_view name, EntryType type)>& callback) noexcept;
+
+/// Switches the standard input to binary mode, so line endings aren't translated; only needed on Windows.
+void binary_stdin() noexcept;
+
 #ifdef WIN32_BUILD
 /// Provides a reliable read-right check on Windows.
 bool win32_can_read(const char* path) noexcept;
@@ -2,25 +2,38 @@
 
 #include <atomic>
 #include <condition_variable>
-#include <functional>
+#include <cstdint>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace util::misc {
 
-/// Manages a given number of threads and runs a task queue.
-/// Simpler version of my std::future based implementation: https://github.com/andrmr/cpp_thread_pool
+/// Manages a given number of threads that run tasks from per-worker work-stealing deques.
+/// Tasks queued from outside the pool go through a bounded injection queue; tasks queued by a worker
+/// go to its own deque, where idle workers can steal them from.
 class ThreadPool
 {
 public:
-    using Ptr  = std::shared_ptr<ThreadPool>; //!< Alias for passing around ThreadPool pointers.
-    using Task = std::function<void()>;       //!< Type of object queued and processed by the pool.
+    using Ptr = std::shared_ptr<ThreadPool>; //!< Alias for passing around ThreadPool pointers.
 
-    /// Constructs a thread pool, with hardware_concurrency() as default number of threads.
+    /// Scheduling statistics, telling queue contention from starved workers.
+    struct Stats
+    {
+        uint64_t tasks {0};      //!< Tasks run by the workers.
+        uint64_t stolen {0};     //!< Tasks taken from another worker's deque.
+        uint64_t inlined {0};    //!< Tasks run by the worker that queued them, because its deque was full.
+        uint64_t blocked_ns {0}; //!< Time spent by threads outside the pool waiting for room in the injection queue.
+        uint64_t idle_ns {0};    //!< Time spent by the workers looking for work, spinning or parked.
+    };
+
+    /// Constructs a thread pool and starts its threads, with hardware_concurrency() as default number of threads.
+    /// @param max_tasks - max number of tasks queued from outside the pool
     /// @param max_threads - max number of threads
-    /// @param max_tasks - max number of queued tasks
     explicit ThreadPool(uint64_t max_tasks, uint32_t max_threads = std::thread::hardware_concurrency()) noexcept;
 
     ~ThreadPool() noexcept;
@@ -32,46 +45,163 @@ public:
     ThreadPool(ThreadPool&&) = delete;
     ThreadPool* operator=(ThreadPool&&) = delete;
 
-    /// Queues a task if the queue is not full. Otherwise, blocks until the queue has available slots.
-    /// @param task - object to be queued and processed
-    void try_add_task(Task task) noexcept;
+    /// Queues a task; tasks are moved, never copied, and never dropped.
+    /// From outside the pool, blocks until the queue has available slots.
+    /// From a worker, runs the task inline if the worker's deque is full, so that workers never wait on each other.
+    /// Runs the task inline too if there is no memory left to queue it.
+    /// @param task - callable object to be queued and processed
+    template <typename F>
+    void try_add_task(F&& task) noexcept;
+
+    /// Returns the index of the calling thread in its pool, or -1 if it isn't a pool thread.
+    static int current_worker() noexcept;
+
+    /// Runs one queued task on the calling thread, if there is any.
+    /// Lets a thread that waits on resources held by queued tasks make progress instead of blocking.
+    /// @returns false if no task was found
+    bool help() noexcept;
 
-    /// Stops the thread pool.
+    /// Counts work done outside the pool, like a read in flight, as a pending task until released.
+    /// stop() waits for it, so the work can still queue tasks when it completes.
+    void hold() noexcept;
+
+    /// Releases work counted by hold().
+    void release() noexcept;
+
+    /// Blocks until all the queued tasks, including the ones they queue, are processed. The threads keep running,
+    /// so a pool kept across searches only waits for each one.
+    void wait() noexcept;
+
+    /// Blocks until all the queued tasks, including the ones they queue, are processed. Then stops the threads.
     void stop() noexcept;
 
+    /// Returns the statistics so far; they are complete once stop() returns.
+    Stats stats() const noexcept;
+
 private:
-    class Queue
+    /// Type erased task, owned by whichever queue holds it.
+    class Task
     {
-        std::queue<Task> m_tasks {};
-        mutable std::mutex m_mutex {};
-        std::mutex m_condition_mutex {};
-        std::condition_variable m_condition {};
-        std::atomic_bool m_continue {true};
-        uint64_t m_max_tasks {0};
+    public:
+        virtual ~Task() noexcept = default;
+        virtual void run() noexcept = 0;
+    };
+
+    template <typename F>
+    class TaskImpl final : public Task
+    {
+    public:
+        explicit TaskImpl(F&& function)
+            : m_function {std::forward<F>(function)}
+        {
+        }
+
+        void run() noexcept override
+        {
+            m_function();
+        }
+
+    private:
+        std::decay_t<F> m_function;
+    };
+
+    /// Fixed capacity Chase-Lev deque. The owner pushes and pops at the bottom, thieves steal from the top.
+    class Deque
+    {
+        std::unique_ptr<std::atomic<Task*>[]> m_slots;
+        int64_t m_mask {0};
+        alignas(64) std::atomic<int64_t> m_top {0};
+        alignas(64) std::atomic<int64_t> m_bottom {0};
 
     public:
-        ~Queue() noexcept;
+        explicit Deque(size_t capacity) noexcept;
 
-        Queue(uint64_t max_tasks) noexcept;
+        bool push(Task* task) noexcept;
+        Task* pop() noexcept;
+        Task* steal() noexcept;
+        bool empty() const noexcept;
+    };
 
-        Queue(const Queue&) = delete;
-        Queue& operator=(const Queue&) = delete;
+    /// Bounded multi-producer multi-consumer ring, used for tasks queued from outside the pool.
+    class Queue
+    {
+        struct Cell
+        {
+            std::atomic<size_t> sequence {0};
+            Task* task {nullptr};
+        };
 
-        // TODO: implement move
-        Queue(Queue&&) = delete;
-        Queue& operator=(Queue&&) = delete;
+        std::unique_ptr<Cell[]> m_cells;
+        size_t m_mask {0};
+        alignas(64) std::atomic<size_t> m_enqueue_pos {0};
+        alignas(64) std::atomic<size_t> m_dequeue_pos {0};
 
+    public:
+        explicit Queue(size_t capacity) noexcept;
 
-        void enqueue(Task task) noexcept;
+        bool push(Task* task) noexcept;
+        Task* pop() noexcept;
         bool empty() const noexcept;
-        bool full() const noexcept;
-        void stop() noexcept;
-        void run() noexcept;
     };
 
+    /// Statistics of a worker, on their own cache line. Only the worker writes them, so they aren't locked.
+    struct alignas(64) WorkerStats
+    {
+        std::atomic_uint64_t tasks {0};
+        std::atomic_uint64_t stolen {0};
+        std::atomic_uint64_t inlined {0};
+        std::atomic_uint64_t idle_ns {0};
+    };
+
+    /// Queues a type erased task, taking ownership of it.
+    void submit(Task* task) noexcept;
+
+    /// Finds a task: own deque first, then the injection queue, then the other workers' deques.
+    Task* find_task(size_t worker, uint64_t& seed) noexcept;
+
+    /// Checks, without taking anything, if there is work or the pool is stopping.
+    bool has_work() const noexcept;
+
+    /// Wakes one parked worker, if any.
+    void wake_one() noexcept;
+
+    /// Runs a task and accounts for its completion.
+    void execute(Task* task) noexcept;
+
+    /// Worker thread loop.
+    void run(size_t worker) noexcept;
+
     Queue m_queue;
+    std::vector<std::unique_ptr<Deque>> m_deques;
+    std::vector<WorkerStats> m_worker_stats;
+    std::atomic_uint64_t m_blocked_ns {0};
     std::vector<std::thread> m_threads;
-    uint32_t m_max_threads {0};
+
+    alignas(64) std::atomic_int64_t m_pending {0}; //!< Tasks queued or running.
+    std::atomic_bool m_continue {true};
+
+    std::mutex m_park_mutex {};
+    std::condition_variable m_park_condition {};
+    std::atomic_uint32_t m_parked {0};
+
+    std::mutex m_space_mutex {};
+    std::condition_variable m_space_condition {};
+    std::atomic_uint32_t m_waiting_for_space {0};
+
+    std::mutex m_idle_mutex {};
+    std::condition_variable m_idle_condition {};
 };
 
+template <typename F>
+void ThreadPool::try_add_task(F&& task) noexcept
+{
+    if (auto queued = new (std::nothrow) TaskImpl<F>(std::forward<F>(task)))
+    {
+        submit(queued);
+        return;
+    }
+
+    task();
+}
+
 } // namespace util::misc
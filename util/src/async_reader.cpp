@@ -0,0 +1,523 @@
+#include "util/async_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <unordered_map>
+
+#include "util/sys.h"
+
+#ifdef UNIX_BUILD
+#    include <fcntl.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#if defined __linux__ && __has_include(<linux/io_uring.h>)
+#    define IO_URING_BUILD
+#    include <linux/io_uring.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <sys/uio.h>
+#endif
+
+namespace util::sys {
+
+namespace {
+
+constexpr uint32_t MAX_PREAD_THREADS {32}; //!< Threads of the pread fallback; more don't add bandwidth.
+
+} // namespace
+
+FileHandle::~FileHandle() noexcept
+{
+#ifdef UNIX_BUILD
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+#endif
+}
+
+FileHandle::FileHandle(const char* path) noexcept
+{
+#ifdef UNIX_BUILD
+    m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+#else
+    (void)path;
+#endif
+}
+
+FileHandle::FileHandle(FileHandle&& other) noexcept
+    : m_fd {std::exchange(other.m_fd, -1)}
+{
+}
+
+FileHandle& FileHandle::operator=(FileHandle&& other) noexcept
+{
+    if (this != &other)
+    {
+        FileHandle old {std::move(*this)};
+        m_fd = std::exchange(other.m_fd, -1);
+    }
+
+    return *this;
+}
+
+bool FileHandle::valid() const noexcept
+{
+    return m_fd >= 0;
+}
+
+int FileHandle::get() const noexcept
+{
+    return m_fd;
+}
+
+uint64_t FileHandle::size() const noexcept
+{
+#ifdef UNIX_BUILD
+    struct stat info {};
+    if (m_fd >= 0 && ::fstat(m_fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        return static_cast<uint64_t>(info.st_size);
+    }
+#endif
+
+    return 0;
+}
+
+size_t FileHandle::read(char* buffer, size_t length, uint64_t offset) const noexcept
+{
+    size_t done {0};
+#ifdef UNIX_BUILD
+    while (m_fd >= 0 && done < length)
+    {
+        auto result = ::pread(m_fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (result <= 0)
+        {
+            break;
+        }
+
+        done += static_cast<size_t>(result);
+    }
+#else
+    (void)buffer;
+    (void)offset;
+    (void)length;
+#endif
+
+    return done;
+}
+
+#ifdef IO_URING_BUILD
+
+/// Submission and completion rings shared with the kernel, driven through raw system calls.
+struct AsyncReader::Ring
+{
+    int fd {-1};
+    void* sq_ring {MAP_FAILED};
+    size_t sq_ring_size {0};
+    void* cq_ring {MAP_FAILED};
+    size_t cq_ring_size {0};
+    io_uring_sqe* sqes {nullptr};
+    size_t sqes_size {0};
+
+    unsigned* sq_tail {nullptr};
+    unsigned* sq_array {nullptr};
+    unsigned sq_mask {0};
+    unsigned* cq_head {nullptr};
+    unsigned* cq_tail {nullptr};
+    unsigned cq_mask {0};
+    io_uring_cqe* cqes {nullptr};
+
+    std::mutex mutex {}; //!< Serializes submissions and buffer registration.
+
+    // registered buffers, filled in sparsely as buffers show up
+    size_t buffer_size {0};
+    size_t max_buffers {0};
+    bool registration {false}; //!< Cleared once the kernel refuses to register more buffers.
+    std::unordered_map<const char*, uint16_t> buffers {};
+
+    ~Ring() noexcept
+    {
+        if (sqes)
+        {
+            ::munmap(sqes, sqes_size);
+        }
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        {
+            ::munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != MAP_FAILED)
+        {
+            ::munmap(sq_ring, sq_ring_size);
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    /// Sets up a ring with room for the given number of reads, plus the request that stops the reaper.
+    /// @returns false if io_uring is unavailable
+    bool setup(uint32_t entries) noexcept
+    {
+        io_uring_params params {};
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries + 1, &params));
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        auto single  = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+        {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+
+        sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+        {
+            return false;
+        }
+
+        cq_ring = single ? sq_ring : ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+        {
+            return false;
+        }
+
+        sqes_size     = params.sq_entries * sizeof(io_uring_sqe);
+        auto sqes_map = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes_map == MAP_FAILED)
+        {
+            return false;
+        }
+
+        auto sq  = static_cast<char*>(sq_ring);
+        auto cq  = static_cast<char*>(cq_ring);
+        sqes     = static_cast<io_uring_sqe*>(sqes_map);
+        sq_tail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_mask  = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        cq_head  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask  = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // an empty sparse table lets buffers be registered one by one as the pool allocates them
+        io_uring_rsrc_register table {};
+        table.nr     = static_cast<uint32_t>(std::min<size_t>(max_buffers, UINT16_MAX));
+        table.flags  = IORING_RSRC_REGISTER_SPARSE;
+        registration = table.nr && ::syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS2, &table, sizeof(table)) == 0;
+        max_buffers  = table.nr;
+
+        return true;
+    }
+
+    /// Finds the registered index of a buffer, registering it on first use. Requires mutex.
+    /// @returns the index, or -1 if the buffer isn't registered
+    int buffer_index(char* buffer) noexcept
+    {
+        if (auto it = buffers.find(buffer); it != buffers.end())
+        {
+            return it->second;
+        }
+
+        if (!registration || buffers.size() == max_buffers)
+        {
+            return -1;
+        }
+
+        // registration pins the buffer; past the locked memory limit, reads go through plain buffers
+        iovec vector {buffer, buffer_size};
+        io_uring_rsrc_update2 update {};
+        update.offset = static_cast<uint32_t>(buffers.size());
+        update.data   = reinterpret_cast<uint64_t>(&vector);
+        update.nr     = 1;
+        if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update)) < 0)
+        {
+            registration = false;
+            return -1;
+        }
+
+        auto index = static_cast<uint16_t>(buffers.size());
+        buffers.emplace(buffer, index);
+        return index;
+    }
+
+    /// Queues one entry and hands it to the kernel. Requires mutex.
+    void push(const io_uring_sqe& entry) noexcept
+    {
+        auto tail       = *sq_tail;
+        auto index      = tail & sq_mask;
+        sqes[index]     = entry;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        while (::syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+};
+
+#else
+
+struct AsyncReader::Ring
+{
+};
+
+#endif
+
+AsyncReader::AsyncReader(uint32_t depth, size_t buffer_size, size_t max_buffers) noexcept
+    : m_depth {std::max<uint32_t>(depth, 1)}
+{
+#ifdef IO_URING_BUILD
+    auto ring         = std::make_unique<Ring>();
+    ring->buffer_size = buffer_size;
+    ring->max_buffers = max_buffers;
+    if (ring->setup(m_depth))
+    {
+        m_ring = std::move(ring);
+        m_threads.emplace_back(&AsyncReader::reap, this);
+        m_valid = true;
+        return;
+    }
+#else
+    (void)buffer_size;
+    (void)max_buffers;
+#endif
+
+#ifdef UNIX_BUILD
+    for (uint32_t i {0}; i < std::min(m_depth, MAX_PREAD_THREADS); ++i)
+    {
+        m_threads.emplace_back(&AsyncReader::serve, this);
+    }
+    m_valid = true;
+#endif
+}
+
+AsyncReader::~AsyncReader() noexcept
+{
+    while (m_in_flight.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+
+#ifdef IO_URING_BUILD
+    if (m_ring)
+    {
+        // a request without user data wakes the reaper and tells it to stop
+        io_uring_sqe entry {};
+        entry.opcode = IORING_OP_NOP;
+        std::lock_guard g {m_ring->mutex};
+        m_ring->push(entry);
+    }
+#endif
+
+    {
+        std::lock_guard g {m_mutex};
+        m_stop = true;
+    }
+    m_condition.notify_all();
+
+    for (auto& t: m_threads)
+    {
+        t.join();
+    }
+}
+
+bool AsyncReader::valid() const noexcept
+{
+    return m_valid;
+}
+
+const char* AsyncReader::backend() const noexcept
+{
+    return m_ring ? "io_uring" : "pread";
+}
+
+uint32_t AsyncReader::depth() const noexcept
+{
+    return m_depth;
+}
+
+AsyncReader::Stats AsyncReader::stats() const noexcept
+{
+    Stats stats;
+    stats.reads = m_reads;
+    stats.bytes = m_bytes;
+    stats.fixed = m_fixed;
+    stats.peak  = m_peak;
+#ifdef IO_URING_BUILD
+    if (m_ring)
+    {
+        std::lock_guard g {m_ring->mutex};
+        stats.registered = static_cast<uint32_t>(m_ring->buffers.size());
+    }
+#endif
+
+    return stats;
+}
+
+bool AsyncReader::reserve() noexcept
+{
+    auto count = m_in_flight.load(std::memory_order_relaxed);
+    do
+    {
+        if (count >= m_depth)
+        {
+            return false;
+        }
+    } while (!m_in_flight.compare_exchange_weak(count, count + 1, std::memory_order_acquire));
+
+    for (auto peak = m_peak.load(std::memory_order_relaxed); peak < count + 1 && !m_peak.compare_exchange_weak(peak, count + 1);)
+    {
+    }
+
+    return true;
+}
+
+void AsyncReader::submit(Request* request) noexcept
+{
+#ifdef IO_URING_BUILD
+    if (m_ring)
+    {
+        io_uring_sqe entry {};
+        entry.fd        = request->fd;
+        entry.off       = request->offset + request->done;
+        entry.addr      = reinterpret_cast<uint64_t>(request->buffer + request->done);
+        entry.len       = static_cast<uint32_t>(request->length - request->done);
+        entry.user_data = reinterpret_cast<uint64_t>(request);
+
+        std::lock_guard g {m_ring->mutex};
+        if (auto index = m_ring->buffer_index(request->buffer); index >= 0)
+        {
+            entry.opcode    = IORING_OP_READ_FIXED;
+            entry.buf_index = static_cast<uint16_t>(index);
+            ++m_fixed;
+        }
+        else
+        {
+            entry.opcode = IORING_OP_READ;
+        }
+
+        m_ring->push(entry);
+        return;
+    }
+#endif
+
+    {
+        std::lock_guard g {m_mutex};
+        m_requests.push_back(request);
+    }
+    m_condition.notify_one();
+}
+
+bool AsyncReader::advance(Request* request, int64_t result) noexcept
+{
+    if (result <= 0)
+    {
+        return true;
+    }
+
+    request->done += static_cast<size_t>(result);
+    return request->done == request->length;
+}
+
+void AsyncReader::finish(Request* request, int64_t result) noexcept
+{
+    // a failure after a partial read reports the error, since the range is incomplete either way
+    ++m_reads;
+    m_bytes += request->done;
+    request->complete(result < 0 ? result : static_cast<int64_t>(request->done));
+    delete request;
+
+    m_in_flight.fetch_sub(1, std::memory_order_release);
+}
+
+void AsyncReader::reap() noexcept
+{
+#ifdef IO_URING_BUILD
+    for (;;)
+    {
+        // an interrupted wait just checks the ring again
+        ::syscall(__NR_io_uring_enter, m_ring->fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+        auto head = *m_ring->cq_head;
+        auto tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const auto& entry = m_ring->cqes[head & m_ring->cq_mask];
+            auto request      = reinterpret_cast<Request*>(entry.user_data);
+            auto result       = int64_t {entry.res};
+
+            // the entry can be reused as soon as its values are copied
+            __atomic_store_n(m_ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+            if (!request)
+            {
+                return;
+            }
+
+            if (advance(request, result))
+            {
+                finish(request, result);
+            }
+            else
+            {
+                submit(request);
+            }
+        }
+    }
+#endif
+}
+
+void AsyncReader::serve() noexcept
+{
+#ifdef UNIX_BUILD
+    for (;;)
+    {
+        Request* request {nullptr};
+        {
+            std::unique_lock lk {m_mutex};
+            m_condition.wait(lk, [this] { return m_stop || !m_requests.empty(); });
+            if (m_requests.empty())
+            {
+                return;
+            }
+
+            request = m_requests.front();
+            m_requests.pop_front();
+        }
+
+        int64_t result {0};
+        for (;;)
+        {
+            auto offset = static_cast<off_t>(request->offset + request->done);
+            result      = ::pread(request->fd, request->buffer + request->done, request->length - request->done, offset);
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            result = result < 0 ? -errno : result;
+            if (advance(request, result))
+            {
+                break;
+            }
+        }
+
+        finish(request, result);
+    }
+#endif
+}
+
+} // namespace util::sys
@@ -0,0 +1,138 @@
+#include "util/buffer_pool.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#include "util/sys.h"
+
+using namespace util::misc;
+
+BufferPool::Buffer::~Buffer() noexcept
+{
+    release();
+}
+
+BufferPool::Buffer::Buffer(BufferPool* pool, char* data) noexcept
+    : m_pool {pool}, m_data {data}
+{
+}
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+    : m_pool {std::exchange(other.m_pool, nullptr)}, m_data {std::exchange(other.m_data, nullptr)}
+{
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        m_pool = std::exchange(other.m_pool, nullptr);
+        m_data = std::exchange(other.m_data, nullptr);
+    }
+
+    return *this;
+}
+
+BufferPool::Buffer::operator bool() const noexcept
+{
+    return m_data != nullptr;
+}
+
+char* BufferPool::Buffer::data() const noexcept
+{
+    return m_data;
+}
+
+size_t BufferPool::Buffer::size() const noexcept
+{
+    return m_pool ? m_pool->buffer_size() : 0U;
+}
+
+void BufferPool::Buffer::release() noexcept
+{
+    if (m_data)
+    {
+        m_pool->give_back(m_data);
+        m_data = nullptr;
+    }
+}
+
+BufferPool::BufferPool(size_t buffer_size, uint64_t max_memory) noexcept
+    : m_buffer_size {buffer_size}, m_max_buffers {static_cast<size_t>(std::max<uint64_t>(max_memory / buffer_size, 1))}
+{
+    // checking buffers in and out never allocates
+    m_allocated.reserve(m_max_buffers);
+    m_free.reserve(m_max_buffers);
+}
+
+BufferPool::~BufferPool() noexcept
+{
+    // NOTE: buffers must not outlive the pool; all checked out buffers are expected back by now
+    for (auto data: m_allocated)
+    {
+        ::operator delete(data, std::align_val_t {util::sys::pagesize()});
+    }
+}
+
+BufferPool::Buffer BufferPool::acquire() noexcept
+{
+    std::unique_lock lk {m_mutex};
+    char* data {nullptr};
+    m_condition.wait(lk, [this, &data] { return (data = take()) != nullptr; });
+
+    return {this, data};
+}
+
+BufferPool::Buffer BufferPool::try_acquire(std::chrono::milliseconds timeout) noexcept
+{
+    std::unique_lock lk {m_mutex};
+    char* data {nullptr};
+    m_condition.wait_for(lk, timeout, [this, &data] { return (data = take()) != nullptr; });
+
+    return {data ? this : nullptr, data};
+}
+
+size_t BufferPool::buffer_size() const noexcept
+{
+    return m_buffer_size;
+}
+
+size_t BufferPool::max_buffers() const noexcept
+{
+    return m_max_buffers;
+}
+
+char* BufferPool::take() noexcept
+{
+    if (!m_free.empty())
+    {
+        auto data = m_free.back();
+        m_free.pop_back();
+        return data;
+    }
+
+    if (m_allocated.size() < m_max_buffers)
+    {
+        // out of memory, the buffers allocated so far are the budget until the next try
+        auto data = static_cast<char*>(::operator new(m_buffer_size, std::align_val_t {util::sys::pagesize()}, std::nothrow));
+        if (data)
+        {
+            m_allocated.push_back(data);
+        }
+        return data;
+    }
+
+    return nullptr;
+}
+
+void BufferPool::give_back(char* data) noexcept
+{
+    {
+        std::lock_guard g {m_mutex};
+        m_free.push_back(data);
+    }
+
+    m_condition.notify_one();
+}
@@ -0,0 +1,85 @@
+#include "util/directory_cache.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+
+using namespace util::sys;
+
+namespace {
+
+namespace fs = std::filesystem;
+
+/// Time during which a directory may still change without its modification time telling, since file system clocks
+/// are coarser than the changes; a directory modified this recently isn't cached.
+constexpr std::chrono::seconds RACY_WINDOW {2};
+
+} // namespace
+
+DirectoryCache::DirectoryCache(size_t max_bytes) noexcept
+    : m_max_bytes {max_bytes}
+{
+}
+
+bool DirectoryCache::list(const char* path, const std::function<void(std::string_view name, EntryType type)>& callback)
+{
+    std::error_code ec;
+    auto modified = fs::last_write_time(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    int64_t mtime = modified.time_since_epoch().count();
+    std::shared_ptr<const Listing> listing;
+    {
+        std::shared_lock lk {m_mutex};
+        if (auto it = m_listings.find(path); it != m_listings.end() && it->second->mtime == mtime)
+        {
+            listing = it->second;
+        }
+    }
+
+    if (!listing)
+    {
+        auto fresh   = std::make_shared<Listing>();
+        fresh->mtime = mtime;
+        fresh->bytes = sizeof(Listing) + std::strlen(path);
+        if (!list_directory(path, [&](std::string_view name, EntryType type) {
+                fresh->entries.emplace_back(name, type);
+                fresh->bytes += sizeof(fresh->entries.front()) + name.size();
+            }))
+        {
+            return false;
+        }
+
+        if (fs::file_time_type::clock::now() - modified >= RACY_WINDOW && fresh->bytes <= m_max_bytes)
+        {
+            std::unique_lock lk {m_mutex};
+            if (auto it = m_listings.find(path); it != m_listings.end())
+            {
+                m_bytes -= it->second->bytes;
+                m_listings.erase(it);
+            }
+
+            // a full cache starts over, rather than tracking which listings are used least
+            if (m_bytes + fresh->bytes > m_max_bytes)
+            {
+                m_listings.clear();
+                m_bytes = 0;
+            }
+
+            m_listings.emplace(path, fresh);
+            m_bytes += fresh->bytes;
+        }
+        listing = std::move(fresh);
+    }
+
+    for (const auto& [name, type]: listing->entries)
+    {
+        callback(name, type);
+    }
+
+    return true;
+}
@@ -0,0 +1,550 @@
+#include <algorithm>
+
+#include "util/inflate_reader.h"
+
+namespace util::io {
+
+namespace {
+
+constexpr size_t INPUT_SIZE {65536};
+constexpr uint32_t WINDOW_SIZE {32768};
+constexpr uint32_t WINDOW_MASK {WINDOW_SIZE - 1};
+
+// base values and extra bits of the length and distance symbols
+constexpr uint16_t LENGTH_BASE[] {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr uint8_t LENGTH_EXTRA[] {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr uint16_t DISTANCE_BASE[] {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,   33,   49,   65,   97,   129,
+                                    193,  257,  385,  513,  769,  1025,  1537,  2049,  3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr uint8_t DISTANCE_EXTRA[] {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/// Order in which the lengths of the code length code are stored.
+constexpr uint8_t CODE_LENGTH_ORDER[] {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+constexpr unsigned MAX_CODE_LENGTH {15};
+
+/// Reverses the lowest bits of a code, since deflate stores Huffman codes starting from their highest bit.
+uint32_t reverse_bits(uint32_t code, unsigned length) noexcept
+{
+    uint32_t reversed {0};
+    for (unsigned i {0}; i < length; ++i, code >>= 1)
+    {
+        reversed = (reversed << 1) | (code & 1);
+    }
+    return reversed;
+}
+
+} // namespace
+
+bool InflateReader::Huffman::build(const uint8_t* lengths, size_t count) noexcept
+{
+    counts.fill(0);
+    for (size_t symbol {0}; symbol < count; ++symbol)
+    {
+        ++counts[lengths[symbol]];
+    }
+    counts[0] = 0;
+
+    // an incomplete code is allowed, its unused codes fail to decode
+    int left {1};
+    for (unsigned length {1}; length <= MAX_CODE_LENGTH; ++length)
+    {
+        left = (left << 1) - counts[length];
+        if (left < 0)
+        {
+            return false;
+        }
+    }
+
+    // symbols sorted by code, and the first code of each length
+    std::array<uint16_t, MAX_CODE_LENGTH + 2> offsets {};
+    std::array<uint32_t, MAX_CODE_LENGTH + 1> next_code {};
+    for (unsigned length {1}; length <= MAX_CODE_LENGTH; ++length)
+    {
+        offsets[length + 1] = static_cast<uint16_t>(offsets[length] + counts[length]);
+        next_code[length]   = (next_code[length - 1] + counts[length - 1]) << 1;
+    }
+
+    fast.fill(0);
+    for (size_t symbol {0}; symbol < count; ++symbol)
+    {
+        auto length = lengths[symbol];
+        if (!length)
+        {
+            continue;
+        }
+
+        symbols[offsets[length]++] = static_cast<uint16_t>(symbol);
+
+        // a short code fills every entry whose lowest bits are the code
+        auto code = next_code[length]++;
+        if (length <= FAST_BITS)
+        {
+            auto entry = static_cast<uint16_t>(symbol << 4 | length);
+            for (auto index = reverse_bits(code, length); index < fast.size(); index += 1U << length)
+            {
+                fast[index] = entry;
+            }
+        }
+    }
+
+    return true;
+}
+
+InflateReader::InflateReader(const char* path)
+    : m_stream {path, std::ios::binary}, m_input(INPUT_SIZE), m_window(WINDOW_SIZE)
+{
+    if (!m_stream.good())
+    {
+        return;
+    }
+
+    refill();
+    if (overrun() || m_count - m_padding < 16)
+    {
+        return;
+    }
+
+    // a zlib header is a multiple of 31, announces deflate and no preset dictionary
+    auto first  = static_cast<uint32_t>(m_bits & 0xff);
+    auto second = static_cast<uint32_t>(m_bits >> 8 & 0xff);
+    if (first == 0x1f && second == 0x8b)
+    {
+        m_format = Format::Gzip;
+        m_valid  = read_header();
+    }
+    else if ((first & 0x0f) == 8 && first >> 4 <= 7 && (first << 8 | second) % 31 == 0 && !(second & 0x20))
+    {
+        bits(16);
+        m_format = Format::Zlib;
+        m_state  = State::BlockHeader;
+        m_valid  = true;
+    }
+}
+
+bool InflateReader::valid() const noexcept
+{
+    return m_valid;
+}
+
+bool InflateReader::failed() const noexcept
+{
+    return m_state == State::Failed;
+}
+
+uint64_t InflateReader::compressed_bytes() const noexcept
+{
+    return m_compressed;
+}
+
+size_t InflateReader::read(char* data, size_t size)
+{
+    auto out     = data;
+    auto out_end = data + size;
+    while (out < out_end)
+    {
+        if (m_state == State::BlockHeader)
+        {
+            if (!read_block_header())
+            {
+                m_state = State::Failed;
+            }
+        }
+        else if (m_state == State::Stored)
+        {
+            for (auto stored = std::min<size_t>(m_stored_left, static_cast<size_t>(out_end - out)); stored > 0; --stored)
+            {
+                auto byte                           = static_cast<char>(bits(8));
+                *out++                              = byte;
+                m_window[m_produced++ & WINDOW_MASK] = byte;
+                --m_stored_left;
+            }
+
+            if (overrun())
+            {
+                m_state = State::Failed;
+            }
+            else if (!m_stored_left)
+            {
+                m_state = m_last_block ? State::Trailer : State::BlockHeader;
+            }
+        }
+        else if (m_state == State::Huffman)
+        {
+            copy_match(out, out_end);
+            while (out < out_end)
+            {
+                auto symbol = decode(*m_literal_code);
+                if (symbol < 256)
+                {
+                    if (symbol < 0)
+                    {
+                        m_state = State::Failed;
+                        break;
+                    }
+
+                    auto byte                           = static_cast<char>(symbol);
+                    *out++                              = byte;
+                    m_window[m_produced++ & WINDOW_MASK] = byte;
+                    continue;
+                }
+
+                if (symbol == 256)
+                {
+                    m_state = m_last_block ? State::Trailer : State::BlockHeader;
+                    break;
+                }
+
+                // a back-reference into the window: length symbol and its extra bits, then the distance's
+                auto length_symbol = static_cast<size_t>(symbol - 257);
+                if (length_symbol >= std::size(LENGTH_BASE))
+                {
+                    m_state = State::Failed;
+                    break;
+                }
+                m_match_length = LENGTH_BASE[length_symbol] + bits(LENGTH_EXTRA[length_symbol]);
+
+                auto distance_symbol = decode(*m_distance_code);
+                if (distance_symbol < 0 || static_cast<size_t>(distance_symbol) >= std::size(DISTANCE_BASE))
+                {
+                    m_state = State::Failed;
+                    break;
+                }
+                m_match_distance = DISTANCE_BASE[distance_symbol] + bits(DISTANCE_EXTRA[distance_symbol]);
+
+                if (m_match_distance > std::min<uint64_t>(m_produced, WINDOW_SIZE))
+                {
+                    m_state = State::Failed;
+                    break;
+                }
+
+                copy_match(out, out_end);
+            }
+
+            if (overrun())
+            {
+                m_state = State::Failed;
+            }
+        }
+        else if (m_state == State::Trailer)
+        {
+            if (!read_trailer())
+            {
+                m_state = State::Failed;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return static_cast<size_t>(out - data);
+}
+
+const std::array<InflateReader::Huffman, 2>& InflateReader::fixed_codes() noexcept
+{
+    static const auto codes = [] {
+        std::array<uint8_t, 288> lengths;
+        std::fill_n(lengths.begin(), 144, uint8_t {8});
+        std::fill_n(lengths.begin() + 144, 112, uint8_t {9});
+        std::fill_n(lengths.begin() + 256, 24, uint8_t {7});
+        std::fill_n(lengths.begin() + 280, 8, uint8_t {8});
+
+        std::array<uint8_t, 30> distance_lengths;
+        distance_lengths.fill(5);
+
+        std::array<Huffman, 2> fixed;
+        fixed[0].build(lengths.data(), lengths.size());
+        fixed[1].build(distance_lengths.data(), distance_lengths.size());
+        return fixed;
+    }();
+
+    return codes;
+}
+
+bool InflateReader::read_header()
+{
+    // magic, method, flags, then modification time, extra flags and OS
+    if (bits(8) != 0x1f || bits(8) != 0x8b || bits(8) != 8)
+    {
+        return false;
+    }
+
+    auto flags = bits(8);
+    for (auto i {0}; i < 6; ++i)
+    {
+        bits(8);
+    }
+
+    if (flags & 0x04)
+    {
+        for (auto extra = bits(16); extra > 0 && !overrun(); --extra)
+        {
+            bits(8);
+        }
+    }
+
+    // file name and comment are zero terminated
+    for (auto field: {0x08U, 0x10U})
+    {
+        if (flags & field)
+        {
+            while (bits(8) && !overrun())
+            {
+            }
+        }
+    }
+
+    if (flags & 0x02)
+    {
+        bits(16);
+    }
+
+    m_produced   = 0;
+    m_last_block = false;
+    m_state      = State::BlockHeader;
+    return !overrun();
+}
+
+bool InflateReader::read_block_header()
+{
+    m_last_block = bits(1);
+    switch (bits(2))
+    {
+        case 0:
+        {
+            align();
+            auto length     = bits(16);
+            auto complement = bits(16);
+            if ((length ^ 0xffff) != complement)
+            {
+                return false;
+            }
+
+            m_stored_left = length;
+            m_state       = length ? State::Stored : m_last_block ? State::Trailer : State::BlockHeader;
+            break;
+        }
+        case 1:
+            m_literal_code  = &fixed_codes()[0];
+            m_distance_code = &fixed_codes()[1];
+            m_state         = State::Huffman;
+            break;
+        case 2:
+            if (!read_dynamic_codes())
+            {
+                return false;
+            }
+
+            m_literal_code  = &m_literals;
+            m_distance_code = &m_distances;
+            m_state         = State::Huffman;
+            break;
+        default:
+            return false;
+    }
+
+    return !overrun();
+}
+
+bool InflateReader::read_dynamic_codes()
+{
+    auto literal_count  = bits(5) + 257;
+    auto distance_count = bits(5) + 1;
+    auto length_count   = bits(4) + 4;
+    if (literal_count > 286 || distance_count > 30)
+    {
+        return false;
+    }
+
+    // the code lengths are themselves Huffman coded
+    std::array<uint8_t, 320> lengths {};
+    for (uint32_t i {0}; i < length_count; ++i)
+    {
+        lengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(bits(3));
+    }
+
+    Huffman length_code;
+    if (!length_code.build(lengths.data(), std::size(CODE_LENGTH_ORDER)))
+    {
+        return false;
+    }
+
+    // 16 repeats the previous length, 17 and 18 repeat zeros
+    const auto total = literal_count + distance_count;
+    for (uint32_t index {0}; index < total;)
+    {
+        auto symbol = decode(length_code);
+        if (symbol < 0 || overrun())
+        {
+            return false;
+        }
+
+        if (symbol < 16)
+        {
+            lengths[index++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+
+        uint8_t length {0};
+        uint32_t repeat {0};
+        if (symbol == 16)
+        {
+            if (!index)
+            {
+                return false;
+            }
+            length = lengths[index - 1];
+            repeat = 3 + bits(2);
+        }
+        else
+        {
+            repeat = symbol == 17 ? 3 + bits(3) : 11 + bits(7);
+        }
+
+        if (index + repeat > total)
+        {
+            return false;
+        }
+        std::fill_n(lengths.begin() + index, repeat, length);
+        index += repeat;
+    }
+
+    // a block without an end code can't end
+    return lengths[256] && m_literals.build(lengths.data(), literal_count) && m_distances.build(lengths.data() + literal_count, distance_count);
+}
+
+bool InflateReader::read_trailer()
+{
+    align();
+    if (m_format == Format::Zlib)
+    {
+        // Adler-32 checksum, not verified
+        bits(16);
+        bits(16);
+        m_state = State::End;
+        return !overrun();
+    }
+
+    // CRC-32, not verified, then the size modulo 2^32
+    bits(16);
+    bits(16);
+    auto size = bits(16);
+    size |= bits(16) << 16;
+    if (overrun() || size != static_cast<uint32_t>(m_produced))
+    {
+        return false;
+    }
+
+    // another member may follow; trailing garbage is ignored, like gzip does
+    refill();
+    if (m_count - m_padding >= 16 && (m_bits & 0xffff) == 0x8b1f)
+    {
+        return read_header();
+    }
+
+    m_state = State::End;
+    return true;
+}
+
+int InflateReader::decode(const Huffman& code) noexcept
+{
+    if (m_count < MAX_CODE_LENGTH)
+    {
+        refill();
+    }
+
+    if (auto entry = code.fast[m_bits & ((1U << Huffman::FAST_BITS) - 1)])
+    {
+        m_bits >>= entry & 15;
+        m_count -= entry & 15U;
+        return entry >> 4;
+    }
+
+    // longer codes are decoded a bit at a time: codes of each length are consecutive, after the shorter ones
+    int value {0};
+    int first {0};
+    int index {0};
+    for (unsigned length {1}; length <= MAX_CODE_LENGTH; ++length)
+    {
+        value |= static_cast<int>(m_bits & 1);
+        m_bits >>= 1;
+        --m_count;
+
+        int count = code.counts[length];
+        if (value - count < first)
+        {
+            return code.symbols[static_cast<size_t>(index + value - first)];
+        }
+
+        index += count;
+        first = (first + count) << 1;
+        value <<= 1;
+    }
+
+    return -1;
+}
+
+void InflateReader::copy_match(char*& out, char* out_end) noexcept
+{
+    for (; m_match_length && out < out_end; --m_match_length)
+    {
+        auto byte                           = m_window[(m_produced - m_match_distance) & WINDOW_MASK];
+        *out++                              = byte;
+        m_window[m_produced++ & WINDOW_MASK] = byte;
+    }
+}
+
+void InflateReader::refill()
+{
+    while (m_count <= 56)
+    {
+        if (m_input_pos == m_input_end && m_stream)
+        {
+            m_stream.read(m_input.data(), static_cast<std::streamsize>(m_input.size()));
+            m_input_pos = 0;
+            m_input_end = static_cast<size_t>(m_stream.gcount());
+            m_compressed += m_input_end;
+        }
+
+        // past the end of the file, zeros are appended and counted so that consuming them fails
+        uint64_t byte {0};
+        if (m_input_pos < m_input_end)
+        {
+            byte = static_cast<unsigned char>(m_input[m_input_pos++]);
+        }
+        else
+        {
+            m_padding += 8;
+        }
+
+        m_bits |= byte << m_count;
+        m_count += 8;
+    }
+}
+
+uint32_t InflateReader::bits(unsigned count)
+{
+    if (m_count < count)
+    {
+        refill();
+    }
+
+    auto value = static_cast<uint32_t>(m_bits & ((uint64_t {1} << count) - 1));
+    m_bits >>= count;
+    m_count -= count;
+    return value;
+}
+
+void InflateReader::align() noexcept
+{
+    m_bits >>= m_count % 8;
+    m_count -= m_count % 8;
+}
+
+bool InflateReader::overrun() const noexcept
+{
+    return m_count < m_padding;
+}
+
+} // namespace util::io
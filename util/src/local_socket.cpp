@@ -0,0 +1,228 @@
+#include "util/local_socket.h"
+
+#include <cstring>
+#include <utility>
+
+#include "util/sys.h"
+
+#ifdef UNIX_BUILD
+#    include <cerrno>
+#    include <csignal>
+#    include <sys/socket.h>
+#    include <sys/time.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
+using namespace util::sys;
+
+namespace {
+
+#ifdef UNIX_BUILD
+/// Fills a socket address with a path.
+/// @returns false if the path doesn't fit
+bool make_address(const char* path, sockaddr_un& address) noexcept
+{
+    address            = {};
+    address.sun_family = AF_UNIX;
+
+    auto length = std::strlen(path);
+    if (length == 0 || length >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    std::memcpy(address.sun_path, path, length);
+    return true;
+}
+#endif
+
+} // namespace
+
+LocalSocket::~LocalSocket() noexcept
+{
+#ifdef UNIX_BUILD
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+#endif
+}
+
+LocalSocket::LocalSocket(int fd) noexcept
+    : m_fd {fd}
+{
+}
+
+LocalSocket LocalSocket::connect(const char* path) noexcept
+{
+#ifdef UNIX_BUILD
+    sockaddr_un address;
+    if (!make_address(path, address))
+    {
+        return {};
+    }
+
+    LocalSocket socket {::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (socket.valid() && ::connect(socket.m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0)
+    {
+        return socket;
+    }
+#else
+    (void)path;
+#endif
+
+    return {};
+}
+
+LocalSocket::LocalSocket(LocalSocket&& other) noexcept
+    : m_fd {std::exchange(other.m_fd, -1)}
+{
+}
+
+LocalSocket& LocalSocket::operator=(LocalSocket&& other) noexcept
+{
+    if (this != &other)
+    {
+        LocalSocket old {std::move(*this)};
+        m_fd = std::exchange(other.m_fd, -1);
+    }
+
+    return *this;
+}
+
+bool LocalSocket::valid() const noexcept
+{
+    return m_fd >= 0;
+}
+
+int LocalSocket::get() const noexcept
+{
+    return m_fd;
+}
+
+bool LocalSocket::send(std::string_view data) const noexcept
+{
+#ifdef UNIX_BUILD
+    while (!data.empty())
+    {
+        auto sent = ::write(m_fd, data.data(), data.size());
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+
+    return true;
+#else
+    return data.empty();
+#endif
+}
+
+size_t LocalSocket::receive(char* data, size_t size) const noexcept
+{
+#ifdef UNIX_BUILD
+    for (;;)
+    {
+        auto received = ::read(m_fd, data, size);
+        if (received >= 0)
+        {
+            return static_cast<size_t>(received);
+        }
+
+        if (errno != EINTR)
+        {
+            return 0;
+        }
+    }
+#else
+    (void)data;
+    (void)size;
+    return 0;
+#endif
+}
+
+bool LocalSocket::set_receive_timeout(std::chrono::milliseconds timeout) const noexcept
+{
+#ifdef UNIX_BUILD
+    timeval value {};
+    value.tv_sec  = timeout.count() / 1000;
+    value.tv_usec = timeout.count() % 1000 * 1000;
+    return ::setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &value, sizeof(value)) == 0;
+#else
+    (void)timeout;
+    return false;
+#endif
+}
+
+LocalListener::LocalListener(const char* path) noexcept
+    : m_path {path}
+{
+#ifdef UNIX_BUILD
+    sockaddr_un address;
+    if (!make_address(path, address))
+    {
+        return;
+    }
+
+    // a socket file nobody accepts on is left over from a process that went away
+    if (LocalSocket::connect(path).valid())
+    {
+        return;
+    }
+    ::unlink(path);
+
+    m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+    {
+        return;
+    }
+
+    if (::bind(m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_fd, SOMAXCONN) != 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    // a client going away while its results are written must not end the process
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+LocalListener::~LocalListener() noexcept
+{
+#ifdef UNIX_BUILD
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        ::unlink(m_path.c_str());
+    }
+#endif
+}
+
+bool LocalListener::valid() const noexcept
+{
+    return m_fd >= 0;
+}
+
+LocalSocket LocalListener::accept() const noexcept
+{
+#ifdef UNIX_BUILD
+    for (;;)
+    {
+        auto fd = ::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0 || errno != EINTR)
+        {
+            return LocalSocket {fd};
+        }
+    }
+#else
+    return {};
+#endif
+}
@@ -0,0 +1,145 @@
+#include "util/mapped_file.h"
+
+#include <utility>
+
+#include "util/sys.h"
+
+#ifdef UNIX_BUILD
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#elif defined WIN32_BUILD
+#    include <windows.h>
+#endif
+
+namespace util::sys {
+
+MappedFile::~MappedFile() noexcept
+{
+    unmap();
+}
+
+MappedFile::MappedFile(const char* path) noexcept
+{
+#ifdef UNIX_BUILD
+    auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    // only regular, non-empty files can be mapped; pipes and devices need buffered reads
+    struct stat info {};
+    if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        auto size = static_cast<size_t>(info.st_size);
+        if (auto data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0); data != MAP_FAILED)
+        {
+            m_data = static_cast<const char*>(data);
+            m_size = size;
+        }
+    }
+
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+#elif defined WIN32_BUILD
+    auto file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    LARGE_INTEGER size {};
+    if (::GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        if (auto mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr); mapping)
+        {
+            if (auto data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0); data)
+            {
+                m_data = static_cast<const char*>(data);
+                m_size = static_cast<size_t>(size.QuadPart);
+            }
+            ::CloseHandle(mapping);
+        }
+    }
+
+    ::CloseHandle(file);
+#else
+    (void)path;
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : m_data {std::exchange(other.m_data, nullptr)}, m_size {std::exchange(other.m_size, 0)}
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        unmap();
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+    }
+
+    return *this;
+}
+
+bool MappedFile::valid() const noexcept
+{
+    return m_data != nullptr;
+}
+
+std::string_view MappedFile::view() const noexcept
+{
+    return {m_data, m_size};
+}
+
+size_t MappedFile::size() const noexcept
+{
+    return m_size;
+}
+
+void MappedFile::advise(Advice advice, size_t offset, size_t length) const noexcept
+{
+#ifdef UNIX_BUILD
+    if (!valid() || offset >= m_size)
+    {
+        return;
+    }
+
+    // madvise requires a page aligned address
+    auto aligned = offset - (offset % pagesize());
+    auto end     = length && offset + length < m_size ? offset + length : m_size;
+
+    // NOTE: the mapping is read-only, madvise only needs the non-const address for its signature
+    auto address = const_cast<char*>(m_data + aligned);
+    ::madvise(address, end - aligned, advice == Advice::Sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+#else
+    // no portable equivalent; the hints are optional
+    (void)advice;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+void MappedFile::unmap() noexcept
+{
+    if (!m_data)
+    {
+        return;
+    }
+
+#ifdef UNIX_BUILD
+    ::munmap(const_cast<char*>(m_data), m_size);
+#elif defined WIN32_BUILD
+    ::UnmapViewOfFile(m_data);
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+} // namespace util::sys
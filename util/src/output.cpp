@@ -0,0 +1,322 @@
+#include "util/output.h"
+
+#include <charconv>
+#include <iostream>
+#include <new>
+#include <utility>
+
+#include "util/sys.h"
+
+#ifdef UNIX_BUILD
+#    include <cerrno>
+#    include <unistd.h>
+#elif defined WIN32_BUILD
+#    include <algorithm>
+#    include <climits>
+#    include <io.h>
+#else
+#    include <cstdio>
+#endif
+
+using namespace util::io;
+
+namespace {
+
+constexpr size_t FLUSH_THRESHOLD {65536}; //!< Slot size that triggers a write, in bytes.
+
+/// Writes the whole text, retrying on partial writes and interrupts.
+void write_all(int fd, std::string_view text) noexcept
+{
+#ifdef UNIX_BUILD
+    while (!text.empty())
+    {
+        auto written = ::write(fd, text.data(), text.size());
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        text.remove_prefix(static_cast<size_t>(written));
+    }
+#elif defined WIN32_BUILD
+    while (!text.empty())
+    {
+        auto written = ::_write(fd, text.data(), static_cast<unsigned>(std::min<size_t>(text.size(), INT_MAX)));
+        if (written <= 0)
+        {
+            return;
+        }
+        text.remove_prefix(static_cast<size_t>(written));
+    }
+#else
+    (void)fd;
+    std::fwrite(text.data(), 1, text.size(), stdout);
+#endif
+}
+
+} // namespace
+
+OutputBuffer::OutputBuffer(size_t capacity)
+{
+    m_data.reserve(capacity);
+}
+
+OutputBuffer& OutputBuffer::append(std::string_view text)
+{
+    m_data.append(text);
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::append(char c)
+{
+    m_data.push_back(c);
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::append_number(uint64_t number)
+{
+    char digits[20];
+    auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), number);
+    m_data.append(digits, static_cast<size_t>(end - digits));
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::append_escaped(std::string_view text)
+{
+    for (auto c: text)
+    {
+        switch (c)
+        {
+            case '\t':
+                m_data.append("\\t");
+                break;
+            case '\r':
+                m_data.append("\\r");
+                break;
+            case '\n':
+                m_data.append("\\n");
+                break;
+            default:
+                m_data.push_back(c);
+        }
+    }
+
+    return *this;
+}
+
+std::string_view OutputBuffer::view() const noexcept
+{
+    return m_data;
+}
+
+size_t OutputBuffer::size() const noexcept
+{
+    return m_data.size();
+}
+
+bool OutputBuffer::empty() const noexcept
+{
+    return m_data.empty();
+}
+
+void OutputBuffer::clear() noexcept
+{
+    m_data.clear();
+}
+
+std::string OutputBuffer::release() noexcept
+{
+    return std::exchange(m_data, {});
+}
+
+Output::Output(int fd, size_t slots)
+    : m_fd {fd}, m_slots(slots)
+{
+    for (auto& slot: m_slots)
+    {
+        slot.buffer = OutputBuffer {2 * FLUSH_THRESHOLD};
+    }
+}
+
+Output::~Output() noexcept
+{
+    flush();
+}
+
+OutputBuffer& Output::slot(size_t index) noexcept
+{
+    return m_slots[index].buffer;
+}
+
+void Output::commit(size_t index) noexcept
+{
+    auto& buffer = m_slots[index].buffer;
+    if (buffer.size() >= FLUSH_THRESHOLD)
+    {
+        write(buffer.view());
+        buffer.clear();
+    }
+}
+
+void Output::flush() noexcept
+{
+    for (auto& slot: m_slots)
+    {
+        if (!slot.buffer.empty())
+        {
+            write(slot.buffer.view());
+            slot.buffer.clear();
+        }
+    }
+
+    release(m_holder);
+}
+
+bool Output::hold(const void* writer) noexcept
+{
+    std::lock_guard g {m_write_mutex};
+    if (!m_holder)
+    {
+        m_holder = writer;
+    }
+
+    return m_holder == writer;
+}
+
+void Output::write_held(const void* writer, std::string_view text) noexcept
+{
+    write(text, writer);
+}
+
+void Output::release(const void* writer) noexcept
+{
+    std::lock_guard g {m_write_mutex};
+    if (m_holder != writer)
+    {
+        return;
+    }
+
+    m_holder = nullptr;
+    write_locked(m_held);
+    m_held.clear();
+    m_held.shrink_to_fit();
+}
+
+uint64_t Output::bytes_written() const noexcept
+{
+    return m_bytes_written;
+}
+
+void Output::write(std::string_view text, const void* writer) noexcept
+{
+    std::lock_guard g {m_write_mutex};
+    if (m_holder && m_holder != writer)
+    {
+        // without the memory to keep it back, the text is written out of turn rather than lost
+        try
+        {
+            m_held.append(text);
+            return;
+        }
+        catch (const std::bad_alloc&)
+        {
+        }
+    }
+
+    write_locked(text);
+}
+
+void Output::write_locked(std::string_view text) noexcept
+{
+    // anything logged through iostreams so far goes first
+    std::cout.flush();
+
+    write_all(m_fd, text);
+    m_bytes_written += text.size();
+}
+
+OrderedGroup::OrderedGroup(Output& output) noexcept
+    : m_output {output}
+{
+}
+
+OrderedGroup::~OrderedGroup() noexcept
+{
+    if (m_holding)
+    {
+        m_output.release(this);
+    }
+}
+
+bool OrderedGroup::room(uint64_t index) noexcept
+{
+    std::lock_guard g {m_mutex};
+    return index < m_next + MAX_AHEAD;
+}
+
+void OrderedGroup::add(uint64_t index, std::string_view text, size_t slot)
+{
+    std::lock_guard g {m_mutex};
+    if (index != m_next)
+    {
+        // ahead of its turn
+        m_pending.emplace(index, text);
+        return;
+    }
+
+    m_text.append(text);
+    ++m_next;
+
+    // append the parts that were waiting for this one
+    for (auto it = m_pending.begin(); it != m_pending.end() && it->first == m_next; it = m_pending.erase(it))
+    {
+        m_text.append(it->second);
+        ++m_next;
+    }
+
+    write_in_turn(slot);
+}
+
+void OrderedGroup::close(uint64_t parts, size_t slot)
+{
+    std::lock_guard g {m_mutex};
+    m_parts = parts;
+    write_in_turn(slot);
+}
+
+void OrderedGroup::write_in_turn(size_t slot)
+{
+    // text that outgrows a slot is written through once the group holds the output, rather than kept until the end;
+    // the output stays held until the group is complete, so no other text comes between its parts
+    auto complete = m_next >= m_parts;
+    if (!m_holding && !complete && m_text.size() >= FLUSH_THRESHOLD)
+    {
+        m_holding = m_output.hold(this);
+    }
+
+    if (m_holding)
+    {
+        if (complete || m_text.size() >= FLUSH_THRESHOLD)
+        {
+            m_output.write_held(this, m_text);
+            m_text.clear();
+        }
+
+        if (complete)
+        {
+            m_output.release(this);
+            m_holding = false;
+        }
+        return;
+    }
+
+    if (complete && !m_text.empty())
+    {
+        m_output.slot(slot).append(m_text);
+        m_output.commit(slot);
+        m_text.clear();
+    }
+}
@@ -1,11 +1,27 @@
 #include "util/sys.h"
 
 #ifdef UNIX_BUILD
+#    include <dirent.h>
+#    include <fcntl.h>
+#    include <sys/stat.h>
 #    include <unistd.h>
 #elif defined WIN32_BUILD
+#    include <fcntl.h>
+#    include <io.h>
 #    include <windows.h>
 #endif
 
+#include <cstdio>
+
+#ifndef UNIX_BUILD
+#    include <filesystem>
+#endif
+
+#if defined X86_BUILD && defined _MSC_VER
+#    include <immintrin.h>
+#    include <intrin.h>
+#endif
+
 namespace util::sys {
 
 #if !(defined UNIX_BUILD || defined WIN32_BUILD)
@@ -27,6 +43,139 @@ unsigned long pagesize() noexcept
 #endif
 }
 
+const CpuFeatures& cpu_features() noexcept
+{
+    static const CpuFeatures features = [] {
+        CpuFeatures detected;
+#if defined X86_BUILD && (defined __GNUC__ || defined __clang__)
+        __builtin_cpu_init();
+        detected.sse2     = __builtin_cpu_supports("sse2");
+        detected.ssse3    = __builtin_cpu_supports("ssse3");
+        detected.avx2     = __builtin_cpu_supports("avx2");
+        detected.avx512bw = __builtin_cpu_supports("avx512bw");
+#elif defined X86_BUILD && defined _MSC_VER
+        int info[4] {};
+        __cpuid(info, 0);
+        auto max_leaf = info[0];
+
+        __cpuid(info, 1);
+        detected.sse2  = info[3] & (1 << 26);
+        detected.ssse3 = info[2] & (1 << 9);
+
+        // the OS must save the ymm/zmm registers on context switches
+        auto os_xsave  = (info[2] & (1 << 27)) != 0;
+        auto xcr0      = os_xsave ? _xgetbv(0) : 0;
+        auto os_avx    = (xcr0 & 0x6) == 0x6;
+        auto os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+        if (max_leaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            detected.avx2     = os_avx && (info[1] & (1 << 5));
+            detected.avx512bw = os_avx512 && (info[1] & (1 << 16)) && (info[1] & (1 << 30));
+        }
+#endif
+        return detected;
+    }();
+
+    return features;
+}
+
+#ifdef UNIX_BUILD
+namespace {
+
+/// Classifies an entry through stat, following symlinks to files but not to directories.
+EntryType stat_entry(int dir_fd, const char* name) noexcept
+{
+    struct stat info {};
+    if (::fstatat(dir_fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        return EntryType::Other;
+    }
+
+    if (S_ISLNK(info.st_mode))
+    {
+        return ::fstatat(dir_fd, name, &info, 0) == 0 && S_ISREG(info.st_mode) ? EntryType::File : EntryType::Other;
+    }
+
+    return S_ISREG(info.st_mode) ? EntryType::File : S_ISDIR(info.st_mode) ? EntryType::Directory : EntryType::Other;
+}
+
+} // namespace
+#endif
+
+bool list_directory(const char* path, const std::function<void(std::string_view name, EntryType type)>& callback) noexcept
+{
+#ifdef UNIX_BUILD
+    auto dir = ::opendir(path);
+    if (!dir)
+    {
+        return false;
+    }
+
+    while (auto entry = ::readdir(dir))
+    {
+        std::string_view name {entry->d_name};
+        if (name == "." || name == "..")
+        {
+            continue;
+        }
+
+        switch (entry->d_type)
+        {
+            case DT_REG:
+                callback(name, EntryType::File);
+                break;
+            case DT_DIR:
+                callback(name, EntryType::Directory);
+                break;
+            case DT_LNK:
+            case DT_UNKNOWN:
+                callback(name, stat_entry(::dirfd(dir), entry->d_name));
+                break;
+            default:
+                callback(name, EntryType::Other);
+        }
+    }
+
+    ::closedir(dir);
+    return true;
+#else
+    namespace fs = std::filesystem;
+
+    std::error_code ec;
+    fs::directory_iterator it {path, ec};
+    if (ec)
+    {
+        return false;
+    }
+
+    for (fs::directory_iterator end; it != end; it.increment(ec))
+    {
+        if (ec)
+        {
+            break;
+        }
+
+        // the iterator caches the type on Windows, so these don't cost a stat call
+        auto type = it->is_symlink(ec) ? (it->is_regular_file(ec) ? EntryType::File : EntryType::Other)
+                  : it->is_directory(ec) ? EntryType::Directory
+                  : it->is_regular_file(ec) ? EntryType::File
+                                            : EntryType::Other;
+        callback(it->path().filename().string(), type);
+    }
+
+    return true;
+#endif
+}
+
+void binary_stdin() noexcept
+{
+#ifdef WIN32_BUILD
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+}
+
 #ifdef WIN32_BUILD
 #    include <securitybaseapi.h>
 bool win32_can_read(const char* path) noexcept
@@ -1,16 +1,68 @@
 #include "util/thread_pool.h"
 
+#include <algorithm>
+#include <chrono>
+
 using namespace util::misc;
 
+namespace {
+
+constexpr size_t DEQUE_CAPACITY {4096};     //!< Tasks a worker can queue before running them inline.
+constexpr size_t MAX_QUEUE_CAPACITY {65536}; //!< Upper bound of the injection queue, in tasks.
+constexpr auto SPIN_ROUNDS {64};             //!< Failed searches for work before a worker parks.
+
+thread_local const void* tls_pool {nullptr}; //!< Pool that owns the current thread, if any.
+thread_local size_t tls_worker {0};          //!< Index of the current thread in its pool.
+
+/// Rounds up to a power of two, as required by the ring indexing.
+size_t ring_capacity(uint64_t tasks) noexcept
+{
+    size_t capacity {1};
+    while (capacity < std::min<uint64_t>(tasks, MAX_QUEUE_CAPACITY))
+    {
+        capacity <<= 1;
+    }
+
+    return capacity;
+}
+
+/// Adds to a counter that only the calling thread writes, without a locked instruction.
+void add_relaxed(std::atomic_uint64_t& counter, uint64_t amount) noexcept
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/// Returns the nanoseconds elapsed since a point in time.
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) noexcept
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/// xorshift step, used to pick steal victims without contention.
+uint64_t next_random(uint64_t& seed) noexcept
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+} // namespace
+
 ThreadPool::ThreadPool(uint64_t max_tasks, uint32_t max_threads) noexcept
-    : m_queue {max_tasks}, m_max_threads {max_threads}
+    : m_queue {ring_capacity(max_tasks)}, m_worker_stats(std::max<uint32_t>(max_threads, 1))
 {
-    // NOTE: two options: start all threads here OR start threads gradually in add_task()
+    // NOTE: all threads start here, since queued tasks may only be stolen by threads that already exist
+    auto count = std::max<uint32_t>(max_threads, 1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_deques.push_back(std::make_unique<Deque>(DEQUE_CAPACITY));
+    }
 
-    //    for (size_t i = 0; i < num_threads; ++i)
-    //    {
-    //        m_threads.emplace_back(&Queue::run, &m_queue);
-    //    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_threads.emplace_back(&ThreadPool::run, this, i);
+    }
 }
 
 ThreadPool::~ThreadPool() noexcept
@@ -18,21 +70,167 @@ ThreadPool::~ThreadPool() noexcept
     stop();
 }
 
-void ThreadPool::try_add_task(Task task) noexcept
+void ThreadPool::submit(Task* task) noexcept
+{
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+
+    if (tls_pool == this)
+    {
+        // a full deque means the workers are saturated; running the task here is the backpressure
+        if (!m_deques[tls_worker]->push(task))
+        {
+            add_relaxed(m_worker_stats[tls_worker].inlined, 1);
+            task->run();
+            delete task;
+            m_pending.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+    }
+    else if (!m_queue.push(task))
+    {
+        // block until a worker takes a task out of the injection queue
+        auto start = std::chrono::steady_clock::now();
+        std::unique_lock lk {m_space_mutex};
+        m_waiting_for_space.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_space_condition.wait(lk, [this, task] { return m_queue.push(task); });
+        m_waiting_for_space.fetch_sub(1);
+        m_blocked_ns.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+    }
+
+    wake_one();
+}
+
+ThreadPool::Task* ThreadPool::find_task(size_t worker, uint64_t& seed) noexcept
+{
+    if (auto task = m_deques[worker]->pop())
+    {
+        return task;
+    }
+
+    if (auto task = m_queue.pop())
+    {
+        // let a blocked producer refill the slot
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiting_for_space.load(std::memory_order_relaxed))
+        {
+            std::lock_guard g {m_space_mutex};
+            m_space_condition.notify_one();
+        }
+
+        return task;
+    }
+
+    // start from a random victim so that thieves don't all hit the same deque
+    auto count = m_deques.size();
+    auto start = next_random(seed) % count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto victim = (start + i) % count;
+        if (victim == worker)
+        {
+            continue;
+        }
+
+        if (auto task = m_deques[victim]->steal())
+        {
+            add_relaxed(m_worker_stats[worker].stolen, 1);
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
+int ThreadPool::current_worker() noexcept
+{
+    return tls_pool ? static_cast<int>(tls_worker) : -1;
+}
+
+bool ThreadPool::help() noexcept
+{
+    // outside the pool there is no own deque; start stealing from the first worker
+    thread_local uint64_t seed {0x2545f4914f6cdd1dULL};
+    auto task = tls_pool == this ? find_task(tls_worker, seed) : m_queue.pop();
+
+    for (size_t i = 0; !task && tls_pool != this && i < m_deques.size(); ++i)
+    {
+        task = m_deques[i]->steal();
+    }
+
+    if (!task)
+    {
+        return false;
+    }
+
+    execute(task);
+    return true;
+}
+
+void ThreadPool::execute(Task* task) noexcept
+{
+    task->run();
+    delete task;
+
+    if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        std::lock_guard g {m_idle_mutex};
+        m_idle_condition.notify_all();
+    }
+}
+
+bool ThreadPool::has_work() const noexcept
+{
+    if (!m_continue || !m_queue.empty())
+    {
+        return true;
+    }
+
+    return std::any_of(m_deques.begin(), m_deques.end(), [](const auto& deque) { return !deque->empty(); });
+}
+
+void ThreadPool::wake_one() noexcept
+{
+    // pairs with the fence in run(): either the worker sees the new task, or we see the parked worker
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_parked.load(std::memory_order_relaxed))
+    {
+        std::lock_guard g {m_park_mutex};
+        m_park_condition.notify_one();
+    }
+}
+
+void ThreadPool::hold() noexcept
+{
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::release() noexcept
 {
-    // add a new thread when one of these conditions is met
-    // 1, pool is empty or 2, pool is not at full capacity AND the queue is saturated
-    if (m_threads.empty() || (m_threads.size() < m_max_threads && m_queue.full()))
+    if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
     {
-        m_threads.emplace_back(&Queue::run, &m_queue);
+        std::lock_guard g {m_idle_mutex};
+        m_idle_condition.notify_all();
     }
+}
 
-    m_queue.enqueue(task);
+void ThreadPool::wait() noexcept
+{
+    std::unique_lock lk {m_idle_mutex};
+    m_idle_condition.wait(lk, [this] { return m_pending.load(std::memory_order_acquire) == 0; });
 }
 
 void ThreadPool::stop() noexcept
 {
-    m_queue.stop();
+    // block until all tasks are processed
+    wait();
+
+    {
+        std::lock_guard g {m_park_mutex};
+        m_continue = false;
+        m_park_condition.notify_all();
+    }
+
     for (auto& t: m_threads)
     {
         if (t.joinable())
@@ -42,80 +240,221 @@ void ThreadPool::stop() noexcept
     }
 }
 
-ThreadPool::Queue::~Queue() noexcept
+ThreadPool::Stats ThreadPool::stats() const noexcept
 {
-    if (m_continue)
+    Stats stats;
+    stats.blocked_ns = m_blocked_ns.load(std::memory_order_relaxed);
+    for (const auto& worker: m_worker_stats)
     {
-        this->stop();
+        stats.tasks += worker.tasks.load(std::memory_order_relaxed);
+        stats.stolen += worker.stolen.load(std::memory_order_relaxed);
+        stats.inlined += worker.inlined.load(std::memory_order_relaxed);
+        stats.idle_ns += worker.idle_ns.load(std::memory_order_relaxed);
     }
+
+    return stats;
+}
+
+void ThreadPool::run(size_t worker) noexcept
+{
+    tls_pool   = this;
+    tls_worker = worker;
+
+    // idle time runs from the first search for work that fails to the next one that succeeds
+    auto& stats = m_worker_stats[worker];
+    std::chrono::steady_clock::time_point idle_start {};
+
+    uint64_t seed {0x9e3779b97f4a7c15ULL ^ (worker + 1)};
+    auto idle_rounds {0};
+    while (m_continue)
+    {
+        if (auto task = find_task(worker, seed))
+        {
+            if (idle_rounds)
+            {
+                add_relaxed(stats.idle_ns, elapsed_ns(idle_start));
+            }
+
+            idle_rounds = 0;
+            add_relaxed(stats.tasks, 1);
+            execute(task);
+            continue;
+        }
+
+        if (!idle_rounds)
+        {
+            idle_start = std::chrono::steady_clock::now();
+        }
+
+        if (++idle_rounds < SPIN_ROUNDS)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // park until a producer queues a task; re-check for work after announcing ourselves to avoid lost wakeups
+        std::unique_lock lk {m_park_mutex};
+        m_parked.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_park_condition.wait(lk, [this] { return has_work(); });
+        m_parked.fetch_sub(1);
+        idle_rounds = 1;
+    }
+
+    if (idle_rounds)
+    {
+        add_relaxed(stats.idle_ns, elapsed_ns(idle_start));
+    }
+
+    tls_pool = nullptr;
 }
 
-ThreadPool::Queue::Queue(uint64_t max_tasks) noexcept
-    : m_max_tasks {max_tasks}
+ThreadPool::Deque::Deque(size_t capacity) noexcept
+    : m_slots {std::make_unique<std::atomic<Task*>[]>(capacity)}, m_mask {static_cast<int64_t>(capacity) - 1}
 {
 }
 
-void ThreadPool::Queue::enqueue(Task task) noexcept
+bool ThreadPool::Deque::push(Task* task) noexcept
 {
-    // doesn't really need sync with the current use case
-    if (full())
+    auto bottom = m_bottom.load(std::memory_order_relaxed);
+    auto top    = m_top.load(std::memory_order_acquire);
+    if (bottom - top > m_mask)
     {
-        std::unique_lock lk {m_condition_mutex};
-        m_condition.wait(lk, [this] { return !full(); });
+        return false;
     }
-    else
+
+    // release publishes the task to thieves that acquire m_bottom
+    m_slots[static_cast<size_t>(bottom & m_mask)].store(task, std::memory_order_relaxed);
+    m_bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+ThreadPool::Task* ThreadPool::Deque::pop() noexcept
+{
+    auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto top = m_top.load(std::memory_order_relaxed);
+
+    if (top > bottom)
     {
-        std::lock_guard g {m_mutex};
-        m_tasks.push(task);
+        // empty
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    auto task = m_slots[static_cast<size_t>(bottom & m_mask)].load(std::memory_order_relaxed);
+    if (top == bottom)
+    {
+        // last task: race the thieves for it
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            task = nullptr;
+        }
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
     }
 
-    m_condition.notify_one();
+    return task;
 }
 
-bool ThreadPool::Queue::empty() const noexcept
+ThreadPool::Task* ThreadPool::Deque::steal() noexcept
 {
-    std::lock_guard g {m_mutex};
-    return m_tasks.empty();
+    auto top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto bottom = m_bottom.load(std::memory_order_acquire);
+
+    if (top >= bottom)
+    {
+        return nullptr;
+    }
+
+    auto task = m_slots[static_cast<size_t>(top & m_mask)].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        // lost the race to another thief or the owner
+        return nullptr;
+    }
+
+    return task;
 }
 
-bool ThreadPool::Queue::full() const noexcept
+bool ThreadPool::Deque::empty() const noexcept
 {
-    std::lock_guard g {m_mutex};
-    return m_tasks.size() >= m_max_tasks;
+    return m_top.load(std::memory_order_acquire) >= m_bottom.load(std::memory_order_acquire);
 }
 
-void ThreadPool::Queue::stop() noexcept
+ThreadPool::Queue::Queue(size_t capacity) noexcept
+    : m_cells {std::make_unique<Cell[]>(capacity)}, m_mask {capacity - 1}
 {
-    // block until queue is empty
-    if (!empty() && m_continue)
+    for (size_t i = 0; i < capacity; ++i)
     {
-        std::unique_lock lk {m_condition_mutex};
-        m_condition.wait(lk, [this] { return empty(); });
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
     }
-
-    m_continue = false;
-    m_condition.notify_all();
 }
 
-void ThreadPool::Queue::run() noexcept
+bool ThreadPool::Queue::push(Task* task) noexcept
 {
-    while (m_continue)
+    auto position = m_enqueue_pos.load(std::memory_order_relaxed);
+    for (;;)
     {
-        std::unique_lock lk {m_condition_mutex};
-        m_condition.wait(lk, [this] { return !empty() || !m_continue; });
-        lk.unlock();
+        auto& cell    = m_cells[position & m_mask];
+        auto sequence = cell.sequence.load(std::memory_order_acquire);
+        auto diff     = static_cast<std::ptrdiff_t>(sequence - position);
 
-        // not RAII but avoids std::optional/nullptr/default constructed
-        // and doesn't lock during execution of task
-        std::unique_lock g {m_mutex};
-        if (!m_tasks.empty())
+        if (diff == 0)
         {
-            auto task = m_tasks.front();
-            m_tasks.pop();
-            g.unlock();
+            if (m_enqueue_pos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell.task = task;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            // full
+            return false;
+        }
+        else
+        {
+            position = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+ThreadPool::Task* ThreadPool::Queue::pop() noexcept
+{
+    auto position = m_dequeue_pos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        auto& cell    = m_cells[position & m_mask];
+        auto sequence = cell.sequence.load(std::memory_order_acquire);
+        auto diff     = static_cast<std::ptrdiff_t>(sequence - (position + 1));
 
-            m_condition.notify_all();
-            task();
+        if (diff == 0)
+        {
+            if (m_dequeue_pos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                auto task = cell.task;
+                cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+                return task;
+            }
+        }
+        else if (diff < 0)
+        {
+            // empty
+            return nullptr;
+        }
+        else
+        {
+            position = m_dequeue_pos.load(std::memory_order_relaxed);
         }
     }
 }
+
+bool ThreadPool::Queue::empty() const noexcept
+{
+    auto position = m_dequeue_pos.load(std::memory_order_relaxed);
+    auto sequence = m_cells[position & m_mask].sequence.load(std::memory_order_acquire);
+    return static_cast<std::ptrdiff_t>(sequence - (position + 1)) < 0;
+}